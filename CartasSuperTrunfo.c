@@ -9,28 +9,139 @@
 // 6. O jogador com mais cartas no final é o vencedor.
 // 7. Estatísticas de vitórias, empates e jogos são mantidas entre partidas.
 // 8. O jogo suporta salvar e carregar cartas de um arquivo binário.
+// 9. Cada partida é gravada em um replay (semente + escolhas) que pode ser
+//    reverificado sem interface com: CartasSuperTrunfo --replay [arquivo] [repeticoes]
 
 // Bibliotecas necessarias
+// Funções POSIX usadas além do C padrão (fileno, fsync) mesmo com -std=c11
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <stdint.h>
+#include <float.h>
+#include <stdarg.h>
+#include <math.h>
+#include <stdatomic.h>
+#ifndef _WIN32
+#include <pthread.h>
+// Entrada do teclado em modo cru (termios) com leitura sem bloqueio
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+// Servidor multiplayer (--servidor): epoll e sockets TCP/Unix
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 // Bibliotecas necessarias para as cores (#ifdef _WIN32 - #include <windows.h>)
 // Variáveis globais, constantes e tipos declarados: 
 // Constantes do programa para escabilidade
-#define MAX_CARTAS 100
+#define MAX_CARTAS 100000000  // limite de segurança por baralho (arquivos e memória)
 #define MAX_JOGADORES 2
 typedef struct Jogador Jogador;
 typedef struct Carta Carta;
 typedef struct Estatisticas Estatisticas;
+typedef struct Baralho Baralho;
 
 #define CARTAS_POR_JOGADOR 5
 #define ARQUIVO_CARTAS "cartas.bin"
+#define ARQUIVO_REPLAYS "replays.bin"
+// Primeiros 4 bytes de um cartas.bin no formato compacto ("STC2").
+// O formato antigo começa com a quantidade de cartas, sempre <= MAX_CARTAS.
+#define MAGICO_ARQUIVO_COMPACTO 0x32435453u
+
+// Catálogo de baralhos nomeados (manifesto e tamanho máximo de um nome)
+#define ARQUIVO_CATALOGO "catalogo.txt"
+#define MAX_NOME_BARALHO 32
+
+// Autosave: grava o baralho em segundo plano após AUTOSAVE_EDICOES alterações
+// ou AUTOSAVE_INTERVALO_SEG segundos depois da primeira alteração não gravada.
+#define AUTOSAVE_EDICOES 5
+#define AUTOSAVE_INTERVALO_SEG 30
+
+// Comandos aceitos durante a escolha de carta (ver escolher_carta_comandos)
+#define CMD_ESCOLHA 0
+#define CMD_DESISTIR 1
+#define CMD_SAIR 2
+
+// Entrada do teclado (ver tecla_ler): teclas comuns são o próprio byte.
+#define ENTRADA_FILA 256              // eventos de tecla pendentes
+#define ENTRADA_INTERVALO_MS 1000     // redesenho/tarefas enquanto nenhuma tecla chega
+#define ENTRADA_ESC_MS 50             // espera pelo resto de uma sequência Esc partida entre leituras
+#define TECLA_FIM (-1)                // fim da entrada
+#define TECLA_TEMPO (-2)              // prazo acabou sem tecla
+#define TECLA_ESC 27
+#define TECLA_APAGAR 127
+#define TECLA_CIMA 0x101
+#define TECLA_BAIXO 0x102
+#define TECLA_DIREITA 0x103
+#define TECLA_ESQUERDA 0x104
+
+// Resultado de uma partida gravado no replay
+#define RESULTADO_JOGADOR1 0
+#define RESULTADO_JOGADOR2 1
+#define RESULTADO_EMPATE 2
+#define RESULTADO_ABORTADA 3
+
+// Ação não realizada no turno (ex: computador não joga quando o humano desiste)
+#define ACAO_NENHUMA 0xFF
+
+// Bits de validade dos campos derivados (Carta.derivados_validos).
+// Os derivados são calculados sob demanda pelos acessores carta_* e
+// invalidados (invalidar_derivados) quando um campo original muda.
+#define DERIVADO_DENSIDADE 0x01
+#define DERIVADO_PIB_PER_CAPITA 0x02
+#define DERIVADO_SUPER_PODER 0x04
+
+// Distribuição equilibrada (linha "distribuicao = equilibrada" em distribuicao.txt):
+// cada jogador recebe uma carta de cada faixa de força, em pares de força
+// parecida, com limite de cartas do mesmo estado por mão.
+#define ARQUIVO_DISTRIBUICAO "distribuicao.txt"
+#define DISTRIBUICAO_JANELA 32         // parceiros candidatos de cada lado da carta sorteada
+#define DISTRIBUICAO_ESTADOS 27        // 'A'..'Z' e "outros"
+#define DISTRIBUICAO_TOLERANCIA_PADRAO 0.10f // fração da soma média de uma mão
+#define DISTRIBUICAO_MAX_ESTADO_PADRAO 2
+#define DISTRIBUICAO_PARTIDAS_PADRAO 5000000 // --distribuir
+
+// Gerador de baralhos sintéticos e otimizador de equilíbrio (--gerar)
+#define GERADOR_BLOCO 65536           // cartas por bloco (cada bloco tem semente própria)
+#define GERADOR_TAREFAS 8             // threads do gerador
+#define OTIMIZADOR_CADEIAS 8          // cadeias de têmpera simulada, uma por thread
+#define OTIMIZADOR_RODADAS 10         // ao fim de cada rodada todas recomeçam da melhor
+#define OTIMIZADOR_PARTIDAS 2048      // partidas sem interface por avaliação
+#define OTIMIZADOR_PASSOS_PADRAO 100000 // passos por cadeia
+#define ALVO_ESPALHAMENTO_PADRAO 4.0  // razão p90/p10 desejada para o super_poder
+
+// Exportação (--exportar e menu principal)
+#define FORMATO_CSV 0
+#define FORMATO_JSONL 1
+#define FORMATO_COLUNAS 2
+#define EXPORTACAO_BUFFER (4u << 20)  // 4 MiB por escrita
+#define EXPORTACAO_REGISTRO 1024      // maior registro de texto possível
+#define EXPORTACAO_GRUPO 16384        // linhas por grupo no formato colunar
+
+// Teste de estresse da publicação para leitores concorrentes (--estresse)
+#define ESTRESSE_CARTAS_PADRAO 10000
+#define ESTRESSE_SEGUNDOS_PADRAO 2.0
+#define ESTRESSE_AMOSTRA 64           // cartas lidas por leitura
+#define ESTRESSE_CONFERENCIA 256      // a cada tantas leituras refaz a impressão inteira
 
 // Estrutura que representa uma carta do jogo.
 // Cada carta contém atributos originais e campos derivados
-// (densidade, PIB per capita e super_poder).
+// (densidade, PIB per capita e super_poder), estes calculados sob demanda.
 typedef struct Carta {
     char estado;                // Letra do estado (A-Z)
     char codigo[5];             // Código da carta (ex: A01)
@@ -41,9 +152,34 @@ typedef struct Carta {
     int num_pontos_turisticos;  // Número de pontos turísticos
     float densidade_populacional; // População / área (derivado)
     float pib_per_capita;        // (pib * 1e9) / populacao (derivado)
-    float super_poder;           // valor normalizado (0-100) (derivado)
+    float super_poder;           // fórmula de pontuação configurável (derivado)
+    unsigned char derivados_validos; // bits DERIVADO_* já calculados
 } Carta;
 
+// Layout de Carta gravado pelo formato antigo de cartas.bin (antes dos bits
+// de validade). Mantido apenas para leitura de arquivos antigos.
+typedef struct CartaArquivoV1 {
+    char estado;
+    char codigo[5];
+    char nome_cidade[50];
+    int populacao;
+    float area;
+    float pib;
+    int num_pontos_turisticos;
+    float densidade_populacional;
+    float pib_per_capita;
+    float super_poder;
+} CartaArquivoV1;
+
+// Baralho de tamanho variável (cresce conforme cadastro ou carga de arquivos).
+typedef struct Baralho {
+    Carta *cartas;
+    int n;
+    int capacidade;
+    uint32_t versao;                  // muda a cada alteração (ver baralho_modificado)
+    int iguais_inicio, iguais_fim;    // cartas no começo/fim iguais às da última publicação (ver baralho_alterado)
+} Baralho;
+
 // Estrutura genérica para representar o estado de um jogador (humano ou computador).
 typedef struct Jogador {
     Carta cartas[CARTAS_POR_JOGADOR]; // cartas em mãos
@@ -58,11 +194,414 @@ typedef struct Estatisticas {
     int empates;                      // empates entre partidas
 } Estatisticas;
 
+// Fórmula de pontuação (super_poder) compilada para bytecode de pilha.
+// Cada posição da pilha é uma coluna de até FORMULA_LOTE cartas, então cada
+// instrução é um laço simples sobre o lote (vetorizável pelo compilador).
+#define ARQUIVO_FORMULA "formula.txt"
+#define FORMULA_PADRAO "populacao + area + pib + pontos + pib_per_capita + inv(densidade)"
+#define FORMULA_LOTE 256
+#define FORMULA_MAX_OPS 64
+#define FORMULA_MAX_PILHA 16
+#define FORMULA_MAX_NORM 8
+
+// Atributos que a fórmula pode ler (colunas do lote)
+#define CAMPO_POPULACAO 0
+#define CAMPO_AREA 1
+#define CAMPO_PIB 2
+#define CAMPO_PONTOS 3
+#define CAMPO_DENSIDADE 4
+#define CAMPO_PIB_PER_CAPITA 5
+#define FORMULA_CAMPOS 6
+
+// Instruções (arg: campo, índice da constante ou da normalização)
+#define OP_CAMPO 0
+#define OP_CONSTANTE 1
+#define OP_SOMA 2
+#define OP_SUBTRACAO 3
+#define OP_MULTIPLICACAO 4
+#define OP_DIVISAO 5
+#define OP_NEGACAO 6
+#define OP_LOG 7
+#define OP_INVERSO 8
+#define OP_NORMALIZA 9
+#define OP_MINIMO 10
+#define OP_MAXIMO 11
+#define OP_COMBINACAO 12              // soma ponderada de campos em uma só passada
+#define FORMULA_MAX_TERMOS 8          // termos por OP_COMBINACAO
+
+// Pontuação em ponto fixo (linha "pontuacao = fixa" em formula.txt):
+// valores Q47.16 em int64_t (FIXO_UM = 1.0).
+#define FIXO_BITS 16
+#define FIXO_UM ((int64_t)1 << FIXO_BITS)
+#define FIXO_MAX INT64_MAX            // saturação (o mínimo é -FIXO_MAX)
+#define FIXO_LN2_Q32 2977044472LL     // ln(2) * 2^32
+
+typedef struct Formula {
+    unsigned char op[FORMULA_MAX_OPS];
+    unsigned char arg[FORMULA_MAX_OPS];
+    float constantes[FORMULA_MAX_OPS];
+    unsigned char termo_campo[FORMULA_MAX_OPS]; // termos das combinações (campo e peso)
+    float termo_peso[FORMULA_MAX_OPS];
+    unsigned char comb_inicio[FORMULA_MAX_OPS], comb_n[FORMULA_MAX_OPS];
+    int n_ops, n_constantes, n_termos, n_comb;
+    int n_norm;
+    int pos_norm[FORMULA_MAX_NORM];   // posição de cada OP_NORMALIZA (em ordem pós-fixa)
+    float norm_min[FORMULA_MAX_NORM], norm_max[FORMULA_MAX_NORM];
+    int64_t constantes_fixas[FORMULA_MAX_OPS]; // versões em ponto fixo (modo fixa)
+    int64_t termo_peso_fixo[FORMULA_MAX_OPS];
+    int64_t norm_min_fixo[FORMULA_MAX_NORM], norm_max_fixo[FORMULA_MAX_NORM];
+    int fixa;                         // 1 = pontuação em ponto fixo
+    int norm_valida;                  // mín/máx calculados para (norm_cartas, norm_n)
+    const Carta *norm_cartas;
+    int norm_n;
+    int padrao;                       // 1 se equivale a FORMULA_PADRAO
+    int soma_direta;                  // só combinação [+ inv(campo)]: ver executar_soma_direta
+    char texto[256];
+} Formula;
+
+// Forma compacta de uma carta (28 bytes contra os 88 de Carta):
+// o nome vira índice em um pool de nomes internados e os campos derivados
+// não são guardados (são recalculados ao expandir).
+// Usada só no arquivo (cartas.bin e shards do catálogo) e no histórico de
+// versões; o baralho em uso, as consultas, os instantâneos publicados e a
+// exportação continuam trabalhando sobre Carta completa.
+typedef struct CartaCompacta {
+    uint32_t populacao;
+    float area;
+    float pib;
+    uint32_t nome;                    // índice em PoolNomes
+    uint32_t num_pontos_turisticos;
+    char estado;
+    char codigo[4];                   // sem '\0' quando tem 4 caracteres
+} CartaCompacta;
+
+// Pool de nomes internados: cada nome distinto é guardado uma única vez.
+typedef struct PoolNomes {
+    char *texto;                      // nomes concatenados, cada um terminado em '\0'
+    size_t tam_texto, cap_texto;
+    uint32_t *inicio;                 // deslocamento de cada nome em texto
+    int n, cap;
+    int32_t *tabela;                  // hash aberto: índice do nome ou -1
+    int cap_tabela;                   // potência de 2
+} PoolNomes;
+
+typedef struct BaralhoCompacto {
+    CartaCompacta *cartas;
+    int n;
+    PoolNomes nomes;
+} BaralhoCompacto;
+
+// Histórico de versões do baralho (copy-on-write):
+// uma Versao é uma tabela de blocos de até VERSAO_BLOCO cartas compactas.
+// Tabelas e blocos têm contagem de referências e são compartilhados entre
+// versões; guardar uma versão custa só uma referência, e alterar uma versão
+// compartilhada copia a tabela de ponteiros e apenas o bloco alterado.
+#define VERSAO_BLOCO 1024
+#define HISTORICO_NIVEIS 64           // níveis de desfazer/refazer
+#define MAX_VERSOES_NOMEADAS 32
+#define MAX_DESCRICAO_VERSAO 64
+#define DIFERENCAS_EXIBIDAS 20        // linhas por lado na comparação de versões
+
+typedef struct BlocoVersao {
+    int refs;
+    int n;
+    CartaCompacta cartas[VERSAO_BLOCO];
+} BlocoVersao;
+
+typedef struct Versao {
+    int refs;
+    int n_cartas;
+    int n_blocos, cap_blocos;
+    BlocoVersao **blocos;
+} Versao;
+
+typedef struct EntradaHistorico {
+    Versao *versao;
+    char descricao[MAX_DESCRICAO_VERSAO]; // ação registrada ou nome da versão
+} EntradaHistorico;
+
+typedef struct Historico {
+    PoolNomes nomes;                  // nomes de todas as versões (só cresce)
+    Versao *atual;                    // mesmo conteúdo do baralho em uso (NULL = desativado)
+    EntradaHistorico desfazer[HISTORICO_NIVEIS];
+    EntradaHistorico refazer[HISTORICO_NIVEIS];
+    int n_desfazer, n_refazer;
+    EntradaHistorico nomeadas[MAX_VERSOES_NOMEADAS];
+    int n_nomeadas;
+} Historico;
+
+// Mapa de zona: mínimos/máximos de um bloco de cartas (ou de um shard inteiro)
+// usados pelas consultas para descartar blocos sem olhar carta por carta.
+typedef struct ZonaBloco {
+    int32_t pop_min, pop_max;
+    float area_min, area_max;
+    float pib_min, pib_max;
+    uint32_t estados;                 // bit (letra - 'A') de cada estado presente
+} ZonaBloco;
+
+// Catálogo de baralhos nomeados. Cada baralho é dividido em shards
+// (arquivos no formato compacto) que podem ser lidos e gravados em paralelo.
+// O manifesto (ARQUIVO_CATALOGO) tem uma linha por shard:
+//   <baralho> <indice> <arquivo> <n_cartas> [<pop_min> <pop_max> <area_min>
+//   <area_max> <pib_min> <pib_max> <estados_hex>]
+// A parte entre colchetes é o mapa de zona do shard (opcional).
+typedef struct EntradaCatalogo {
+    char baralho[MAX_NOME_BARALHO];
+    int indice;
+    char arquivo[MAX_NOME_BARALHO + 32]; // <baralho>.g<geração>.<índice>.bin
+    int n_cartas;
+    int tem_zona;                     // 1 se o manifesto trouxe o mapa de zona
+    ZonaBloco zona;
+} EntradaCatalogo;
+
+typedef struct Catalogo {
+    EntradaCatalogo *shards;
+    int n, cap;
+} Catalogo;
+
+// Consulta sobre o baralho (ver interpretar_consulta).
+#define ORDEM_NENHUMA 0
+#define ORDEM_POPULACAO 1
+#define ORDEM_AREA 2
+#define ORDEM_PIB 3
+#define ORDEM_PONTOS 4
+#define ORDEM_SUPER_PODER 5
+#define ORDEM_NOME 6
+
+typedef struct Consulta {
+    uint32_t estados;                 // 0 = todos; senão bit (letra - 'A')
+    int32_t pop_min, pop_max;
+    float area_min, area_max;
+    float pib_min, pib_max;
+    char prefixo[50];                 // prefixo do nome da cidade ("" = todos)
+    int ordem;                        // ORDEM_*
+    int decrescente;
+    int limite;                       // 0 = sem limite
+} Consulta;
+
+// Índice colunar do baralho para consultas: uma coluna por atributo filtrável
+// e um mapa de zona a cada BLOCO_CONSULTA cartas. Reconstruído quando a
+// versão do baralho muda.
+#define BLOCO_CONSULTA 1024
+typedef struct IndiceConsulta {
+    const Carta *cartas;
+    int n;
+    uint32_t versao;
+    int32_t *populacao;
+    float *area;
+    float *pib;
+    uint32_t *estado_bit;
+    ZonaBloco *zonas;
+    int n_blocos;
+} IndiceConsulta;
+
+// Publicação do baralho para leitores concorrentes (RCU com épocas):
+// o escritor publica cópias imutáveis (Instantaneo) trocando um ponteiro
+// atômico; leitores nunca esperam nem bloqueiam o escritor. Um instantâneo
+// substituído só é liberado quando todo leitor ativo entrou depois da troca.
+// Como no histórico, um instantâneo é uma tabela de blocos de até
+// VERSAO_BLOCO cartas com contagem de referências: publicar uma alteração
+// copia só os blocos do trecho alterado e compartilha os outros com o
+// instantâneo anterior.
+#define MAX_LEITORES 64
+#define MARCA_INSTANTANEO 0x54534E49u // "INST"; apagada antes de liberar
+#define IMPRESSAO_BASE 1099511628211u // primo do FNV de 64 bits (ver impressao_bloco)
+
+typedef struct BlocoInstantaneo {
+    int refs;                         // só o escritor mexe
+    int n;
+    uint64_t impressao;               // impressao_bloco das cartas
+    uint64_t potencia;                // IMPRESSAO_BASE^n, para compor com os outros blocos
+    Carta cartas[];                   // imutáveis, com todos os derivados calculados
+} BlocoInstantaneo;
+
+typedef struct Instantaneo {
+    BlocoInstantaneo **blocos;
+    int *inicio;                      // índice da primeira carta de cada bloco (n_blocos + 1 entradas)
+    int n_blocos;
+    int n;
+    uint32_t versao;                  // Baralho.versao publicado
+    uint64_t impressao;               // impressões dos blocos compostas na ordem
+    _Atomic(Carta *) contiguo;        // cópia contínua (ver instantaneo_cartas)
+    uint32_t marca;                   // MARCA_INSTANTANEO enquanto vivo
+    uint_fast64_t epoca_retirada;
+    struct Instantaneo *proximo;      // fila de retirados aguardando liberação
+} Instantaneo;
+
+// Cada leitor anuncia a época em que entrou (0 = fora de leitura), em uma
+// linha de cache própria para não disputar com os outros leitores.
+typedef struct SlotLeitor {
+    _Alignas(64) atomic_uint_fast64_t epoca;
+    atomic_int ocupado;
+} SlotLeitor;
+
+typedef struct Publicacao {
+    _Atomic(Instantaneo *) atual;
+    atomic_uint_fast64_t epoca;       // época global (começa em 1)
+    SlotLeitor leitores[MAX_LEITORES];
+    Instantaneo *retirados;           // só o escritor mexe (um escritor por vez)
+    int n_retirados, max_retirados;
+    long publicados, liberados;
+    long copiadas;                    // cartas copiadas para blocos novos, somando as publicações
+} Publicacao;
+
+// Estado do autosave. O menu avisa a cada alteração publicada e a thread de
+// gravação escreve apenas o instantâneo mais recente: alterações que chegam
+// enquanto outra espera são agrupadas (coalescidas).
+typedef struct Autosave {
+#ifndef _WIN32
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+    int ativo;                        // 1 se a thread de gravação está rodando
+    Publicacao *publicacao;           // de onde vem o baralho a gravar
+    int leitor;                       // slot de leitor da gravação
+    int pendente;                     // há alteração publicada ainda não gravada
+    int edicoes;                      // alterações acumuladas desde a última gravação
+    time_t prazo;                     // quando o snapshot pendente deve ser gravado
+    int encerrar;
+    int concluidos, falhas, coalescidos; // contadores desde o último relatório
+    int cartas_gravadas;              // tamanho do último baralho gravado
+} Autosave;
+
+// Partida sem interface, com as mãos guardadas como índices no baralho.
+// Usada pelo replay e pelo servidor; segue as mesmas regras das partidas ao vivo.
+typedef struct PartidaIndices {
+    int mao[MAX_JOGADORES][CARTAS_POR_JOGADOR];
+    int restantes[MAX_JOGADORES];
+    int vitorias[MAX_JOGADORES];
+    int empates;
+    uint32_t rng;                     // continua do embaralhamento (escolhas do computador)
+} PartidaIndices;
+
+// Regras da distribuição (distribuicao.txt). Sem o arquivo, o baralho é
+// embaralhado inteiro, como sempre foi.
+typedef struct RegrasDistribuicao {
+    int equilibrada;                  // 0 = embaralhamento uniforme
+    float tolerancia;                 // diferença máxima entre as somas das mãos (fração da soma média)
+    int max_por_estado;               // cartas do mesmo estado por mão (0 = sem limite)
+} RegrasDistribuicao;
+
+// Uma carta do baralho ordenado por força (24 bytes: um acesso à memória por carta sorteada).
+typedef struct PosicaoDistribuicao {
+    int64_t forca;                    // cartas_forca
+    int carta;                        // índice no baralho
+    int posicao;                      // em Distribuicao.posicoes
+    unsigned char antes, depois;      // parceiros dentro da folga: [posicao - antes, posicao + depois]
+    unsigned char estado;             // 0..DISTRIBUICAO_ESTADOS-1
+} PosicaoDistribuicao;
+
+// Índices pré-calculados de um baralho para distribuir_equilibrado.
+// Posições = cartas em ordem de força; faixa f = posições [f*n/5, (f+1)*n/5).
+typedef struct Distribuicao {
+    int n;
+    PosicaoDistribuicao *posicoes;
+    PosicaoDistribuicao *elegiveis;   // cópias das posições com parceiro, por faixa e estado
+    int balde[CARTAS_POR_JOGADOR][DISTRIBUICAO_ESTADOS + 1]; // início de cada (faixa, estado) em elegiveis
+    int64_t folga;                    // diferença máxima garantida entre as mãos
+    int max_por_estado;
+    int excluidas;                    // cartas sem parceiro dentro da folga
+    int faixas_sem_garantia;          // faixas sem nenhum par dentro da folga
+} Distribuicao;
+
+// Distribuição do último instantâneo jogado no menu (ver distribuicao_da_versao).
+typedef struct CacheDistribuicao {
+    Distribuicao d;
+    int pronta;
+    uint32_t versao;                  // Baralho.versao para a qual d foi preparada
+    int n;
+} CacheDistribuicao;
+
+
+// Registro compacto de uma partida para reprodução determinística.
+// Cada ação ocupa 1 byte: (comando << 4) | índice da carta escolhida.
+// As escolhas do computador são recalculadas a partir da semente; o valor
+// gravado serve apenas para conferência.
+typedef struct Replay {
+    uint32_t semente;                 // semente do gerador usado na partida
+    uint32_t impressao_baralho;       // impressão digital do baralho (ver impressao_baralho)
+    int32_t n_cartas;                 // tamanho do baralho no início da partida
+    unsigned char modo_computador;    // 1 = 1xComputador, 0 = 1x1
+    unsigned char n_turnos;           // turnos efetivamente registrados
+    unsigned char resultado;          // RESULTADO_*
+    unsigned char acoes[CARTAS_POR_JOGADOR][MAX_JOGADORES];
+} Replay;
+
+#ifdef __linux__
+// Servidor multiplayer: um único laço epoll atende todas as mesas.
+// Cada conexão é uma máquina de estados alimentada por linhas de texto.
+#define CONEXAO_MODO 0                // aguardando "1x1" ou "computador"
+#define CONEXAO_AGUARDANDO 1          // 1x1 aguardando oponente
+#define CONEXAO_JOGANDO 2
+#define SERVIDOR_PORTA_PADRAO 5050
+#define REPLAYS_LOTE 1024             // replays acumulados antes de acordar o gravador
+#define REPLAYS_INTERVALO_SEG 1       // tempo máximo de um replay só na memória
+
+typedef struct Conexao {
+    int fd;
+    int estado;                       // CONEXAO_*
+    int mesa;                         // índice em Servidor.mesas (-1 = nenhuma)
+    int jogador;                      // posição na mesa (0 ou 1)
+    int oponente_fd;                  // conexão do oponente (-1 = computador/nenhum)
+    int fechar;                       // encerrar assim que a saída for enviada
+    int meio_fechada;                 // saída já encerrada (shutdown); espera o cliente fechar
+    char entrada[256];                // linha parcial recebida
+    size_t n_entrada;
+    char *saida;                      // dados ainda não enviados
+    size_t n_saida, cap_saida;
+} Conexao;
+
+typedef struct Mesa {
+    int ativa;
+    int modo_computador;
+    int fd[MAX_JOGADORES];            // conexão de cada jogador (-1 = computador)
+    int turno;
+    int pronto[MAX_JOGADORES];        // jogador já enviou a ação do turno
+    int escolha[MAX_JOGADORES];
+    int cmd[MAX_JOGADORES];
+    PartidaIndices partida;
+    Replay rep;
+} Mesa;
+
+// Gravador de replays do servidor: o laço epoll só copia o replay para a
+// fila; uma thread grava a fila em lotes (sem disco no laço de eventos).
+typedef struct GravadorReplays {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int ativo;                        // 1 se a thread está rodando (senão grava na hora)
+    Replay *fila;                     // preenchida pelo laço epoll
+    int n, cap;
+    int encerrar;
+    long perdidos;                    // replays que não puderam ser gravados
+} GravadorReplays;
+
+typedef struct Servidor {
+    int epoll_fd, escuta_fd;
+    Conexao **conexoes;               // indexado pelo fd
+    int cap_conexoes;
+    Mesa *mesas;
+    int n_mesas, cap_mesas;
+    int *mesas_livres;                // pilha de mesas reaproveitáveis
+    int n_livres;
+    int aguardando_fd;                // conexão 1x1 esperando oponente (-1 = nenhuma)
+    Carta *baralho;
+    int n_cartas;
+    int *ordem;                       // vetor auxiliar de partida_indices_iniciar
+    Distribuicao *distribuicao;       // NULL = distribuição uniforme
+    GravadorReplays gravador;
+    long partidas_concluidas;
+} Servidor;
+#endif
+
 // Funções de cor no terminal (compatível Windows / Unix)
 // Implementação específica por plataforma:
 
 #ifdef _WIN32
 #include <windows.h>
+#include <conio.h>                    // _kbhit/_getch (entrada do teclado)
+#include <io.h>
 // set_color: define cor no console Windows
 void set_color(int color) { SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), color); }
 // reset_color: restaura cor padrão no Windows
@@ -75,26 +614,43 @@ void reset_color() { printf("\033[0m"); }
 #endif
 
 // Function prototypes
-void embaralhar_cartas(Carta *cartas, int n);
+uint32_t rng_proximo(uint32_t *estado);
+void embaralhar_cartas(Carta *cartas, int n, uint32_t *rng);
+void iniciar_replay(Replay *r, const Carta *baralho, int n_cartas, uint32_t semente, int modo_computador);
+void registrar_acao_replay(Replay *r, int turno, int jogador, int escolha, int cmd);
+void gravar_replay(const Replay *r);
 void distribuir_cartas(Carta *baralho, int n_cartas, Jogador *jogadores, int modo_computador);
+Carta *montar_mesa(const Carta *baralho, int n_cartas, const Distribuicao *d, uint32_t *rng);
+int distribuir_equilibrado(const Distribuicao *d, uint32_t *rng, int mao[MAX_JOGADORES][CARTAS_POR_JOGADOR]);
 void exibe_menu_batalha(void);
 void exibir_cartas_jogador(const Jogador *j, int jogador_id);
 void exibir_cartas_jogador_computador(const Jogador *j, int jogador_id, int eh_computador);
-void limpar_buffer_stdin(void);
+void entrada_iniciar(void);
+int ler_opcao(const char *prompt, int max, int esc_volta);
 void remover_carta(Jogador *j, int idx);
-void exibir_resultado_turno(float sp1, float sp2, int *v1, int *v2, int *empates);
-void exibir_resultado_turno_computador(float sp1, float sp2, int *v1, int *v2, int *empates);
-void exibir_cartas_resumido(const Carta *cartas, int n);
-void exibir_carta(const Carta *c);
-void apagar_carta(Carta *cartas, int *n_cartas);
+void exibir_resultado_turno(const Carta *c1, const Carta *c2, int *v1, int *v2, int *empates);
+void exibir_resultado_turno_computador(const Carta *c1, const Carta *c2, int *v1, int *v2, int *empates);
+int comparar_super_poder(const Carta *a, const Carta *b);
+void exibir_cartas_resumido(Carta *cartas, int n);
+void exibir_carta(Carta *c);
+void garantir_derivados(Carta *cartas, int n);
+uint32_t impressao_baralho(const Carta *cartas, int n);
+static uint64_t impressao_bloco(const Carta *cartas, int n, uint64_t *potencia);
+int apagar_carta(Carta *cartas, int *n_cartas);
 static int escolher_carta_comandos(Jogador *j, int jogador_id, int *cmd);
 
+// Gerador da sessão: semeado em main e usado para sortear a semente de cada partida.
+static uint32_t rng_sessao = 2463534242u;
+
+// Regras de distribuição em uso (ver carregar_regras_distribuicao).
+static RegrasDistribuicao regras_distribuicao = {0, DISTRIBUICAO_TOLERANCIA_PADRAO, DISTRIBUICAO_MAX_ESTADO_PADRAO};
+
 // implementação das funções
 // apos decisao de qual tipo de partida em menu antes da batalha quue toma decisao para qual caminho seguir
 
 
 // Implementação: partida humano x computador
-void jogar_partida_1xComputador(Carta *baralho, int n_cartas, Estatisticas *estat) {
+void jogar_partida_1xComputador(Carta *baralho, int n_cartas, const Distribuicao *dist, Estatisticas *estat) {
     if (n_cartas < CARTAS_POR_JOGADOR * MAX_JOGADORES) {
         printf("Não há cartas suficientes para iniciar a partida.\n");
         return;
@@ -108,9 +664,17 @@ void jogar_partida_1xComputador(Carta *baralho, int n_cartas, Estatisticas *esta
         jogadores[i].empates = 0;
     }
 
-    // Embaralha e distribui
-    embaralhar_cartas(baralho, n_cartas);
-    distribuir_cartas(baralho, n_cartas, jogadores, 1); // modo computador
+    // Derivados do baralho inteiro só são calculados quando há partida
+    garantir_derivados(baralho, n_cartas);
+
+    // Embaralha uma cópia (o baralho cadastrado mantém a ordem) e distribui
+    Replay rep;
+    uint32_t rng = rng_proximo(&rng_sessao);
+    iniciar_replay(&rep, baralho, n_cartas, rng, 1);
+    Carta *mesa = montar_mesa(baralho, n_cartas, dist, &rng);
+    if (!mesa) { printf("Memória insuficiente para iniciar a partida.\n"); return; }
+    distribuir_cartas(mesa, CARTAS_POR_JOGADOR * MAX_JOGADORES, jogadores, 1); // modo computador
+    free(mesa);
 
     int vitorias_turno[2] = {0, 0};
     int empates_turno = 0;
@@ -127,13 +691,15 @@ void jogar_partida_1xComputador(Carta *baralho, int n_cartas, Estatisticas *esta
         // Humano escolhe (comandos suportados)
         int cmd_h = 0;
         int escolha_h = escolher_carta_comandos(&jogadores[0], 0, &cmd_h);
-        if (cmd_h == 2) {
-            limpar_buffer_stdin();
+        registrar_acao_replay(&rep, turno, 0, escolha_h, cmd_h);
+        if (cmd_h == CMD_SAIR) {
+            rep.resultado = RESULTADO_ABORTADA;
+            gravar_replay(&rep);
             memset(estat, 0, sizeof(*estat));
             printf("Retornando ao menu principal. Estatísticas da partida atual descartadas.\n");
             return;
         }
-        if (cmd_h == 1) {
+        if (cmd_h == CMD_DESISTIR) {
             // Humano desistiu
             printf("Humano desistiu do turno! Computador vence este turno.\n");
             vitorias_turno[1]++;
@@ -145,7 +711,8 @@ void jogar_partida_1xComputador(Carta *baralho, int n_cartas, Estatisticas *esta
         // Computador escolhe (estratégia simples: carta aleatória)
         int escolha_c;
         if (jogadores[1].cartas_restantes > 0) {
-            escolha_c = rand() % jogadores[1].cartas_restantes;
+            escolha_c = (int)(rng_proximo(&rng) % (uint32_t)jogadores[1].cartas_restantes);
+            registrar_acao_replay(&rep, turno, 1, escolha_c, CMD_ESCOLHA);
             // Informa escolha do computador (nome da cidade) ao jogador
             printf("Computador jogou: %s (carta %d)\n", jogadores[1].cartas[escolha_c].nome_cidade, escolha_c + 1);
         } else {
@@ -153,189 +720,5021 @@ void jogar_partida_1xComputador(Carta *baralho, int n_cartas, Estatisticas *esta
             break; // Sai do loop se não há cartas
         }
 
-        // Compara super poderes
-        float sp_h = jogadores[0].cartas[escolha_h].super_poder;
-        float sp_c = jogadores[1].cartas[escolha_c].super_poder;
-        exibir_resultado_turno_computador(sp_h, sp_c, &vitorias_turno[0], &vitorias_turno[1], &empates_turno);
+        // Compara super poderes
+        exibir_resultado_turno_computador(&jogadores[0].cartas[escolha_h], &jogadores[1].cartas[escolha_c],
+                                          &vitorias_turno[0], &vitorias_turno[1], &empates_turno);
+
+        // Remove cartas jogadas (remover maior índice primeiro para evitar deslocamento incorreto)
+        if (escolha_h > escolha_c) {
+            remover_carta(&jogadores[0], escolha_h);
+            remover_carta(&jogadores[1], escolha_c);
+        } else {
+            remover_carta(&jogadores[1], escolha_c);
+            remover_carta(&jogadores[0], escolha_h);
+        }
+    }
+
+    // Grava o replay da partida
+    if (vitorias_turno[0] > vitorias_turno[1]) rep.resultado = RESULTADO_JOGADOR1;
+    else if (vitorias_turno[1] > vitorias_turno[0]) rep.resultado = RESULTADO_JOGADOR2;
+    else rep.resultado = RESULTADO_EMPATE;
+    gravar_replay(&rep);
+
+    // Atualiza estatísticas gerais
+    estat->jogos_jogados++;
+    if (vitorias_turno[0] > vitorias_turno[1]) {
+        estat->vitorias[0]++; // vitória do humano
+    } else if (vitorias_turno[1] > vitorias_turno[0]) {
+        estat->vitorias[1]++; // vitória do jogador 2/computador
+        estat->computador_vitorias++; // contador específico para computador
+    } else {
+        estat->empates++;
+    }
+
+    // Exibe resultado final
+    set_color(31);
+    printf("Resultado final da partida (Humano x Computador):\n");
+    reset_color();
+
+    if (vitorias_turno[0] > vitorias_turno[1]) {
+        set_color(32);
+        printf("Humano venceu a partida!\n");
+        reset_color();
+    } else if (vitorias_turno[1] > vitorias_turno[0]) {
+        set_color(34);
+        printf("Computador venceu a partida!\n");
+        reset_color();
+    } else {
+        set_color(36);
+        printf("A partida terminou empatada!\n");
+        reset_color();
+    }
+}
+
+// Utilitários de entrada e validação
+// Entrada do teclado:
+// - Num terminal, a entrada fica em modo cru (sem eco e sem esperar Enter) e
+//   as teclas são lidas sem bloquear: poll() com prazo e read() do que chegou.
+//   Cada tecla (ou sequência de escape, como as setas) vira um evento na fila.
+// - Menus e a escolha de carta reagem a uma única tecla; textos e números
+//   passam pelo editor de linha de ler_linha (eco e apagar feitos aqui).
+// - Fora de um terminal (entrada redirecionada) os mesmos eventos vêm do
+//   arquivo/pipe e as opções continuam sendo lidas como linhas.
+
+static struct {
+    int teclas[ENTRADA_FILA];
+    int inicio, n;
+    int fim;                          // a entrada acabou (EOF)
+    int cru;                          // terminal em modo cru
+#ifndef _WIN32
+    struct termios original;
+#endif
+    int (*ociosa)(void *);            // chamada sem tecla a cada ENTRADA_INTERVALO_MS; 1 = imprimiu algo
+    void *ctx_ociosa;
+} entrada;
+
+static void fila_teclas_inserir(int tecla) {
+    if (entrada.n == ENTRADA_FILA) return; // fila cheia: tecla descartada
+    entrada.teclas[(entrada.inicio + entrada.n++) % ENTRADA_FILA] = tecla;
+}
+
+static int fila_teclas_retirar(void) {
+    int tecla = entrada.teclas[entrada.inicio];
+    entrada.inicio = (entrada.inicio + 1) % ENTRADA_FILA;
+    entrada.n--;
+    return tecla;
+}
+
+#ifndef _WIN32
+// entrada_restaurar: devolve o terminal ao modo de linha (atexit e sinais).
+static void entrada_restaurar(void) {
+    if (entrada.cru) tcsetattr(STDIN_FILENO, TCSAFLUSH, &entrada.original);
+    entrada.cru = 0;
+}
+
+static void entrada_sinal(int sinal) {
+    if (entrada.cru) tcsetattr(STDIN_FILENO, TCSAFLUSH, &entrada.original);
+    signal(sinal, SIG_DFL);
+    raise(sinal);
+}
+
+// entrada_iniciar: liga o modo cru se a entrada for um terminal. Ctrl+C
+// continua funcionando (ISIG) e o terminal é restaurado na saída.
+void entrada_iniciar(void) {
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &entrada.original) != 0) return;
+    struct termios cru = entrada.original;
+    cru.c_lflag &= ~(tcflag_t)(ICANON | ECHO);
+    cru.c_cc[VMIN] = 0;               // read() não bloqueia: a espera é feita por poll()
+    cru.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &cru) != 0) return;
+    entrada.cru = 1;
+    atexit(entrada_restaurar);
+    signal(SIGINT, entrada_sinal);
+    signal(SIGTERM, entrada_sinal);
+}
+
+// entrada_sequencia_aberta: 1 se os bytes terminam no meio de uma sequência
+// Esc (ESC sozinho ou ESC [ sem o byte final), que pode chegar na próxima leitura.
+static int entrada_sequencia_aberta(const unsigned char *b, int n) {
+    int i = n - 1;
+    while (i >= 0 && b[i] != 27 && n - i <= 8) i--;
+    if (i < 0 || b[i] != 27) return 0;
+    if (i == n - 1) return 1;
+    if (b[i + 1] != '[' && b[i + 1] != 'O') return 0;
+    int j = i + 2;
+    while (j < n && b[j] >= 0x20 && b[j] <= 0x3F) j++;
+    return j == n;
+}
+
+// entrada_decodificar: bytes lidos -> eventos (setas e Esc isolado).
+static void entrada_decodificar(const unsigned char *b, int n) {
+    for (int i = 0; i < n; ++i) {
+        if (b[i] == 27 && i + 1 < n && (b[i + 1] == '[' || b[i + 1] == 'O')) {
+            int j = i + 2;
+            while (j < n && b[j] >= 0x20 && b[j] <= 0x3F) j++; // parâmetros (ex: ESC [ 1 ; 5 A)
+            if (j < n) {
+                switch (b[j]) {
+                case 'A': fila_teclas_inserir(TECLA_CIMA); break;
+                case 'B': fila_teclas_inserir(TECLA_BAIXO); break;
+                case 'C': fila_teclas_inserir(TECLA_DIREITA); break;
+                case 'D': fila_teclas_inserir(TECLA_ESQUERDA); break;
+                default: break;           // outras sequências são ignoradas
+                }
+            }
+            i = j;
+        } else if (b[i] == 127 || b[i] == 8) {
+            fila_teclas_inserir(TECLA_APAGAR);
+        } else if (b[i] == '\r') {
+            if (!(i + 1 < n && b[i + 1] == '\n')) fila_teclas_inserir('\n');
+        } else {
+            fila_teclas_inserir(b[i]);
+        }
+    }
+}
+#else
+void entrada_iniciar(void) {
+    entrada.cru = _isatty(_fileno(stdin));
+}
+#endif
+
+// entrada_ociosa: registra a tarefa chamada enquanto ler_opcao espera uma tecla.
+void entrada_ociosa(int (*tarefa)(void *), void *ctx) {
+    entrada.ociosa = tarefa;
+    entrada.ctx_ociosa = ctx;
+}
+
+// tecla_ler:
+// - Próximo evento da fila; se vazia, espera até espera_ms (-1 = sem limite).
+// - Retorna a tecla, TECLA_TEMPO se o prazo acabou ou TECLA_FIM no fim da entrada.
+
+int tecla_ler(int espera_ms) {
+    if (entrada.n > 0) return fila_teclas_retirar();
+    if (entrada.fim) return TECLA_FIM;
+    fflush(stdout);
+#ifndef _WIN32
+    struct pollfd p = { STDIN_FILENO, POLLIN, 0 };
+    int pronto = poll(&p, 1, espera_ms);
+    if (pronto == 0 || (pronto < 0 && errno == EINTR)) return TECLA_TEMPO;
+    unsigned char buf[64];
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return TECLA_TEMPO;
+    if (n <= 0) { entrada.fim = 1; return TECLA_FIM; }
+    // Uma seta pode chegar partida (ESC | [ A): espera um pouco pelo resto
+    // antes de tratar o ESC do fim da leitura como a tecla Esc.
+    while (n < (ssize_t)sizeof(buf) && entrada_sequencia_aberta(buf, (int)n) && poll(&p, 1, ENTRADA_ESC_MS) > 0) {
+        ssize_t mais = read(STDIN_FILENO, buf + n, sizeof(buf) - (size_t)n);
+        if (mais <= 0) break;
+        n += mais;
+    }
+    entrada_decodificar(buf, (int)n);
+#else
+    if (!entrada.cru) { // pipe/arquivo: leitura comum
+        int c = getchar();
+        if (c == EOF) { entrada.fim = 1; return TECLA_FIM; }
+        fila_teclas_inserir(c == '\r' ? '\n' : c);
+    } else {
+        DWORD inicio = GetTickCount();
+        while (!_kbhit()) {
+            if (espera_ms >= 0 && GetTickCount() - inicio >= (DWORD)espera_ms) return TECLA_TEMPO;
+            Sleep(10);
+        }
+        int c = _getch();
+        if (c == 0 || c == 224) { // teclas especiais: prefixo + código
+            int s = _getch();
+            fila_teclas_inserir(s == 72 ? TECLA_CIMA : s == 80 ? TECLA_BAIXO : s == 77 ? TECLA_DIREITA : TECLA_ESQUERDA);
+        } else {
+            fila_teclas_inserir(c == '\r' ? '\n' : c == 8 ? TECLA_APAGAR : c);
+        }
+    }
+#endif
+    return entrada.n > 0 ? fila_teclas_retirar() : TECLA_TEMPO;
+}
+
+// ler_linha: lê uma linha (sem o '\n') pela fila de teclas. No modo cru faz
+// o eco e trata Apagar (um caractere UTF-8 inteiro). Retorna 0 no fim da entrada.
+
+int ler_linha(char *buf, size_t tam) {
+    size_t n = 0;
+    for (;;) {
+        int t = tecla_ler(-1);
+        if (t == TECLA_FIM) {
+            if (n == 0) return 0;
+            break;
+        }
+        if (t == '\n') {
+            if (entrada.cru) printf("\n");
+            break;
+        }
+        if (t == TECLA_APAGAR) {
+            if (n == 0) continue;
+            while (n > 0 && ((unsigned char)buf[n - 1] & 0xC0) == 0x80) n--; // bytes de continuação
+            if (n > 0) n--;
+            if (entrada.cru) printf("\b \b");
+            continue;
+        }
+        if (t < 32 || t > 255 || n + 1 >= tam) continue; // controle, setas ou linha cheia
+        buf[n++] = (char)t;
+        if (entrada.cru) putchar(t);
+    }
+    buf[n] = '\0';
+    return 1;
+}
+
+// ler_inteiro_prompt: Lê uma linha e converte para inteiro com validação.
+// Retorna 0 em caso de falha na leitura (fim da entrada).
+
+int ler_inteiro_prompt(const char *prompt) {
+    char buf[64];
+    long v;
+    char *end;
+    while (1) {
+        printf("%s", prompt);
+        if (!ler_linha(buf, sizeof(buf))) return 0;
+        v = strtol(buf, &end, 10);
+        if (end != buf && *end == '\0') return (int)v;
+        printf("Entrada inválida. Tente novamente.\n");
+    }
+}
+
+// ler_texto_prompt: Lê uma linha (sem o '\n') para buf.
+// Retorna 0 em caso de falha na leitura.
+
+int ler_texto_prompt(const char *prompt, char *buf, size_t tam) {
+    printf("%s", prompt);
+    return ler_linha(buf, tam);
+}
+
+// ler_opcao:
+// - Opção de menu de 0 a max com uma única tecla; 0 é sempre voltar/sair.
+//   O fim da entrada também retorna 0, e Esc só se esc_volta (nos submenus;
+//   no menu principal 0 é "Salvar e sair" e Esc é ignorado, como as teclas
+//   fora do menu).
+// - Enquanto espera, chama a tarefa ociosa (se houver) e reimprime o prompt
+//   quando ela escreveu algo.
+// - Sem terminal, lê a opção como uma linha (número).
+
+int ler_opcao(const char *prompt, int max, int esc_volta) {
+    printf("%s", prompt);
+    if (!entrada.cru) {
+        char buf[64];
+        if (!ler_linha(buf, sizeof(buf))) return 0;
+        char *end;
+        long v = strtol(buf, &end, 10);
+        return end != buf && *end == '\0' && v >= 0 && v <= max ? (int)v : -1;
+    }
+    for (;;) {
+        int t = tecla_ler(entrada.ociosa ? ENTRADA_INTERVALO_MS : -1);
+        if (t == TECLA_TEMPO) {
+            if (entrada.ociosa && entrada.ociosa(entrada.ctx_ociosa)) printf("%s", prompt);
+            continue;
+        }
+        if (t == TECLA_FIM || (t == TECLA_ESC && esc_volta)) { printf("\n"); return 0; }
+        if (t < '0' || t > '9') continue;
+        int v = t - '0';
+        if (v > max) continue;
+        printf("%c\n", t);
+        return v;
+    }
+}
+
+// Funções de validação simples para os campos das cartas:
+
+// Verifica e valida se caractere corresponde a A..Z (nao aceita minúsculas).
+
+int valida_estado(char c) {
+    c = toupper((unsigned char)c);
+    return (c >= 'A' && c <= 'Z');
+}
+
+// valida_codigo:
+// Verifica se a string tem formato: letra + digits (tamanho 2..4), loop para digitar novamente..
+
+int valida_codigo(const char *s) {
+    size_t L = strlen(s);
+    if (L < 2 || L > 4) return 0;
+    if (!isalpha((unsigned char)s[0])) return 0;
+    for (size_t i = 1; i < L; ++i) if (!isdigit((unsigned char)s[i])) return 0;
+    return 1;
+}
+
+// valida_nome: Garante que o nome não é vazio, loop para digitar novamente.
+
+int valida_nome(const char *nome) {
+    return nome != NULL && strlen(nome) > 0;
+}
+
+// valida_populacao / valida_area / valida_pib / valida_pontos:
+// Checagens simples de intervalo, loop para digitar novamente..
+
+int valida_populacao(int p) { return p > 0; }
+int valida_area(float a) { return a > 0.0f; }
+int valida_pib(float p) { return p > 0.0f; }
+int valida_pontos(int n) { return n >= 0; }
+
+// Cálculos derivados e normalização
+
+// invalidar_derivados:
+// - Deve ser chamada sempre que um campo original da carta for alterado.
+
+void invalidar_derivados(Carta *c) {
+    c->derivados_validos = 0;
+}
+
+// carta_densidade / carta_pib_per_capita:
+// - Acessores dos campos derivados: calculam na primeira leitura e guardam
+//   o valor na própria carta até a próxima invalidação.
+
+float carta_densidade(Carta *c) {
+    if (!(c->derivados_validos & DERIVADO_DENSIDADE)) {
+        if (c->area > 0.0f)
+            c->densidade_populacional = (float)c->populacao / c->area;
+        else
+            c->densidade_populacional = 0.0f;
+        c->derivados_validos |= DERIVADO_DENSIDADE;
+    }
+    return c->densidade_populacional;
+}
+
+float carta_pib_per_capita(Carta *c) {
+    if (!(c->derivados_validos & DERIVADO_PIB_PER_CAPITA)) {
+        if (c->populacao > 0)
+            c->pib_per_capita = (c->pib * 1e9f) / c->populacao; // reais por habitante
+        else
+            c->pib_per_capita = 0.0f;
+        c->derivados_validos |= DERIVADO_PIB_PER_CAPITA;
+    }
+    return c->pib_per_capita;
+}
+
+// Pontuação em ponto fixo:
+// - Soma e subtração saturam em ±FIXO_MAX; multiplicação e divisão usam
+//   produto de 128 bits e arredondam para o mais próximo (empate: longe de zero).
+// - Cada operação tem um único resultado possível, então o valor não depende
+//   de flags de compilação, largura de SIMD nem de quantas threads calculam.
+
+static int64_t fixo_soma(int64_t a, int64_t b) {
+    if (b > 0 && a > FIXO_MAX - b) return FIXO_MAX;
+    if (b < 0 && a < -FIXO_MAX - b) return -FIXO_MAX;
+    return a + b;
+}
+
+static int64_t fixo_saturar(uint64_t magnitude, int negativo) {
+    if (magnitude > (uint64_t)FIXO_MAX) magnitude = (uint64_t)FIXO_MAX;
+    return negativo ? -(int64_t)magnitude : (int64_t)magnitude;
+}
+
+#if defined(__SIZEOF_INT128__)
+// Inteiro de 128 bits do GCC/Clang (extensão: __extension__ cala -Wpedantic)
+__extension__ typedef unsigned __int128 fixo_u128;
+#endif
+
+// fixo_muldiv: a * b / c arredondado (c != 0), sem estouro intermediário.
+static int64_t fixo_muldiv(int64_t a, int64_t b, int64_t c) {
+    int negativo = (a < 0) != (b < 0) && a != 0 && b != 0;
+    if (c < 0) negativo = !negativo;
+    uint64_t ua = a < 0 ? 0 - (uint64_t)a : (uint64_t)a;
+    uint64_t ub = b < 0 ? 0 - (uint64_t)b : (uint64_t)b;
+    uint64_t uc = c < 0 ? 0 - (uint64_t)c : (uint64_t)c;
+#if defined(__SIZEOF_INT128__)
+    fixo_u128 q = ((fixo_u128)ua * ub + uc / 2) / uc;
+    return fixo_saturar(q >> 64 ? UINT64_MAX : (uint64_t)q, negativo);
+#else
+    // Sem inteiro de 128 bits: produto em quatro partes e divisão bit a bit
+    uint64_t a0 = (uint32_t)ua, a1 = ua >> 32, b0 = (uint32_t)ub, b1 = ub >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0;
+    uint64_t meio = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    uint64_t lo = (meio << 32) | (uint32_t)p00;
+    uint64_t hi = a1 * b1 + (p01 >> 32) + (p10 >> 32) + (meio >> 32);
+    uint64_t soma = lo + uc / 2;
+    hi += soma < lo;
+    lo = soma;
+    uint64_t q = 0, r = 0;
+    for (int i = 127; i >= 0; --i) {
+        int estouro = (int)(r >> 63);
+        r = (r << 1) | ((i >= 64 ? hi >> (i - 64) : lo >> i) & 1u);
+        if (estouro || r >= uc) {
+            r -= uc;
+            if (i >= 64) return fixo_saturar(UINT64_MAX, negativo);
+            q |= (uint64_t)1 << i;
+        }
+    }
+    return fixo_saturar(q, negativo);
+#endif
+}
+
+static int64_t fixo_mul(int64_t a, int64_t b) {
+    return fixo_muldiv(a, b, FIXO_UM);
+}
+
+// fixo_de_float: conversão exata até o arredondamento final (frexpf/ldexpf
+// só mexem no expoente).
+static int64_t fixo_de_float(float x) {
+    if (isnan(x)) return 0;
+    if (isinf(x)) return x > 0 ? FIXO_MAX : -FIXO_MAX;
+    int e;
+    float m = frexpf(x, &e);                 // x = m * 2^e, 0.5 <= |m| < 1
+    int64_t mantissa = (int64_t)ldexpf(m, 24); // inteiro de até 24 bits
+    int desloc = e - 24 + FIXO_BITS;
+    int negativo = mantissa < 0;
+    uint64_t u = negativo ? (uint64_t)-mantissa : (uint64_t)mantissa;
+    if (desloc >= 0) return desloc > 62 - 24 ? fixo_saturar(UINT64_MAX, negativo) : fixo_saturar(u << desloc, negativo);
+    if (-desloc > 62) return 0;
+    return fixo_saturar((u + ((uint64_t)1 << (-desloc - 1))) >> -desloc, negativo);
+}
+
+// fixo_log: logaritmo natural (0 se x <= 0). log2 bit a bit por quadrados
+// sucessivos (fração truncada) e depois multiplicado por ln(2).
+static int64_t fixo_log(int64_t x) {
+    if (x <= 0) return 0;
+    uint64_t v = (uint64_t)x;
+    int msb = 63;
+    while (!(v >> msb)) msb--;
+    uint64_t z = msb >= 30 ? v >> (msb - 30) : v << (30 - msb); // [1, 2) com 30 bits de fração
+    int64_t log2 = (int64_t)(msb - FIXO_BITS) * FIXO_UM;
+    for (int i = FIXO_BITS - 1; i >= 0; --i) {
+        z = (z * z) >> 30;
+        if (z >= ((uint64_t)2 << 30)) {
+            z >>= 1;
+            log2 += (int64_t)1 << i;
+        }
+    }
+    return fixo_muldiv(log2, FIXO_LN2_Q32, (int64_t)1 << 32);
+}
+
+// Fórmula de pontuação:
+// Sintaxe: números, campos (populacao, area, pib, pontos, densidade,
+// pib_per_capita), + - * / e parênteses, e as funções log(x) (natural;
+// 0 se x <= 0), inv(x) (1/x; 0 se x <= 1e-9), norm(x) (mín/máx do baralho
+// levado a 0..1), min(a, b) e max(a, b). Ex: 2 * norm(log(populacao)) + inv(densidade)
+// Compilada uma vez para pós-fixa; avaliada em lotes de FORMULA_LOTE cartas.
+
+static Formula formula_super_poder;
+static int formula_pronta = 0;
+
+typedef struct AnalisadorFormula {
+    const char *inicio, *p;
+    Formula *f;
+    int pilha, pilha_max;
+    char erro[128];
+} AnalisadorFormula;
+
+static void formula_erro(AnalisadorFormula *a, const char *msg) {
+    if (!a->erro[0]) snprintf(a->erro, sizeof(a->erro), "%s (posição %d)", msg, (int)(a->p - a->inicio) + 1);
+}
+
+// formula_emitir: acrescenta uma instrução e acompanha a altura da pilha.
+static void formula_emitir(AnalisadorFormula *a, int op, int arg) {
+    Formula *f = a->f;
+    if (f->n_ops >= FORMULA_MAX_OPS) { formula_erro(a, "fórmula longa demais"); return; }
+    f->op[f->n_ops] = (unsigned char)op;
+    f->arg[f->n_ops] = (unsigned char)arg;
+    f->n_ops++;
+    if (op == OP_CAMPO || op == OP_CONSTANTE) a->pilha++;
+    else if (op == OP_SOMA || op == OP_SUBTRACAO || op == OP_MULTIPLICACAO || op == OP_DIVISAO ||
+             op == OP_MINIMO || op == OP_MAXIMO) a->pilha--;
+    if (a->pilha > a->pilha_max) a->pilha_max = a->pilha;
+    if (a->pilha > FORMULA_MAX_PILHA) formula_erro(a, "fórmula aninhada demais");
+}
+
+static void formula_espacos(AnalisadorFormula *a) {
+    while (isspace((unsigned char)*a->p)) a->p++;
+}
+
+static int formula_aceita(AnalisadorFormula *a, char c) {
+    formula_espacos(a);
+    if (*a->p != c) return 0;
+    a->p++;
+    return 1;
+}
+
+static void formula_expressao(AnalisadorFormula *a);
+
+// fator: número | campo | função(args) | (expressão) | -fator
+static void formula_fator(AnalisadorFormula *a) {
+    static const char *campos[FORMULA_CAMPOS] = {"populacao", "area", "pib", "pontos", "densidade", "pib_per_capita"};
+    formula_espacos(a);
+    if (a->erro[0]) return;
+    if (formula_aceita(a, '-')) { formula_fator(a); formula_emitir(a, OP_NEGACAO, 0); return; }
+    if (formula_aceita(a, '(')) {
+        formula_expressao(a);
+        if (!formula_aceita(a, ')')) formula_erro(a, "esperado ')'");
+        return;
+    }
+    if (isdigit((unsigned char)*a->p) || *a->p == '.') {
+        char *fim;
+        float v = strtof(a->p, &fim);
+        if (a->f->n_constantes >= FORMULA_MAX_OPS) { formula_erro(a, "constantes demais"); return; }
+        a->f->constantes[a->f->n_constantes] = v;
+        formula_emitir(a, OP_CONSTANTE, a->f->n_constantes++);
+        a->p = fim;
+        return;
+    }
+    char nome[32];
+    size_t L = 0;
+    while ((isalnum((unsigned char)*a->p) || *a->p == '_') && L + 1 < sizeof(nome)) nome[L++] = *a->p++;
+    nome[L] = '\0';
+    if (L == 0) { formula_erro(a, "esperado número, campo ou função"); return; }
+
+    for (int c = 0; c < FORMULA_CAMPOS; ++c)
+        if (strcmp(nome, campos[c]) == 0) { formula_emitir(a, OP_CAMPO, c); return; }
+
+    int op = strcmp(nome, "log") == 0 ? OP_LOG : strcmp(nome, "inv") == 0 ? OP_INVERSO
+           : strcmp(nome, "norm") == 0 ? OP_NORMALIZA : strcmp(nome, "min") == 0 ? OP_MINIMO
+           : strcmp(nome, "max") == 0 ? OP_MAXIMO : -1;
+    if (op < 0) { formula_erro(a, "campo ou função desconhecida"); return; }
+    if (!formula_aceita(a, '(')) { formula_erro(a, "esperado '(' após a função"); return; }
+    formula_expressao(a);
+    if (op == OP_MINIMO || op == OP_MAXIMO) {
+        if (!formula_aceita(a, ',')) { formula_erro(a, "min e max recebem dois argumentos"); return; }
+        formula_expressao(a);
+    }
+    if (!formula_aceita(a, ')')) { formula_erro(a, "esperado ')'"); return; }
+    if (op == OP_NORMALIZA) {
+        if (a->f->n_norm >= FORMULA_MAX_NORM) { formula_erro(a, "normalizações demais"); return; }
+        a->f->pos_norm[a->f->n_norm] = a->f->n_ops;
+        formula_emitir(a, OP_NORMALIZA, a->f->n_norm++);
+    } else {
+        formula_emitir(a, op, 0);
+    }
+}
+
+static void formula_termo(AnalisadorFormula *a) {
+    formula_fator(a);
+    for (;;) {
+        if (formula_aceita(a, '*')) { formula_fator(a); formula_emitir(a, OP_MULTIPLICACAO, 0); }
+        else if (formula_aceita(a, '/')) { formula_fator(a); formula_emitir(a, OP_DIVISAO, 0); }
+        else return;
+    }
+}
+
+static void formula_expressao(AnalisadorFormula *a) {
+    formula_termo(a);
+    for (;;) {
+        if (formula_aceita(a, '+')) { formula_termo(a); formula_emitir(a, OP_SOMA, 0); }
+        else if (formula_aceita(a, '-')) { formula_termo(a); formula_emitir(a, OP_SUBTRACAO, 0); }
+        else return;
+    }
+}
+
+// formula_termo_em: reconhece em op[k] um termo "campo" ou "peso * campo"
+// (em qualquer ordem). Retorna quantas instruções o termo ocupa (0 se não é termo).
+static int formula_termo_em(const Formula *f, int k, int *campo, float *peso) {
+    if (k + 2 < f->n_ops && f->op[k + 2] == OP_MULTIPLICACAO) {
+        if (f->op[k] == OP_CONSTANTE && f->op[k + 1] == OP_CAMPO) {
+            *peso = f->constantes[f->arg[k]]; *campo = f->arg[k + 1]; return 3;
+        }
+        if (f->op[k] == OP_CAMPO && f->op[k + 1] == OP_CONSTANTE) {
+            *peso = f->constantes[f->arg[k + 1]]; *campo = f->arg[k]; return 3;
+        }
+    }
+    if (k < f->n_ops && f->op[k] == OP_CAMPO) { *peso = 1.0f; *campo = f->arg[k]; return 1; }
+    return 0;
+}
+
+// otimizar_formula:
+// - Troca cadeias "t1 ± t2 ± ... ± tn" de termos de campo por uma OP_COMBINACAO,
+//   que soma tudo em uma passada pelo lote em vez de uma por operação.
+// - A soma segue a mesma ordem (esquerda para direita); termos de peso 1
+//   dão exatamente o mesmo resultado que as instruções originais.
+static void otimizar_formula(Formula *f) {
+    unsigned char op[FORMULA_MAX_OPS], arg[FORMULA_MAX_OPS];
+    int n = 0;
+    for (int k = 0; k < f->n_ops;) {
+        int campo[FORMULA_MAX_TERMOS];
+        float peso[FORMULA_MAX_TERMOS];
+        int nt = 0, fim = k;
+        int tam = formula_termo_em(f, k, &campo[0], &peso[0]);
+        if (tam > 0) {
+            nt = 1;
+            fim = k + tam;
+            while (nt < FORMULA_MAX_TERMOS) {
+                int t = formula_termo_em(f, fim, &campo[nt], &peso[nt]);
+                if (t == 0 || fim + t >= f->n_ops) break;
+                int sinal = f->op[fim + t];
+                if (sinal != OP_SOMA && sinal != OP_SUBTRACAO) break;
+                if (sinal == OP_SUBTRACAO) peso[nt] = -peso[nt];
+                nt++;
+                fim += t + 1;
+            }
+        }
+        if (nt >= 2) {
+            f->comb_inicio[f->n_comb] = (unsigned char)f->n_termos;
+            f->comb_n[f->n_comb] = (unsigned char)nt;
+            for (int t = 0; t < nt; ++t) {
+                f->termo_campo[f->n_termos] = (unsigned char)campo[t];
+                f->termo_peso[f->n_termos++] = peso[t];
+            }
+            op[n] = OP_COMBINACAO;
+            arg[n++] = (unsigned char)f->n_comb++;
+            k = fim;
+        } else {
+            op[n] = f->op[k];
+            arg[n++] = f->arg[k];
+            k++;
+        }
+    }
+    memcpy(f->op, op, (size_t)n);
+    memcpy(f->arg, arg, (size_t)n);
+    f->n_ops = n;
+    for (int k = 0; k < n; ++k) if (op[k] == OP_NORMALIZA) f->pos_norm[arg[k]] = k;
+}
+
+// compilar_formula: converte o texto em bytecode. Retorna 1 em sucesso;
+// em erro, 0 e a mensagem em 'erro'.
+
+int compilar_formula(const char *texto, Formula *f, char *erro, size_t tam_erro) {
+    AnalisadorFormula a;
+    memset(f, 0, sizeof(*f));
+    memset(&a, 0, sizeof(a));
+    a.inicio = a.p = texto;
+    a.f = f;
+    formula_expressao(&a);
+    formula_espacos(&a);
+    if (!a.erro[0] && *a.p != '\0') formula_erro(&a, "texto inesperado");
+    if (a.erro[0]) {
+        snprintf(erro, tam_erro, "%s", a.erro);
+        return 0;
+    }
+    otimizar_formula(f);
+    f->soma_direta = f->op[0] == OP_COMBINACAO &&
+                     (f->n_ops == 1 || (f->n_ops == 4 && f->op[1] == OP_CAMPO && f->op[2] == OP_INVERSO && f->op[3] == OP_SOMA));
+    for (int i = 0; i < f->n_constantes; ++i) f->constantes_fixas[i] = fixo_de_float(f->constantes[i]);
+    for (int i = 0; i < f->n_termos; ++i) f->termo_peso_fixo[i] = fixo_de_float(f->termo_peso[i]);
+    snprintf(f->texto, sizeof(f->texto), "%s", texto);
+    return 1;
+}
+
+// formula_atual: fórmula em uso (a padrão se carregar_formula não foi chamada).
+Formula *formula_atual(void) {
+    if (!formula_pronta) {
+        char erro[128];
+        compilar_formula(FORMULA_PADRAO, &formula_super_poder, erro, sizeof(erro));
+        formula_super_poder.padrao = 1;
+        formula_pronta = 1;
+    }
+    return &formula_super_poder;
+}
+
+// carregar_formula:
+// - Lê "super_poder = <expressão>" do arquivo (linhas com # são comentários).
+//   Sem arquivo, ou com fórmula inválida, fica a FORMULA_PADRAO.
+// - "pontuacao = fixa" liga a pontuação em ponto fixo (resultado idêntico em
+//   qualquer máquina); "pontuacao = float" (padrão) mantém o cálculo em float.
+// - Avisos vão para stderr: stdout pode ser uma exportação.
+
+// formula_chave: se a linha é "<chave> = valor" (a chave exata, espaços
+// opcionais antes do '='), retorna o texto depois do '='; senão NULL.
+static char *formula_chave(char *linha, const char *chave) {
+    size_t L = strlen(chave);
+    if (strncmp(linha, chave, L) != 0) return NULL;
+    char *p = linha + L;
+    while (isspace((unsigned char)*p)) p++;
+    return *p == '=' ? p + 1 : NULL;
+}
+
+void carregar_formula(const char *arquivo) {
+    Formula *padrao = formula_atual();
+    FILE *f = fopen(arquivo, "r");
+    if (!f) return;
+    char linha[512];
+    int fixa = 0;
+    while (fgets(linha, sizeof(linha), f)) {
+        linha[strcspn(linha, "\r\n")] = '\0';
+        char *p = linha;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '#' || *p == '\0') continue;
+        char *valor = formula_chave(p, "pontuacao");
+        if (valor) {
+            char modo[16] = "";
+            sscanf(valor, "%15s", modo);
+            if (strcmp(modo, "fixa") == 0) fixa = 1;
+            else if (strcmp(modo, "float") == 0) fixa = 0;
+            else fprintf(stderr, "%s: pontuacao desconhecida '%s' (use fixa ou float)\n", arquivo, modo);
+            continue;
+        }
+        valor = formula_chave(p, "super_poder");
+        if (!valor) {
+            fprintf(stderr, "%s: linha ignorada (esperado super_poder = <fórmula>): %s\n", arquivo, p);
+            continue;
+        }
+        Formula nova;
+        char erro[128];
+        if (!compilar_formula(valor, &nova, erro, sizeof(erro))) {
+            fprintf(stderr, "%s: fórmula inválida, %s. Usando a fórmula padrão.\n", arquivo, erro);
+            continue;
+        }
+        nova.padrao = nova.n_ops == padrao->n_ops && nova.n_termos == padrao->n_termos &&
+                      memcmp(nova.op, padrao->op, (size_t)nova.n_ops) == 0 &&
+                      memcmp(nova.arg, padrao->arg, (size_t)nova.n_ops) == 0 &&
+                      memcmp(nova.termo_campo, padrao->termo_campo, (size_t)nova.n_termos) == 0 &&
+                      memcmp(nova.termo_peso, padrao->termo_peso, (size_t)nova.n_termos * sizeof(float)) == 0 &&
+                      memcmp(nova.constantes, padrao->constantes, (size_t)nova.n_constantes * sizeof(float)) == 0;
+        formula_super_poder = nova;
+    }
+    fclose(f);
+    formula_super_poder.fixa = fixa;
+}
+
+// executar_formula:
+// - Roda as n_ops primeiras instruções sobre m <= FORMULA_LOTE cartas e grava
+//   o topo da pilha em saida. Com n_ops = pos_norm[k], o topo é o argumento
+//   da normalização k (usado para medir mín/máx do baralho).
+// - Densidade e PIB per capita são calculados aqui, com as mesmas contas dos
+//   acessores, e guardados na carta. Só lê a fórmula (pode rodar em threads).
+
+static void executar_formula(const Formula *f, Carta *cartas, int m, int n_ops, float *saida) {
+    float colunas[FORMULA_CAMPOS][FORMULA_LOTE];
+    float pilha[FORMULA_MAX_PILHA][FORMULA_LOTE];
+    const float *topo_ptr[FORMULA_MAX_PILHA]; // campos entram na pilha sem cópia
+    float *pop = colunas[CAMPO_POPULACAO], *area = colunas[CAMPO_AREA], *pib = colunas[CAMPO_PIB];
+    float *dens = colunas[CAMPO_DENSIDADE], *ppc = colunas[CAMPO_PIB_PER_CAPITA];
+    for (int i = 0; i < m; ++i) {
+        pop[i] = (float)cartas[i].populacao;
+        area[i] = cartas[i].area;
+        pib[i] = cartas[i].pib;
+        colunas[CAMPO_PONTOS][i] = (float)cartas[i].num_pontos_turisticos;
+    }
+    for (int i = 0; i < m; ++i) {
+        dens[i] = area[i] > 0.0f ? pop[i] / area[i] : 0.0f;
+        ppc[i] = pop[i] > 0.0f ? (pib[i] * 1e9f) / pop[i] : 0.0f;
+    }
+    for (int i = 0; i < m; ++i) {
+        cartas[i].densidade_populacional = dens[i];
+        cartas[i].pib_per_capita = ppc[i];
+        cartas[i].derivados_validos |= DERIVADO_DENSIDADE | DERIVADO_PIB_PER_CAPITA;
+    }
+
+    int topo = -1;
+    for (int k = 0; k < n_ops; ++k) {
+        int arg = f->arg[k];
+        if (f->op[k] == OP_CAMPO) { topo_ptr[++topo] = colunas[arg]; continue; }
+        if (f->op[k] == OP_CONSTANTE) {
+            float v = f->constantes[arg], *d = pilha[++topo];
+            for (int i = 0; i < m; ++i) d[i] = v;
+            topo_ptr[topo] = d;
+            continue;
+        }
+        if (f->op[k] == OP_COMBINACAO) {
+            const float *col[FORMULA_MAX_TERMOS];
+            float peso[FORMULA_MAX_TERMOS];
+            int nt = f->comb_n[arg];
+            for (int t = 0; t < nt; ++t) {
+                col[t] = colunas[f->termo_campo[f->comb_inicio[arg] + t]];
+                peso[t] = f->termo_peso[f->comb_inicio[arg] + t];
+            }
+            float *d = pilha[++topo];
+            for (int i = 0; i < m; ++i) {
+                float soma = peso[0] * col[0][i];
+                for (int t = 1; t < nt; ++t) soma += peso[t] * col[t][i];
+                d[i] = soma;
+            }
+            topo_ptr[topo] = d;
+            continue;
+        }
+        const float *y = topo_ptr[topo];
+        float *d;
+        switch (f->op[k]) {
+        case OP_NEGACAO:
+            d = pilha[topo];
+            for (int i = 0; i < m; ++i) d[i] = -y[i];
+            break;
+        case OP_LOG:
+            d = pilha[topo];
+            for (int i = 0; i < m; ++i) d[i] = y[i] > 0.0f ? logf(y[i]) : 0.0f;
+            break;
+        case OP_INVERSO:
+            d = pilha[topo];
+            for (int i = 0; i < m; ++i) d[i] = y[i] > 1e-9f ? 1.0f / y[i] : 0.0f;
+            break;
+        case OP_NORMALIZA: {
+            float lo = f->norm_min[arg], amplitude = f->norm_max[arg] - f->norm_min[arg];
+            float escala = amplitude > 0.0f ? 1.0f / amplitude : 0.0f;
+            d = pilha[topo];
+            for (int i = 0; i < m; ++i) d[i] = (y[i] - lo) * escala;
+            break;
+        }
+        default: { // binárias: d = x op y, com x o penúltimo e y o topo
+            const float *x = topo_ptr[--topo];
+            d = pilha[topo];
+            switch (f->op[k]) {
+            case OP_SOMA: for (int i = 0; i < m; ++i) d[i] = x[i] + y[i]; break;
+            case OP_SUBTRACAO: for (int i = 0; i < m; ++i) d[i] = x[i] - y[i]; break;
+            case OP_MULTIPLICACAO: for (int i = 0; i < m; ++i) d[i] = x[i] * y[i]; break;
+            case OP_DIVISAO: for (int i = 0; i < m; ++i) d[i] = y[i] != 0.0f ? x[i] / y[i] : 0.0f; break;
+            case OP_MINIMO: for (int i = 0; i < m; ++i) d[i] = y[i] < x[i] ? y[i] : x[i]; break;
+            case OP_MAXIMO: for (int i = 0; i < m; ++i) d[i] = y[i] > x[i] ? y[i] : x[i]; break;
+            }
+            break;
+        }
+        }
+        topo_ptr[topo] = d;
+    }
+    if (saida) memcpy(saida, topo_ptr[topo], (size_t)m * sizeof(float));
+}
+
+// executar_formula_fixa:
+// - Mesmo programa de executar_formula, em ponto fixo Q47.16 (pontuacao = fixa).
+// - Os campos são convertidos da carta, não dos derivados em float: densidade
+//   e PIB per capita são refeitos aqui com divisão inteira arredondada.
+// - Não grava nada na carta; o resultado vai para saida.
+
+static void executar_formula_fixa(const Formula *f, const Carta *cartas, int m, int n_ops, int64_t *saida) {
+    int64_t colunas[FORMULA_CAMPOS][FORMULA_LOTE];
+    int64_t pilha[FORMULA_MAX_PILHA][FORMULA_LOTE];
+    const int64_t *topo_ptr[FORMULA_MAX_PILHA];
+    int64_t *pop = colunas[CAMPO_POPULACAO], *area = colunas[CAMPO_AREA], *pib = colunas[CAMPO_PIB];
+    for (int i = 0; i < m; ++i) {
+        pop[i] = (int64_t)cartas[i].populacao * FIXO_UM;
+        area[i] = fixo_de_float(cartas[i].area);
+        pib[i] = fixo_de_float(cartas[i].pib);
+        colunas[CAMPO_PONTOS][i] = (int64_t)cartas[i].num_pontos_turisticos * FIXO_UM;
+        colunas[CAMPO_DENSIDADE][i] = area[i] > 0 ? fixo_muldiv(pop[i], FIXO_UM, area[i]) : 0;
+        colunas[CAMPO_PIB_PER_CAPITA][i] = cartas[i].populacao > 0 ? fixo_muldiv(pib[i], 1000000000, (int64_t)cartas[i].populacao) : 0;
+    }
+
+    int topo = -1;
+    for (int k = 0; k < n_ops; ++k) {
+        int arg = f->arg[k];
+        if (f->op[k] == OP_CAMPO) { topo_ptr[++topo] = colunas[arg]; continue; }
+        if (f->op[k] == OP_CONSTANTE) {
+            int64_t v = f->constantes_fixas[arg], *d = pilha[++topo];
+            for (int i = 0; i < m; ++i) d[i] = v;
+            topo_ptr[topo] = d;
+            continue;
+        }
+        if (f->op[k] == OP_COMBINACAO) {
+            int64_t *d = pilha[++topo];
+            for (int i = 0; i < m; ++i) d[i] = 0;
+            for (int t = 0; t < f->comb_n[arg]; ++t) {
+                const int64_t *col = colunas[f->termo_campo[f->comb_inicio[arg] + t]];
+                int64_t peso = f->termo_peso_fixo[f->comb_inicio[arg] + t];
+                if (peso == FIXO_UM)
+                    for (int i = 0; i < m; ++i) d[i] = fixo_soma(d[i], col[i]);
+                else
+                    for (int i = 0; i < m; ++i) d[i] = fixo_soma(d[i], fixo_mul(peso, col[i]));
+            }
+            topo_ptr[topo] = d;
+            continue;
+        }
+        const int64_t *y = topo_ptr[topo];
+        int64_t *d;
+        switch (f->op[k]) {
+        case OP_NEGACAO:
+            d = pilha[topo];
+            for (int i = 0; i < m; ++i) d[i] = -y[i];
+            break;
+        case OP_LOG:
+            d = pilha[topo];
+            for (int i = 0; i < m; ++i) d[i] = fixo_log(y[i]);
+            break;
+        case OP_INVERSO:
+            d = pilha[topo];
+            for (int i = 0; i < m; ++i) d[i] = y[i] > 0 ? fixo_muldiv(FIXO_UM, FIXO_UM, y[i]) : 0;
+            break;
+        case OP_NORMALIZA: {
+            int64_t lo = f->norm_min_fixo[arg], amplitude = fixo_soma(f->norm_max_fixo[arg], -lo);
+            d = pilha[topo];
+            for (int i = 0; i < m; ++i) d[i] = amplitude > 0 ? fixo_muldiv(fixo_soma(y[i], -lo), FIXO_UM, amplitude) : 0;
+            break;
+        }
+        default: {
+            const int64_t *x = topo_ptr[--topo];
+            d = pilha[topo];
+            switch (f->op[k]) {
+            case OP_SOMA: for (int i = 0; i < m; ++i) d[i] = fixo_soma(x[i], y[i]); break;
+            case OP_SUBTRACAO: for (int i = 0; i < m; ++i) d[i] = fixo_soma(x[i], -y[i]); break;
+            case OP_MULTIPLICACAO: for (int i = 0; i < m; ++i) d[i] = fixo_mul(x[i], y[i]); break;
+            case OP_DIVISAO: for (int i = 0; i < m; ++i) d[i] = y[i] != 0 ? fixo_muldiv(x[i], FIXO_UM, y[i]) : 0; break;
+            case OP_MINIMO: for (int i = 0; i < m; ++i) d[i] = y[i] < x[i] ? y[i] : x[i]; break;
+            case OP_MAXIMO: for (int i = 0; i < m; ++i) d[i] = y[i] > x[i] ? y[i] : x[i]; break;
+            }
+            break;
+        }
+        }
+        topo_ptr[topo] = d;
+    }
+    memcpy(saida, topo_ptr[topo], (size_t)m * sizeof(int64_t));
+}
+
+// executar_soma_direta: programa que é só uma combinação, somada ou não ao
+// inverso de um campo (caso da FORMULA_PADRAO). Calcula carta a carta em uma
+// só passada, sem colunas nem pilha, com as mesmas operações e na mesma
+// ordem de executar_formula.
+static void executar_soma_direta(const Formula *f, Carta *cartas, int m) {
+    const unsigned char *campo = f->termo_campo + f->comb_inicio[f->arg[0]];
+    const float *peso = f->termo_peso + f->comb_inicio[f->arg[0]];
+    int nt = f->comb_n[f->arg[0]];
+    int inverso = f->n_ops == 4 ? f->arg[1] : -1;
+    for (int i = 0; i < m; ++i) {
+        Carta *c = &cartas[i];
+        float v[FORMULA_CAMPOS];
+        v[CAMPO_POPULACAO] = (float)c->populacao;
+        v[CAMPO_AREA] = c->area;
+        v[CAMPO_PIB] = c->pib;
+        v[CAMPO_PONTOS] = (float)c->num_pontos_turisticos;
+        v[CAMPO_DENSIDADE] = v[CAMPO_AREA] > 0.0f ? v[CAMPO_POPULACAO] / v[CAMPO_AREA] : 0.0f;
+        v[CAMPO_PIB_PER_CAPITA] = v[CAMPO_POPULACAO] > 0.0f ? (v[CAMPO_PIB] * 1e9f) / v[CAMPO_POPULACAO] : 0.0f;
+        float soma;
+        if (f->padrao) { // pesos 1: mesma soma, sem o laço indireto pelos termos
+            soma = v[CAMPO_POPULACAO] + v[CAMPO_AREA] + v[CAMPO_PIB] + v[CAMPO_PONTOS] + v[CAMPO_PIB_PER_CAPITA];
+        } else {
+            soma = peso[0] * v[campo[0]];
+            for (int t = 1; t < nt; ++t) soma += peso[t] * v[campo[t]];
+        }
+        if (inverso >= 0) soma += v[inverso] > 1e-9f ? 1.0f / v[inverso] : 0.0f;
+        c->densidade_populacional = v[CAMPO_DENSIDADE];
+        c->pib_per_capita = v[CAMPO_PIB_PER_CAPITA];
+        c->super_poder = soma;
+        c->derivados_validos = DERIVADO_DENSIDADE | DERIVADO_PIB_PER_CAPITA | DERIVADO_SUPER_PODER;
+    }
+}
+
+// derivar_cartas: calcula os derivados de n cartas em lotes; com so_invalidas,
+// pula os lotes já calculados. Não mexe no mín/máx das normalizações.
+// - No modo fixo, super_poder guarda o valor inteiro convertido para float;
+//   o inteiro não fica na carta e é refeito quando preciso (ver
+//   comparar_super_poder e cartas_forca).
+static void derivar_cartas(Carta *cartas, int n, int so_invalidas) {
+    const Formula *f = formula_atual();
+    const unsigned char completo = DERIVADO_DENSIDADE | DERIVADO_PIB_PER_CAPITA | DERIVADO_SUPER_PODER;
+    float sp[FORMULA_LOTE];
+    int64_t sp_fixo[FORMULA_LOTE];
+    for (int inicio = 0; inicio < n; inicio += FORMULA_LOTE) {
+        Carta *lote = cartas + inicio;
+        int m = n - inicio < FORMULA_LOTE ? n - inicio : FORMULA_LOTE;
+        if (so_invalidas) {
+            int pendente = 0;
+            for (int i = 0; i < m; ++i) pendente |= lote[i].derivados_validos != completo;
+            if (!pendente) continue;
+        }
+        if (f->fixa) {
+            executar_formula(f, lote, m, 0, NULL); // só densidade e PIB per capita
+            executar_formula_fixa(f, lote, m, f->n_ops, sp_fixo);
+            for (int i = 0; i < m; ++i) {
+                lote[i].super_poder = (float)((double)sp_fixo[i] / FIXO_UM); // preserva a ordem
+                lote[i].derivados_validos = completo;
+            }
+            continue;
+        }
+        if (f->soma_direta) {
+            executar_soma_direta(f, lote, m);
+            continue;
+        }
+        executar_formula(f, lote, m, f->n_ops, sp);
+        for (int i = 0; i < m; ++i) {
+            lote[i].super_poder = sp[i];
+            lote[i].derivados_validos = completo;
+        }
+    }
+}
+
+// carta_super_poder:
+// Calcula o Super Poder pela fórmula configurada (FORMULA_PADRAO: soma de
+// população, área, PIB, pontos turísticos, PIB per capita e inverso da
+// densidade). norm() usa o mín/máx do último cálculo do baralho inteiro.
+
+float carta_super_poder(Carta *c) {
+    if (!(c->derivados_validos & DERIVADO_SUPER_PODER)) derivar_cartas(c, 1, 0);
+    return c->super_poder;
+}
+
+// calcula_campos_derivados:
+// - Força o cálculo de todos os derivados de uma carta
+//   (densidade_populacional, pib_per_capita e super_poder).
+
+void calcula_campos_derivados(struct Carta *c) {
+    carta_super_poder(c); // também calcula densidade e PIB per capita
+}
+
+// calcular_super_poder_normalizado:
+// - Mede o mín/máx de cada norm() da fórmula sobre o baralho inteiro (as
+//   internas primeiro) e recalcula o super_poder de todas as cartas.
+
+void calcular_super_poder_normalizado(Carta *cartas, int n) {
+    Formula *f = formula_atual();
+    float v[FORMULA_LOTE];
+    int64_t v_fixo[FORMULA_LOTE];
+    for (int k = 0; k < f->n_norm; ++k) {
+        if (f->fixa) {
+            int64_t lo = FIXO_MAX, hi = -FIXO_MAX;
+            for (int inicio = 0; inicio < n; inicio += FORMULA_LOTE) {
+                int m = n - inicio < FORMULA_LOTE ? n - inicio : FORMULA_LOTE;
+                executar_formula_fixa(f, cartas + inicio, m, f->pos_norm[k], v_fixo);
+                for (int i = 0; i < m; ++i) {
+                    lo = v_fixo[i] < lo ? v_fixo[i] : lo;
+                    hi = v_fixo[i] > hi ? v_fixo[i] : hi;
+                }
+            }
+            f->norm_min_fixo[k] = n > 0 ? lo : 0;
+            f->norm_max_fixo[k] = n > 0 ? hi : 0;
+            continue;
+        }
+        float lo = FLT_MAX, hi = -FLT_MAX;
+        for (int inicio = 0; inicio < n; inicio += FORMULA_LOTE) {
+            int m = n - inicio < FORMULA_LOTE ? n - inicio : FORMULA_LOTE;
+            executar_formula(f, cartas + inicio, m, f->pos_norm[k], v);
+            for (int i = 0; i < m; ++i) {
+                lo = v[i] < lo ? v[i] : lo;
+                hi = v[i] > hi ? v[i] : hi;
+            }
+        }
+        f->norm_min[k] = n > 0 ? lo : 0.0f;
+        f->norm_max[k] = n > 0 ? hi : 0.0f;
+    }
+    f->norm_valida = 1;
+    f->norm_cartas = cartas;
+    f->norm_n = n;
+    derivar_cartas(cartas, n, 0);
+}
+
+// garantir_derivados:
+// - Cálculo em lote apenas das cartas ainda não calculadas. Chamado quando
+//   uma partida (ou outra operação sobre o baralho inteiro) realmente precisa.
+// - Se a fórmula normaliza, qualquer carta nova ou alterada muda o mín/máx:
+//   nesse caso o baralho inteiro é renormalizado.
+
+void garantir_derivados(Carta *cartas, int n) {
+    const Formula *f = formula_atual();
+    if (f->n_norm > 0) {
+        int precisa = !f->norm_valida || f->norm_cartas != cartas || f->norm_n != n;
+        for (int i = 0; !precisa && i < n; ++i)
+            precisa = cartas[i].derivados_validos != (DERIVADO_DENSIDADE | DERIVADO_PIB_PER_CAPITA | DERIVADO_SUPER_PODER);
+        if (precisa) calcular_super_poder_normalizado(cartas, n);
+        return;
+    }
+    derivar_cartas(cartas, n, 1);
+}
+
+// derivar_cartas_thread: como garantir_derivados, mas só lê a fórmula
+// (seguro em threads; não atualiza o mín/máx das normalizações).
+
+void derivar_cartas_thread(Carta *cartas, int n) {
+    derivar_cartas(cartas, n, 1);
+}
+
+// cartas_forca: super_poder em ponto fixo de n cartas, para somar e
+// ordenar forças na distribuição. No modo float é o float convertido; no
+// modo fixo o inteiro é recalculado em lotes pela fórmula.
+
+static void cartas_forca(const Carta *cartas, int n, int64_t *forca) {
+    const Formula *f = formula_atual();
+    if (!f->fixa) {
+        for (int i = 0; i < n; ++i) forca[i] = fixo_de_float(cartas[i].super_poder);
+        return;
+    }
+    for (int inicio = 0; inicio < n; inicio += FORMULA_LOTE) {
+        int m = n - inicio < FORMULA_LOTE ? n - inicio : FORMULA_LOTE;
+        executar_formula_fixa(f, cartas + inicio, m, f->n_ops, forca + inicio);
+    }
+}
+
+// comparar_super_poder: 1 se a vence b, -1 se perde, 0 se empata.
+// - No modo fixo o resultado é o dos inteiros (igual em qualquer máquina ou
+//   compilação). A conversão para float preserva a ordem, então floats
+//   diferentes já decidem; só floats iguais recalculam os dois inteiros.
+// - Os derivados das duas cartas já devem estar calculados.
+
+int comparar_super_poder(const Carta *a, const Carta *b) {
+    if (a->super_poder != b->super_poder || !formula_atual()->fixa)
+        return (a->super_poder > b->super_poder) - (a->super_poder < b->super_poder);
+    int64_t fa, fb;
+    cartas_forca(a, 1, &fa);
+    cartas_forca(b, 1, &fb);
+    return (fa > fb) - (fa < fb);
+}
+
+// Codificação compacta de cartas:
+// fnv1a: hash FNV-1a de 32 bits (pool de nomes e impressão digital do baralho).
+
+static uint32_t fnv1a(uint32_t h, const void *dados, size_t n) {
+    const unsigned char *p = (const unsigned char *)dados;
+    for (size_t i = 0; i < n; ++i) { h ^= p[i]; h *= 16777619u; }
+    return h;
+}
+
+// comprimento_limitado: como strnlen (que não é C padrão), via memchr.
+static size_t comprimento_limitado(const char *s, size_t max) {
+    const char *fim = memchr(s, '\0', max);
+    return fim ? (size_t)(fim - s) : max;
+}
+
+// pool_internar:
+// - Retorna o índice do nome no pool, inserindo-o se ainda não existir.
+// - Retorna -1 se faltar memória.
+
+int pool_internar(PoolNomes *pool, const char *nome, size_t len) {
+    if (pool->n * 2 >= pool->cap_tabela) {
+        int nova_cap = pool->cap_tabela ? pool->cap_tabela * 2 : 256;
+        int32_t *nova = malloc((size_t)nova_cap * sizeof(int32_t));
+        if (!nova) return -1;
+        for (int i = 0; i < nova_cap; ++i) nova[i] = -1;
+        for (int i = 0; i < pool->n; ++i) {
+            const char *s = pool->texto + pool->inicio[i];
+            uint32_t h = fnv1a(2166136261u, s, strlen(s)) & (uint32_t)(nova_cap - 1);
+            while (nova[h] >= 0) h = (h + 1) & (uint32_t)(nova_cap - 1);
+            nova[h] = i;
+        }
+        free(pool->tabela);
+        pool->tabela = nova;
+        pool->cap_tabela = nova_cap;
+    }
+
+    uint32_t mascara = (uint32_t)(pool->cap_tabela - 1);
+    uint32_t h = fnv1a(2166136261u, nome, len) & mascara;
+    while (pool->tabela[h] >= 0) {
+        const char *s = pool->texto + pool->inicio[pool->tabela[h]];
+        if (strncmp(s, nome, len) == 0 && s[len] == '\0') return pool->tabela[h];
+        h = (h + 1) & mascara;
+    }
+
+    if (pool->n == pool->cap) {
+        int nova_cap = pool->cap ? pool->cap * 2 : 64;
+        uint32_t *novo = realloc(pool->inicio, (size_t)nova_cap * sizeof(uint32_t));
+        if (!novo) return -1;
+        pool->inicio = novo;
+        pool->cap = nova_cap;
+    }
+    if (pool->tam_texto + len + 1 > pool->cap_texto) {
+        size_t nova_cap = pool->cap_texto ? pool->cap_texto * 2 : 1024;
+        while (nova_cap < pool->tam_texto + len + 1) nova_cap *= 2;
+        char *novo = realloc(pool->texto, nova_cap);
+        if (!novo) return -1;
+        pool->texto = novo;
+        pool->cap_texto = nova_cap;
+    }
+    memcpy(pool->texto + pool->tam_texto, nome, len);
+    pool->texto[pool->tam_texto + len] = '\0';
+    pool->inicio[pool->n] = (uint32_t)pool->tam_texto;
+    pool->tam_texto += len + 1;
+    pool->tabela[h] = pool->n;
+    return pool->n++;
+}
+
+const char *pool_nome(const PoolNomes *pool, uint32_t idx) {
+    return idx < (uint32_t)pool->n ? pool->texto + pool->inicio[idx] : "";
+}
+
+void pool_liberar(PoolNomes *pool) {
+    free(pool->texto);
+    free(pool->inicio);
+    free(pool->tabela);
+    memset(pool, 0, sizeof(*pool));
+}
+
+// compactar_carta / expandir_carta:
+// - Conversão sem perdas entre Carta e CartaCompacta.
+// - expandir_carta deixa os derivados inválidos; serão calculados no primeiro acesso.
+
+int compactar_carta(const Carta *c, PoolNomes *pool, CartaCompacta *out) {
+    int nome = pool_internar(pool, c->nome_cidade, comprimento_limitado(c->nome_cidade, sizeof(c->nome_cidade) - 1));
+    if (nome < 0) return 0;
+    out->populacao = (uint32_t)c->populacao;
+    out->area = c->area;
+    out->pib = c->pib;
+    out->nome = (uint32_t)nome;
+    out->num_pontos_turisticos = (uint32_t)c->num_pontos_turisticos;
+    out->estado = c->estado;
+    memcpy(out->codigo, c->codigo, sizeof(out->codigo));
+    return 1;
+}
+
+void expandir_carta(const CartaCompacta *cc, const PoolNomes *pool, Carta *c) {
+    memset(c, 0, sizeof(*c));
+    c->estado = cc->estado;
+    memcpy(c->codigo, cc->codigo, sizeof(cc->codigo));
+    snprintf(c->nome_cidade, sizeof(c->nome_cidade), "%s", pool_nome(pool, cc->nome));
+    c->populacao = (int)cc->populacao;
+    c->area = cc->area;
+    c->pib = cc->pib;
+    c->num_pontos_turisticos = (int)cc->num_pontos_turisticos;
+    invalidar_derivados(c);
+}
+
+// compactar_baralho / liberar_baralho_compacto:
+// - Converte o baralho inteiro, compartilhando nomes repetidos no pool.
+// - Retorna 0 se faltar memória.
+
+int compactar_baralho(const Carta *cartas, int n, BaralhoCompacto *bc) {
+    memset(bc, 0, sizeof(*bc));
+    bc->cartas = malloc((size_t)(n > 0 ? n : 1) * sizeof(CartaCompacta));
+    if (!bc->cartas) return 0;
+    for (int i = 0; i < n; ++i) {
+        if (!compactar_carta(&cartas[i], &bc->nomes, &bc->cartas[i])) return 0;
+        bc->n++;
+    }
+    return 1;
+}
+
+void liberar_baralho_compacto(BaralhoCompacto *bc) {
+    free(bc->cartas);
+    pool_liberar(&bc->nomes);
+    memset(bc, 0, sizeof(*bc));
+}
+
+// Formato compacto em disco (little-endian):
+//   MAGICO_ARQUIVO_COMPACTO
+//   varint n_nomes, e para cada nome: varint tamanho + bytes
+//   varint n_cartas, e para cada carta:
+//     estado (1 byte), tamanho do código (1 byte) + bytes,
+//     varint índice do nome, varint população, área e PIB (float, 4 bytes cada),
+//     varint pontos turísticos
+// Inteiros usam LEB128 (7 bits por byte), então valores típicos ocupam 1 a 4 bytes.
+
+static unsigned char *escrever_varint(unsigned char *p, uint32_t v) {
+    while (v >= 0x80) { *p++ = (unsigned char)(v | 0x80); v >>= 7; }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+// ler_varint: retorna 0 se o buffer terminar ou o valor exceder 32 bits.
+static int ler_varint(const unsigned char **p, const unsigned char *fim, uint32_t *v) {
+    uint32_t r = 0;
+    for (int desloc = 0; desloc < 35; desloc += 7) {
+        if (*p >= fim) return 0;
+        unsigned char b = *(*p)++;
+        r |= (uint32_t)(b & 0x7F) << desloc;
+        if (!(b & 0x80)) { *v = r; return 1; }
+    }
+    return 0;
+}
+
+// codificar_baralho_compacto:
+// - Serializa o baralho em um único buffer (liberar com free) e devolve o tamanho.
+// - Retorna NULL se faltar memória.
+
+unsigned char *codificar_baralho_compacto(const BaralhoCompacto *bc, size_t *tam) {
+    size_t cap = 4 + 5 + bc->nomes.tam_texto + (size_t)bc->nomes.n * 5
+               + 5 + (size_t)bc->n * (1 + 1 + 4 + 5 + 5 + 4 + 4 + 5);
+    unsigned char *buf = malloc(cap);
+    if (!buf) return NULL;
+    unsigned char *p = buf;
+    uint32_t magico = MAGICO_ARQUIVO_COMPACTO;
+    memcpy(p, &magico, 4); p += 4;
+
+    p = escrever_varint(p, (uint32_t)bc->nomes.n);
+    for (int i = 0; i < bc->nomes.n; ++i) {
+        const char *s = pool_nome(&bc->nomes, (uint32_t)i);
+        size_t len = strlen(s);
+        p = escrever_varint(p, (uint32_t)len);
+        memcpy(p, s, len); p += len;
+    }
+
+    p = escrever_varint(p, (uint32_t)bc->n);
+    for (int i = 0; i < bc->n; ++i) {
+        const CartaCompacta *c = &bc->cartas[i];
+        unsigned char len = (unsigned char)comprimento_limitado(c->codigo, sizeof(c->codigo));
+        *p++ = (unsigned char)c->estado;
+        *p++ = len;
+        memcpy(p, c->codigo, len); p += len;
+        p = escrever_varint(p, c->nome);
+        p = escrever_varint(p, c->populacao);
+        memcpy(p, &c->area, 4); p += 4;
+        memcpy(p, &c->pib, 4); p += 4;
+        p = escrever_varint(p, c->num_pontos_turisticos);
+    }
+    *tam = (size_t)(p - buf);
+    return buf;
+}
+
+// decodificar_baralho_compacto:
+// - Lê o buffer gerado por codificar_baralho_compacto, validando limites.
+// - max_cartas: recusa arquivos com mais cartas que isso.
+// - Retorna 1 em sucesso (bc deve ser liberado com liberar_baralho_compacto).
+
+int decodificar_baralho_compacto(const unsigned char *buf, size_t tam, int max_cartas, BaralhoCompacto *bc) {
+    const unsigned char *p = buf, *fim = buf + tam;
+    uint32_t magico, n_nomes, n_cartas, v;
+    memset(bc, 0, sizeof(*bc));
+    if (tam < 4) return 0;
+    memcpy(&magico, p, 4); p += 4;
+    if (magico != MAGICO_ARQUIVO_COMPACTO) return 0;
+
+    if (!ler_varint(&p, fim, &n_nomes)) return 0;
+    for (uint32_t i = 0; i < n_nomes; ++i) {
+        if (!ler_varint(&p, fim, &v) || v > (uint32_t)(fim - p)) goto falha;
+        if (pool_internar(&bc->nomes, (const char *)p, v) != (int)i) goto falha; // nomes repetidos = arquivo inválido
+        p += v;
+    }
+
+    if (!ler_varint(&p, fim, &n_cartas) || n_cartas > (uint32_t)max_cartas) goto falha;
+    bc->cartas = malloc((size_t)(n_cartas ? n_cartas : 1) * sizeof(CartaCompacta));
+    if (!bc->cartas) goto falha;
+    for (uint32_t i = 0; i < n_cartas; ++i) {
+        CartaCompacta *c = &bc->cartas[i];
+        memset(c, 0, sizeof(*c));
+        if (fim - p < 2) goto falha;
+        c->estado = (char)*p++;
+        unsigned char len = *p++;
+        if (len > sizeof(c->codigo) || len > fim - p) goto falha;
+        memcpy(c->codigo, p, len); p += len;
+        if (!ler_varint(&p, fim, &c->nome) || c->nome >= n_nomes) goto falha;
+        if (!ler_varint(&p, fim, &c->populacao)) goto falha;
+        if (fim - p < 8) goto falha;
+        memcpy(&c->area, p, 4); p += 4;
+        memcpy(&c->pib, p, 4); p += 4;
+        if (!ler_varint(&p, fim, &c->num_pontos_turisticos)) goto falha;
+        bc->n++;
+    }
+    return 1;
+
+falha:
+    liberar_baralho_compacto(bc);
+    return 0;
+}
+
+// Baralho dinâmico:
+// baralho_reservar: garante espaço para pelo menos 'minimo' cartas (0 se faltar memória).
+
+int baralho_reservar(Baralho *b, int minimo) {
+    if (minimo <= b->capacidade) return 1;
+    if (minimo > MAX_CARTAS) return 0;
+    int nova = b->capacidade ? b->capacidade : 16;
+    while (nova < minimo) nova = nova > MAX_CARTAS / 2 ? MAX_CARTAS : nova * 2;
+    Carta *novo = realloc(b->cartas, (size_t)nova * sizeof(Carta));
+    if (!novo) return 0;
+    memset(novo + b->capacidade, 0, (size_t)(nova - b->capacidade) * sizeof(Carta));
+    b->cartas = novo;
+    b->capacidade = nova;
+    return 1;
+}
+
+void baralho_liberar(Baralho *b) {
+    free(b->cartas);
+    memset(b, 0, sizeof(*b));
+}
+
+// baralho_modificado: marca que o conteúdo mudou (invalida índices de consulta).
+// Sem saber o trecho, a próxima publicação copia o baralho inteiro.
+
+static void baralho_nova_versao(Baralho *b) {
+    static uint32_t contador = 0;
+    b->versao = ++contador;
+}
+
+void baralho_modificado(Baralho *b) {
+    baralho_nova_versao(b);
+    b->iguais_inicio = b->iguais_fim = 0;
+}
+
+// baralho_alterado: como baralho_modificado, chamado depois de trocar as
+// cartas a partir de 'inicio' por 'inseridas' cartas novas (as que vêm
+// depois só se deslocam). A próxima publicação copia só os blocos do trecho.
+
+void baralho_alterado(Baralho *b, int inicio, int inseridas) {
+    int depois = b->n - inicio - inseridas;
+    baralho_nova_versao(b);
+    if (b->iguais_inicio > inicio) b->iguais_inicio = inicio;
+    if (b->iguais_fim > depois) b->iguais_fim = depois;
+}
+
+// Histórico de versões:
+// versao_soltar / bloco_soltar: liberam quando a última referência sai.
+
+static void bloco_soltar(BlocoVersao *b) {
+    if (--b->refs == 0) free(b);
+}
+
+void versao_soltar(Versao *v) {
+    if (!v || --v->refs > 0) return;
+    for (int i = 0; i < v->n_blocos; ++i) bloco_soltar(v->blocos[i]);
+    free(v->blocos);
+    free(v);
+}
+
+static Versao *versao_reter(Versao *v) {
+    v->refs++;
+    return v;
+}
+
+static int versao_acrescentar_bloco(Versao *v) {
+    if (v->n_blocos == v->cap_blocos) {
+        int nova = v->cap_blocos ? v->cap_blocos * 2 : 16;
+        BlocoVersao **novo = realloc(v->blocos, (size_t)nova * sizeof(BlocoVersao *));
+        if (!novo) return 0;
+        v->blocos = novo;
+        v->cap_blocos = nova;
+    }
+    BlocoVersao *b = malloc(sizeof(BlocoVersao));
+    if (!b) return 0;
+    b->refs = 1;
+    b->n = 0;
+    v->blocos[v->n_blocos++] = b;
+    return 1;
+}
+
+// versao_construir: versão nova (sem compartilhamento) com as cartas dadas.
+static Versao *versao_construir(PoolNomes *nomes, const Carta *cartas, int n) {
+    Versao *v = calloc(1, sizeof(Versao));
+    if (!v) return NULL;
+    v->refs = 1;
+    for (int i = 0; i < n; ++i) {
+        if ((v->n_blocos == 0 || v->blocos[v->n_blocos - 1]->n == VERSAO_BLOCO) && !versao_acrescentar_bloco(v)) {
+            versao_soltar(v);
+            return NULL;
+        }
+        BlocoVersao *b = v->blocos[v->n_blocos - 1];
+        if (!compactar_carta(&cartas[i], nomes, &b->cartas[b->n])) {
+            versao_soltar(v);
+            return NULL;
+        }
+        b->n++;
+        v->n_cartas++;
+    }
+    return v;
+}
+
+// historico_gravavel:
+// - Garante que h->atual não é compartilhada, copiando só a tabela de blocos
+//   (os blocos ganham mais uma referência).
+// - bloco_gravavel copia o bloco i se ele ainda for compartilhado.
+
+static int historico_gravavel(Historico *h) {
+    Versao *v = h->atual;
+    if (v->refs == 1) return 1;
+    Versao *nova = calloc(1, sizeof(Versao));
+    if (!nova) return 0;
+    nova->cap_blocos = v->n_blocos > 0 ? v->n_blocos : 1;
+    nova->blocos = malloc((size_t)nova->cap_blocos * sizeof(BlocoVersao *));
+    if (!nova->blocos) { free(nova); return 0; }
+    for (int i = 0; i < v->n_blocos; ++i) {
+        nova->blocos[i] = v->blocos[i];
+        nova->blocos[i]->refs++;
+    }
+    nova->refs = 1;
+    nova->n_blocos = v->n_blocos;
+    nova->n_cartas = v->n_cartas;
+    versao_soltar(v);
+    h->atual = nova;
+    return 1;
+}
+
+static BlocoVersao *bloco_gravavel(Versao *v, int i) {
+    BlocoVersao *b = v->blocos[i];
+    if (b->refs == 1) return b;
+    BlocoVersao *copia = malloc(sizeof(BlocoVersao));
+    if (!copia) return NULL;
+    copia->refs = 1;
+    copia->n = b->n;
+    memcpy(copia->cartas, b->cartas, (size_t)b->n * sizeof(CartaCompacta));
+    bloco_soltar(b);
+    v->blocos[i] = copia;
+    return copia;
+}
+
+void historico_liberar(Historico *h) {
+    for (int i = 0; i < h->n_desfazer; ++i) versao_soltar(h->desfazer[i].versao);
+    for (int i = 0; i < h->n_refazer; ++i) versao_soltar(h->refazer[i].versao);
+    for (int i = 0; i < h->n_nomeadas; ++i) versao_soltar(h->nomeadas[i].versao);
+    versao_soltar(h->atual);
+    pool_liberar(&h->nomes);
+    memset(h, 0, sizeof(*h));
+}
+
+// historico_iniciar: a versão inicial é o baralho carregado.
+void historico_iniciar(Historico *h, const Baralho *b) {
+    memset(h, 0, sizeof(*h));
+    h->atual = versao_construir(&h->nomes, b->cartas, b->n);
+    if (!h->atual) printf("Memória insuficiente: histórico de versões desativado.\n");
+}
+
+// historico_falhar: sem memória no meio de uma alteração a versão atual
+// deixaria de acompanhar o baralho, então o histórico é desativado.
+static int historico_falhar(Historico *h) {
+    historico_liberar(h);
+    printf("Memória insuficiente: histórico de versões desativado.\n");
+    return 0;
+}
+
+// historico_empilhar: guarda v (referência já retida) no topo da pilha,
+// descartando o nível mais antigo se ela estiver cheia.
+static void historico_empilhar(EntradaHistorico *pilha, int *n, Versao *v, const char *descricao) {
+    if (*n == HISTORICO_NIVEIS) {
+        versao_soltar(pilha[0].versao);
+        memmove(pilha, pilha + 1, (HISTORICO_NIVEIS - 1) * sizeof(EntradaHistorico));
+        (*n)--;
+    }
+    pilha[*n].versao = v;
+    snprintf(pilha[*n].descricao, sizeof(pilha[*n].descricao), "%s", descricao);
+    (*n)++;
+}
+
+// historico_marcar: registra v como o ponto de desfazer de uma nova ação
+// (uma ação nova descarta o que havia para refazer).
+static void historico_marcar(Historico *h, Versao *v, const char *descricao) {
+    historico_empilhar(h->desfazer, &h->n_desfazer, v, descricao);
+    while (h->n_refazer > 0) versao_soltar(h->refazer[--h->n_refazer].versao);
+}
+
+// historico_inserir: acompanha o cadastro de uma carta no fim do baralho.
+int historico_inserir(Historico *h, const Carta *c) {
+    if (!h->atual) return 0;
+    char descricao[MAX_DESCRICAO_VERSAO];
+    snprintf(descricao, sizeof(descricao), "cadastro de %s", c->nome_cidade);
+    historico_marcar(h, versao_reter(h->atual), descricao);
+    if (!historico_gravavel(h)) return historico_falhar(h);
+    Versao *v = h->atual;
+    if ((v->n_blocos == 0 || v->blocos[v->n_blocos - 1]->n == VERSAO_BLOCO) && !versao_acrescentar_bloco(v))
+        return historico_falhar(h);
+    BlocoVersao *b = bloco_gravavel(v, v->n_blocos - 1);
+    if (!b || !compactar_carta(c, &h->nomes, &b->cartas[b->n])) return historico_falhar(h);
+    b->n++;
+    v->n_cartas++;
+    return 1;
+}
+
+// historico_apagar: acompanha a remoção da carta de índice idx.
+// Só o bloco que contém a carta é copiado; um bloco que fica vazio sai da tabela.
+int historico_apagar(Historico *h, int idx) {
+    if (!h->atual || idx < 0 || idx >= h->atual->n_cartas) return 0;
+    int i = 0;
+    while (idx >= h->atual->blocos[i]->n) idx -= h->atual->blocos[i++]->n;
+    char descricao[MAX_DESCRICAO_VERSAO];
+    snprintf(descricao, sizeof(descricao), "remoção de %s", pool_nome(&h->nomes, h->atual->blocos[i]->cartas[idx].nome));
+    historico_marcar(h, versao_reter(h->atual), descricao);
+    if (!historico_gravavel(h)) return historico_falhar(h);
+    Versao *v = h->atual;
+    BlocoVersao *b = bloco_gravavel(v, i);
+    if (!b) return historico_falhar(h);
+    memmove(b->cartas + idx, b->cartas + idx + 1, (size_t)(b->n - idx - 1) * sizeof(CartaCompacta));
+    b->n--;
+    v->n_cartas--;
+    if (b->n == 0) {
+        bloco_soltar(b);
+        memmove(v->blocos + i, v->blocos + i + 1, (size_t)(v->n_blocos - i - 1) * sizeof(BlocoVersao *));
+        v->n_blocos--;
+    }
+    return 1;
+}
+
+// historico_substituir: acompanha a troca do baralho inteiro (ex.: carga do catálogo).
+int historico_substituir(Historico *h, const Carta *cartas, int n, const char *descricao) {
+    if (!h->atual) return 0;
+    Versao *nova = versao_construir(&h->nomes, cartas, n);
+    if (!nova) return historico_falhar(h);
+    historico_marcar(h, h->atual, descricao);
+    h->atual = nova;
+    return 1;
+}
+
+// historico_aplicar:
+// - Torna 'destino' (referência já retida) a versão atual e atualiza o baralho.
+// - Os blocos compartilhados no começo e no fim das duas tabelas já estão no
+//   baralho: o fim só é deslocado e apenas os blocos do meio são expandidos.
+// - Retorna 0 se faltar memória (nada é alterado).
+
+static int historico_aplicar(Historico *h, Versao *destino, Baralho *b) {
+    Versao *origem = h->atual;
+    int comum = origem->n_blocos < destino->n_blocos ? origem->n_blocos : destino->n_blocos;
+    int prefixo = 0, cartas_prefixo = 0;
+    while (prefixo < comum && origem->blocos[prefixo] == destino->blocos[prefixo])
+        cartas_prefixo += destino->blocos[prefixo++]->n;
+    int sufixo = 0, cartas_sufixo = 0;
+    while (sufixo < comum - prefixo &&
+           origem->blocos[origem->n_blocos - 1 - sufixo] == destino->blocos[destino->n_blocos - 1 - sufixo])
+        cartas_sufixo += destino->blocos[destino->n_blocos - 1 - sufixo++]->n;
+
+    if (!baralho_reservar(b, destino->n_cartas)) return 0;
+    memmove(b->cartas + destino->n_cartas - cartas_sufixo, b->cartas + origem->n_cartas - cartas_sufixo,
+            (size_t)cartas_sufixo * sizeof(Carta));
+    int k = cartas_prefixo;
+    for (int i = prefixo; i < destino->n_blocos - sufixo; ++i)
+        for (int j = 0; j < destino->blocos[i]->n; ++j)
+            expandir_carta(&destino->blocos[i]->cartas[j], &h->nomes, &b->cartas[k++]);
+    b->n = destino->n_cartas;
+    baralho_alterado(b, cartas_prefixo, destino->n_cartas - cartas_prefixo - cartas_sufixo);
+    h->atual = destino;
+    versao_soltar(origem);
+    return 1;
+}
+
+// historico_desfazer / historico_refazer:
+// - Movem a versão atual para a outra pilha e aplicam a do topo.
+// - Retornam a descrição da ação desfeita/refeita, ou NULL se não houver.
+
+const char *historico_desfazer(Historico *h, Baralho *b) {
+    if (!h->atual || h->n_desfazer == 0) return NULL;
+    EntradaHistorico *e = &h->desfazer[h->n_desfazer - 1];
+    Versao *anterior = versao_reter(h->atual);
+    if (!historico_aplicar(h, e->versao, b)) { versao_soltar(anterior); return NULL; }
+    h->n_desfazer--;
+    historico_empilhar(h->refazer, &h->n_refazer, anterior, e->descricao);
+    return h->refazer[h->n_refazer - 1].descricao;
+}
+
+const char *historico_refazer(Historico *h, Baralho *b) {
+    if (!h->atual || h->n_refazer == 0) return NULL;
+    EntradaHistorico *e = &h->refazer[h->n_refazer - 1];
+    Versao *anterior = versao_reter(h->atual);
+    if (!historico_aplicar(h, e->versao, b)) { versao_soltar(anterior); return NULL; }
+    h->n_refazer--;
+    historico_empilhar(h->desfazer, &h->n_desfazer, anterior, e->descricao);
+    return h->desfazer[h->n_desfazer - 1].descricao;
+}
+
+// historico_buscar: versão nomeada (NULL se não existir); nome vazio = atual.
+Versao *historico_buscar(Historico *h, const char *nome) {
+    if (nome[0] == '\0') return h->atual;
+    for (int i = 0; i < h->n_nomeadas; ++i)
+        if (strcmp(h->nomeadas[i].descricao, nome) == 0) return h->nomeadas[i].versao;
+    return NULL;
+}
+
+// historico_nomear: guarda a versão atual com um nome (substitui se já existir).
+int historico_nomear(Historico *h, const char *nome) {
+    if (!h->atual) return 0;
+    for (int i = 0; i < h->n_nomeadas; ++i) {
+        if (strcmp(h->nomeadas[i].descricao, nome) == 0) {
+            versao_soltar(h->nomeadas[i].versao);
+            h->nomeadas[i].versao = versao_reter(h->atual);
+            return 1;
+        }
+    }
+    if (h->n_nomeadas == MAX_VERSOES_NOMEADAS) return 0;
+    EntradaHistorico *e = &h->nomeadas[h->n_nomeadas++];
+    e->versao = versao_reter(h->atual);
+    snprintf(e->descricao, sizeof(e->descricao), "%s", nome);
+    return 1;
+}
+
+// historico_restaurar: a versão nomeada volta a ser o baralho (pode ser desfeito).
+int historico_restaurar(Historico *h, const char *nome, Baralho *b) {
+    Versao *v = h->atual ? historico_buscar(h, nome) : NULL;
+    if (!v || nome[0] == '\0') return 0;
+    Versao *anterior = versao_reter(h->atual);
+    if (!historico_aplicar(h, versao_reter(v), b)) {
+        versao_soltar(v);
+        versao_soltar(anterior);
+        return 0;
+    }
+    char descricao[MAX_DESCRICAO_VERSAO];
+    snprintf(descricao, sizeof(descricao), "restauração de '%s'", nome);
+    historico_marcar(h, anterior, descricao);
+    return 1;
+}
+
+static int comparar_ponteiros(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void *const *)a, y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+// blocos_ordenados: cópia ordenada da tabela de blocos (para busca binária).
+static BlocoVersao **blocos_ordenados(const Versao *v) {
+    BlocoVersao **t = malloc((size_t)(v->n_blocos > 0 ? v->n_blocos : 1) * sizeof(BlocoVersao *));
+    if (!t) return NULL;
+    memcpy(t, v->blocos, (size_t)v->n_blocos * sizeof(BlocoVersao *));
+    qsort(t, (size_t)v->n_blocos, sizeof(BlocoVersao *), comparar_ponteiros);
+    return t;
+}
+
+// blocos_compartilhados: quantos blocos de a também estão em b.
+int blocos_compartilhados(const Versao *a, const Versao *b) {
+    BlocoVersao **tb = blocos_ordenados(b);
+    if (!tb) return 0;
+    int comuns = 0;
+    for (int i = 0; i < a->n_blocos; ++i)
+        if (bsearch(&a->blocos[i], tb, (size_t)b->n_blocos, sizeof(BlocoVersao *), comparar_ponteiros)) comuns++;
+    free(tb);
+    return comuns;
+}
+
+// historico_memoria: blocos distintos usados por todas as versões guardadas.
+int historico_memoria(const Historico *h) {
+    int total = 0, n = 0;
+    const Versao *versoes[1 + 2 * HISTORICO_NIVEIS + MAX_VERSOES_NOMEADAS];
+    versoes[n++] = h->atual;
+    for (int i = 0; i < h->n_desfazer; ++i) versoes[n++] = h->desfazer[i].versao;
+    for (int i = 0; i < h->n_refazer; ++i) versoes[n++] = h->refazer[i].versao;
+    for (int i = 0; i < h->n_nomeadas; ++i) versoes[n++] = h->nomeadas[i].versao;
+    for (int i = 0; i < n; ++i) total += versoes[i]->n_blocos;
+    BlocoVersao **todos = malloc((size_t)(total > 0 ? total : 1) * sizeof(BlocoVersao *));
+    if (!todos) return total;
+    int k = 0;
+    for (int i = 0; i < n; ++i) {
+        memcpy(todos + k, versoes[i]->blocos, (size_t)versoes[i]->n_blocos * sizeof(BlocoVersao *));
+        k += versoes[i]->n_blocos;
+    }
+    qsort(todos, (size_t)total, sizeof(BlocoVersao *), comparar_ponteiros);
+    int distintos = 0;
+    for (int i = 0; i < total; ++i) if (i == 0 || todos[i] != todos[i - 1]) distintos++;
+    free(todos);
+    return distintos;
+}
+
+static int comparar_carta_compacta(const void *pa, const void *pb) {
+    const CartaCompacta *a = pa, *b = pb;
+    int r = strncmp(a->codigo, b->codigo, sizeof(a->codigo));
+    if (r == 0) r = (a->estado > b->estado) - (a->estado < b->estado);
+    if (r == 0) r = (a->nome > b->nome) - (a->nome < b->nome);
+    if (r == 0) r = (a->populacao > b->populacao) - (a->populacao < b->populacao);
+    if (r == 0) r = memcmp(&a->area, &b->area, sizeof(a->area));
+    if (r == 0) r = memcmp(&a->pib, &b->pib, sizeof(a->pib));
+    if (r == 0) r = (a->num_pontos_turisticos > b->num_pontos_turisticos) - (a->num_pontos_turisticos < b->num_pontos_turisticos);
+    return r;
+}
+
+// cartas_exclusivas: cartas (ordenadas) dos blocos de v que não estão em 'outros'.
+static CartaCompacta *cartas_exclusivas(const Versao *v, BlocoVersao **outros, int n_outros, int *n) {
+    *n = 0;
+    CartaCompacta *res = malloc((size_t)(v->n_cartas > 0 ? v->n_cartas : 1) * sizeof(CartaCompacta));
+    if (!res) return NULL;
+    for (int i = 0; i < v->n_blocos; ++i) {
+        if (bsearch(&v->blocos[i], outros, (size_t)n_outros, sizeof(BlocoVersao *), comparar_ponteiros)) continue;
+        memcpy(res + *n, v->blocos[i]->cartas, (size_t)v->blocos[i]->n * sizeof(CartaCompacta));
+        *n += v->blocos[i]->n;
+    }
+    qsort(res, (size_t)*n, sizeof(CartaCompacta), comparar_carta_compacta);
+    return res;
+}
+
+static void exibir_diferenca(const Historico *h, char sinal, const CartaCompacta *c, int *exibidas) {
+    if (++*exibidas > DIFERENCAS_EXIBIDAS) return;
+    char codigo[sizeof(c->codigo) + 1];
+    snprintf(codigo, sizeof(codigo), "%.*s", (int)sizeof(c->codigo), c->codigo);
+    set_color(sinal == '+' ? 32 : 31);
+    printf("%c %c %-4s %-30s pop %u | área %.2f | PIB %.2f | pontos %u\n", sinal, c->estado, codigo,
+           pool_nome(&h->nomes, c->nome), c->populacao, c->area, c->pib, c->num_pontos_turisticos);
+    reset_color();
+}
+
+// historico_comparar:
+// - Lista as cartas que só existem em uma das versões (como multiconjunto,
+//   sem considerar a posição).
+// - Blocos compartilhados pelas duas são pulados sem ler as cartas, então o
+//   custo depende do que mudou, não do tamanho do baralho.
+
+int historico_comparar(const Historico *h, const Versao *a, const Versao *b) {
+    BlocoVersao **ta = blocos_ordenados(a), **tb = blocos_ordenados(b);
+    int na = 0, nb = 0;
+    CartaCompacta *sa = ta && tb ? cartas_exclusivas(a, tb, b->n_blocos, &na) : NULL;
+    CartaCompacta *sb = ta && tb ? cartas_exclusivas(b, ta, a->n_blocos, &nb) : NULL;
+    int ok = sa && sb;
+    if (ok) {
+        printf("%d de %d blocos compartilhados; %d cartas comparadas.\n",
+               blocos_compartilhados(b, a), b->n_blocos, na + nb);
+        int i = 0, j = 0, removidas = 0, adicionadas = 0;
+        while (i < na || j < nb) {
+            int r = i == na ? 1 : j == nb ? -1 : comparar_carta_compacta(&sa[i], &sb[j]);
+            if (r == 0) { i++; j++; }
+            else if (r < 0) exibir_diferenca(h, '-', &sa[i++], &removidas);
+            else exibir_diferenca(h, '+', &sb[j++], &adicionadas);
+        }
+        if (removidas > DIFERENCAS_EXIBIDAS || adicionadas > DIFERENCAS_EXIBIDAS)
+            printf("(exibidas até %d diferenças de cada lado)\n", DIFERENCAS_EXIBIDAS);
+        printf("Total: %d cartas adicionadas, %d removidas (%d -> %d cartas).\n",
+               adicionadas, removidas, a->n_cartas, b->n_cartas);
+    }
+    free(ta);
+    free(tb);
+    free(sa);
+    free(sb);
+    return ok;
+}
+
+// Funções de arquivo:
+// arquivo_sincronizar: descarrega o FILE e espera o sistema gravar o conteúdo
+// no disco, para que o rename seguinte nunca aponte para dados perdidos.
+static int arquivo_sincronizar(FILE *f) {
+    if (fflush(f) != 0) return 0;
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+// diretorio_sincronizar: grava no disco as entradas do diretório atual
+// (as renomeações feitas até aqui).
+static void diretorio_sincronizar(void) {
+#ifndef _WIN32
+    int fd = open(".", O_RDONLY);
+    if (fd >= 0) { fsync(fd); close(fd); }
+#endif
+}
+
+// gravar_baralho_compacto / salvar_cartas_arquivo:
+// Grava o baralho no formato compacto (ver codificar_baralho_compacto).
+// Escreve em "<arquivo>.tmp" e renomeia ao final, para que uma falha no
+// meio da gravação nunca destrua o arquivo anterior.
+// Não imprime nada (pode rodar em threads); retorna 1 em sucesso.
+static int gravar_baralho_compacto(const char *arquivo, const BaralhoCompacto *bc) {
+    size_t tam = 0;
+    unsigned char *buf = codificar_baralho_compacto(bc, &tam);
+    if (!buf) return 0;
+
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", arquivo);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) { free(buf); return 0; }
+    size_t escritos = fwrite(buf, 1, tam, f);
+    free(buf);
+    int sincronizado = escritos == tam && arquivo_sincronizar(f);
+    if (fclose(f) != 0 || !sincronizado) { remove(tmp); return 0; }
+#ifdef _WIN32
+    remove(arquivo); // rename não sobrescreve no Windows
+#endif
+    if (rename(tmp, arquivo) != 0) { remove(tmp); return 0; }
+    return 1;
+}
+
+int salvar_cartas_arquivo(const char *arquivo, const Carta *cartas, int n) {
+    BaralhoCompacto bc;
+    int ok = compactar_baralho(cartas, n, &bc) && gravar_baralho_compacto(arquivo, &bc);
+    liberar_baralho_compacto(&bc);
+    return ok;
+}
+
+// salvar_instantaneo_arquivo: como salvar_cartas_arquivo, lendo as cartas
+// direto dos blocos de um instantâneo publicado (sem cópia contínua).
+int salvar_instantaneo_arquivo(const char *arquivo, const Instantaneo *s) {
+    BaralhoCompacto bc;
+    memset(&bc, 0, sizeof(bc));
+    bc.cartas = malloc((size_t)(s->n > 0 ? s->n : 1) * sizeof(CartaCompacta));
+    int ok = bc.cartas != NULL;
+    for (int i = 0; ok && i < s->n_blocos; ++i)
+        for (int j = 0; ok && j < s->blocos[i]->n; ++j)
+            if ((ok = compactar_carta(&s->blocos[i]->cartas[j], &bc.nomes, &bc.cartas[bc.n]))) bc.n++;
+    ok = ok && gravar_baralho_compacto(arquivo, &bc);
+    liberar_baralho_compacto(&bc);
+    return ok;
+}
+
+// salvar_cartas:
+// Grava o baralho atual em ARQUIVO_CARTAS e informa o resultado.
+void salvar_cartas(const Carta *cartas, int n) {
+    if (!salvar_cartas_arquivo(ARQUIVO_CARTAS, cartas, n)) { printf("Erro ao salvar cartas!\n"); return; }
+    set_color(32);
+    printf("Cartas salvas com sucesso!\n");
+    reset_color();
+}
+
+// carregar_cartas_arquivo:
+// Lê o arquivo binário nos dois formatos: compacto (começa com
+// MAGICO_ARQUIVO_COMPACTO) ou antigo (número de cartas + array de CartaArquivoV1)
+// e acrescenta as cartas ao final de b.
+// Os campos derivados ficam inválidos: só são calculados quando usados.
+// Retorna a quantidade de cartas lidas (0 se falha ou não existir).
+
+int carregar_cartas_arquivo(const char *arquivo, Baralho *b) {
+    FILE *f = fopen(arquivo, "rb");
+    if (!f) return 0;
+    int n = 0;
+    if (fread(&n, sizeof(int), 1, f) != 1) { fclose(f); return 0; }
+
+    if ((uint32_t)n == MAGICO_ARQUIVO_COMPACTO) {
+        // Lê o arquivo inteiro de uma vez e decodifica em memória
+        if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return 0; }
+        long tam = ftell(f);
+        if (tam <= 0 || fseek(f, 0, SEEK_SET) != 0) { fclose(f); return 0; }
+        unsigned char *buf = malloc((size_t)tam);
+        if (!buf || fread(buf, 1, (size_t)tam, f) != (size_t)tam) { free(buf); fclose(f); return 0; }
+        fclose(f);
+
+        BaralhoCompacto bc;
+        int ok = decodificar_baralho_compacto(buf, (size_t)tam, MAX_CARTAS - b->n, &bc);
+        free(buf);
+        if (!ok) return 0;
+        if (!baralho_reservar(b, b->n + bc.n)) { liberar_baralho_compacto(&bc); return 0; }
+        for (int i = 0; i < bc.n; ++i) expandir_carta(&bc.cartas[i], &bc.nomes, &b->cartas[b->n + i]);
+        n = bc.n;
+        b->n += n;
+        liberar_baralho_compacto(&bc);
+        return n;
+    }
+
+    if (n < 0 || n > MAX_CARTAS - b->n || !baralho_reservar(b, b->n + n)) { fclose(f); return 0; }
+    for (int i = 0; i < n; ++i) {
+        CartaArquivoV1 v1;
+        if (fread(&v1, sizeof(v1), 1, f) != 1) { fclose(f); return 0; }
+        Carta *c = &b->cartas[b->n + i];
+        memset(c, 0, sizeof(Carta));
+        c->estado = v1.estado;
+        memcpy(c->codigo, v1.codigo, sizeof(v1.codigo));
+        memcpy(c->nome_cidade, v1.nome_cidade, sizeof(v1.nome_cidade));
+        c->populacao = v1.populacao;
+        c->area = v1.area;
+        c->pib = v1.pib;
+        c->num_pontos_turisticos = v1.num_pontos_turisticos;
+    }
+    fclose(f);
+    b->n += n;
+    return n;
+}
+
+// carregar_cartas:
+// Carrega ARQUIVO_CARTAS para o baralho atual.
+
+int carregar_cartas(Baralho *b) {
+    return carregar_cartas_arquivo(ARQUIVO_CARTAS, b);
+}
+
+// Publicação para leitores concorrentes:
+// - Leitor: registra um slot uma vez; a cada leitura leitor_entrar anuncia a
+//   época global no slot e só então lê o ponteiro publicado; leitor_sair zera o slot.
+// - Escritor: troca o ponteiro, avança a época e guarda o antigo com a época
+//   da troca. Quem entrou depois do avanço já enxerga o novo ponteiro, então
+//   o antigo pode ser liberado quando nenhum slot ativo tiver época <= a dele.
+// - Todas as operações atômicas usam ordem sequencial (o padrão), que é o que
+//   garante a ordem "anuncia a época, depois lê o ponteiro".
+
+void publicacao_iniciar(Publicacao *p) {
+    memset(p, 0, sizeof(*p));
+    atomic_init(&p->atual, NULL);
+    atomic_init(&p->epoca, 1);
+    for (int i = 0; i < MAX_LEITORES; ++i) {
+        atomic_init(&p->leitores[i].epoca, 0);
+        atomic_init(&p->leitores[i].ocupado, 0);
+    }
+}
+
+// leitor_registrar: reserva um slot de leitor (-1 se todos estão em uso).
+int leitor_registrar(Publicacao *p) {
+    for (int i = 0; i < MAX_LEITORES; ++i) {
+        int livre = 0;
+        if (atomic_compare_exchange_strong(&p->leitores[i].ocupado, &livre, 1)) return i;
+    }
+    return -1;
+}
+
+void leitor_liberar(Publicacao *p, int slot) {
+    if (slot >= 0) atomic_store(&p->leitores[slot].ocupado, 0);
+}
+
+// leitor_entrar / leitor_sair:
+// - O instantâneo devolvido vale até leitor_sair (pode ser NULL antes da
+//   primeira publicação). Leituras não se aninham no mesmo slot.
+
+const Instantaneo *leitor_entrar(Publicacao *p, int slot) {
+    atomic_store(&p->leitores[slot].epoca, atomic_load(&p->epoca));
+    return atomic_load(&p->atual);
+}
+
+void leitor_sair(Publicacao *p, int slot) {
+    atomic_store(&p->leitores[slot].epoca, 0);
+}
+
+// instantaneo_carta: carta i do instantâneo (busca binária nos inícios dos blocos).
+const Carta *instantaneo_carta(const Instantaneo *s, int i) {
+    int lo = 0, hi = s->n_blocos - 1;
+    while (lo < hi) {
+        int meio = (lo + hi + 1) / 2;
+        if (s->inicio[meio] <= i) lo = meio;
+        else hi = meio - 1;
+    }
+    return &s->blocos[lo]->cartas[i - s->inicio[lo]];
+}
+
+// instantaneo_cartas:
+// - Cópia contínua das cartas para quem precisa de um vetor (partidas,
+//   listagem, consultas, exportação), feita na primeira chamada e guardada
+//   no instantâneo até ele ser liberado. Não deve ser alterada.
+// - Dois leitores podem copiar ao mesmo tempo: fica a primeira cópia
+//   guardada e a outra é descartada. Retorna NULL se faltar memória.
+
+Carta *instantaneo_cartas(const Instantaneo *s) {
+    Instantaneo *m = (Instantaneo *)s; // só o campo atômico muda
+    Carta *cartas = atomic_load(&m->contiguo);
+    if (cartas) return cartas;
+    cartas = malloc((size_t)(s->n > 0 ? s->n : 1) * sizeof(Carta));
+    if (!cartas) return NULL;
+    for (int i = 0; i < s->n_blocos; ++i)
+        memcpy(cartas + s->inicio[i], s->blocos[i]->cartas, (size_t)s->blocos[i]->n * sizeof(Carta));
+    Carta *esperado = NULL;
+    if (atomic_compare_exchange_strong(&m->contiguo, &esperado, cartas)) return cartas;
+    free(cartas);
+    return esperado;
+}
+
+// instantaneo_conferir: refaz a impressão a partir das cartas (1 se confere).
+int instantaneo_conferir(const Instantaneo *s) {
+    uint64_t h = 0, potencia;
+    int n = 0;
+    for (int i = 0; i < s->n_blocos; ++i) {
+        uint64_t b = impressao_bloco(s->blocos[i]->cartas, s->blocos[i]->n, &potencia);
+        h = h * potencia + b;
+        n += s->blocos[i]->n;
+    }
+    return h == s->impressao && n == s->n;
+}
+
+static void instantaneo_liberar(Instantaneo *s) {
+    s->marca = 0;
+    for (int i = 0; i < s->n_blocos; ++i)
+        if (--s->blocos[i]->refs == 0) free(s->blocos[i]);
+    free(s->blocos);
+    free(s->inicio);
+    free(atomic_load(&s->contiguo));
+    free(s);
+}
+
+// publicacao_recolher: libera os retirados que nenhum leitor ativo pode estar usando.
+static void publicacao_recolher(Publicacao *p) {
+    uint_fast64_t minima = UINT_FAST64_MAX;
+    for (int i = 0; i < MAX_LEITORES; ++i) {
+        uint_fast64_t e = atomic_load(&p->leitores[i].epoca);
+        if (e != 0 && e < minima) minima = e;
+    }
+    Instantaneo **pp = &p->retirados;
+    while (*pp) {
+        Instantaneo *s = *pp;
+        if (s->epoca_retirada < minima) {
+            *pp = s->proximo;
+            instantaneo_liberar(s);
+            p->n_retirados--;
+            p->liberados++;
+        } else {
+            pp = &s->proximo;
+        }
+    }
+}
+
+// instantaneo_montar:
+// - Monta o instantâneo de b a partir do anterior: os blocos inteiros dentro
+//   das cartas iguais do começo e do fim (Baralho.iguais_inicio/iguais_fim)
+//   são compartilhados; o trecho do meio é copiado de b em blocos novos, com
+//   os derivados calculados e a impressão do bloco. Vizinhos incompletos
+//   entram no trecho copiado, para cadastros e remoções não fragmentarem a
+//   tabela. A impressão do instantâneo compõe as dos blocos: O(blocos).
+// - Sem anterior, ou com fórmula que normaliza (derivados dependem do baralho
+//   inteiro), o baralho é copiado inteiro; nesse caso a cópia contínua
+//   normalizada fica guardada no instantâneo.
+// - Retorna NULL se faltar memória.
+
+static Instantaneo *instantaneo_montar(const Instantaneo *anterior, const Baralho *b, long *copiadas) {
+    int n = b->n, prefixo = 0, sufixo = 0, inicio_meio = 0, fim_meio = n;
+    Carta *contiguo = NULL;
+    if (anterior && formula_atual()->n_norm == 0) {
+        int iguais_inicio = b->iguais_inicio < anterior->n ? b->iguais_inicio : anterior->n;
+        if (iguais_inicio > n) iguais_inicio = n;
+        int iguais_fim = b->iguais_fim < anterior->n - iguais_inicio ? b->iguais_fim : anterior->n - iguais_inicio;
+        if (iguais_fim > n - iguais_inicio) iguais_fim = n - iguais_inicio;
+        while (prefixo < anterior->n_blocos && anterior->inicio[prefixo + 1] <= iguais_inicio) prefixo++;
+        while (sufixo < anterior->n_blocos - prefixo &&
+               anterior->n - anterior->inicio[anterior->n_blocos - 1 - sufixo] <= iguais_fim) sufixo++;
+        if (prefixo + sufixo < anterior->n_blocos || anterior->n != n) {
+            if (prefixo > 0 && anterior->blocos[prefixo - 1]->n < VERSAO_BLOCO) prefixo--;
+            if (sufixo > 0 && anterior->blocos[anterior->n_blocos - sufixo]->n < VERSAO_BLOCO) sufixo--;
+        }
+        inicio_meio = anterior->inicio[prefixo];
+        fim_meio = n - (anterior->n - anterior->inicio[anterior->n_blocos - sufixo]);
+    } else if (formula_atual()->n_norm > 0) {
+        contiguo = malloc((size_t)(n > 0 ? n : 1) * sizeof(Carta));
+        if (!contiguo) return NULL;
+        memcpy(contiguo, b->cartas, (size_t)n * sizeof(Carta));
+        garantir_derivados(contiguo, n);
+    }
+
+    int meio = fim_meio - inicio_meio;
+    int novos = (meio + VERSAO_BLOCO - 1) / VERSAO_BLOCO;
+    Instantaneo *s = calloc(1, sizeof(Instantaneo));
+    if (!s) { free(contiguo); return NULL; }
+    s->n_blocos = prefixo + novos + sufixo;
+    s->blocos = calloc((size_t)(s->n_blocos > 0 ? s->n_blocos : 1), sizeof(BlocoInstantaneo *));
+    s->inicio = malloc((size_t)(s->n_blocos + 1) * sizeof(int));
+    if (!s->blocos || !s->inicio) goto falha;
+
+    const Carta *origem = (contiguo ? contiguo : b->cartas) + inicio_meio;
+    for (int i = 0; i < novos; ++i) {
+        int m = meio - i * VERSAO_BLOCO < VERSAO_BLOCO ? meio - i * VERSAO_BLOCO : VERSAO_BLOCO;
+        BlocoInstantaneo *bloco = malloc(sizeof(BlocoInstantaneo) + (size_t)m * sizeof(Carta));
+        if (!bloco) goto falha;
+        bloco->refs = 1;
+        bloco->n = m;
+        memcpy(bloco->cartas, origem + (size_t)i * VERSAO_BLOCO, (size_t)m * sizeof(Carta));
+        if (!contiguo) garantir_derivados(bloco->cartas, m);
+        bloco->impressao = impressao_bloco(bloco->cartas, m, &bloco->potencia);
+        s->blocos[prefixo + i] = bloco;
+    }
+    for (int i = 0; i < prefixo; ++i) (s->blocos[i] = anterior->blocos[i])->refs++;
+    for (int i = 0; i < sufixo; ++i)
+        (s->blocos[prefixo + novos + i] = anterior->blocos[anterior->n_blocos - sufixo + i])->refs++;
+    *copiadas += meio;
+
+    uint64_t h = 0;
+    int k = 0;
+    for (int i = 0; i < s->n_blocos; ++i) {
+        s->inicio[i] = k;
+        k += s->blocos[i]->n;
+        h = h * s->blocos[i]->potencia + s->blocos[i]->impressao;
+    }
+    s->inicio[s->n_blocos] = k;
+    s->n = n;
+    s->impressao = h;
+    atomic_init(&s->contiguo, contiguo);
+    s->marca = MARCA_INSTANTANEO;
+    return s;
+
+falha:
+    for (int i = 0; s->blocos && i < novos; ++i) free(s->blocos[prefixo + i]);
+    free(s->blocos);
+    free(s->inicio);
+    free(s);
+    free(contiguo);
+    return NULL;
+}
+
+// publicar_baralho:
+// - Publica um instantâneo de b (ver instantaneo_montar) e recolhe o que for
+//   possível. Um cadastro ou remoção copia só o bloco tocado (e vizinhos
+//   incompletos), não o baralho inteiro.
+// - Em sucesso b passa a ser igual ao publicado (iguais_inicio/iguais_fim = n).
+// - Retorna 0 se faltar memória (os leitores continuam com o instantâneo anterior).
+
+int publicar_baralho(Publicacao *p, Baralho *b) {
+    Instantaneo *s = instantaneo_montar(atomic_load(&p->atual), b, &p->copiadas);
+    if (!s) return 0;
+    s->versao = b->versao;
+    s->proximo = NULL;
+    b->iguais_inicio = b->iguais_fim = b->n;
+
+    Instantaneo *antigo = atomic_exchange(&p->atual, s);
+    p->publicados++;
+    if (antigo) {
+        antigo->epoca_retirada = atomic_fetch_add(&p->epoca, 1);
+        antigo->proximo = p->retirados;
+        p->retirados = antigo;
+        if (++p->n_retirados > p->max_retirados) p->max_retirados = p->n_retirados;
+    }
+    publicacao_recolher(p);
+    return 1;
+}
+
+// publicacao_encerrar: libera tudo; não pode haver leitores ativos.
+void publicacao_encerrar(Publicacao *p) {
+    Instantaneo *s = atomic_exchange(&p->atual, NULL);
+    if (s) instantaneo_liberar(s);
+    while (p->retirados) {
+        s = p->retirados;
+        p->retirados = s->proximo;
+        instantaneo_liberar(s);
+    }
+    p->n_retirados = 0;
+}
+
+// Autosave em segundo plano:
+// A thread de gravação dorme até haver alteração pendente e então espera o
+// prazo (ou AUTOSAVE_EDICOES alterações) antes de gravar o instantâneo
+// publicado mais recente. Sem pthreads (Windows) a gravação é feita na hora,
+// ao atingir AUTOSAVE_EDICOES.
+
+#ifndef _WIN32
+static void *thread_autosave(void *arg) {
+    Autosave *as = (Autosave *)arg;
+    pthread_mutex_lock(&as->mutex);
+    for (;;) {
+        while (!as->pendente && !as->encerrar) pthread_cond_wait(&as->cond, &as->mutex);
+        if (!as->pendente) break; // encerrar sem nada pendente
+
+        // Espera o prazo, acumulando (coalescendo) novas alterações
+        while (as->pendente && !as->encerrar && as->edicoes < AUTOSAVE_EDICOES && time(NULL) < as->prazo) {
+            struct timespec limite = { as->prazo, 0 };
+            pthread_cond_timedwait(&as->cond, &as->mutex, &limite);
+        }
+        if (!as->pendente) continue;
+
+        as->pendente = 0;
+        as->edicoes = 0;
+        pthread_mutex_unlock(&as->mutex);
+
+        // Sem lock e sem cópia: o menu segue publicando enquanto a gravação lê
+        const Instantaneo *snap = leitor_entrar(as->publicacao, as->leitor);
+        int n = snap ? snap->n : 0;
+        int ok = snap && salvar_instantaneo_arquivo(ARQUIVO_CARTAS, snap);
+        leitor_sair(as->publicacao, as->leitor);
+
+        pthread_mutex_lock(&as->mutex);
+        if (ok) { as->concluidos++; as->cartas_gravadas = n; }
+        else as->falhas++;
+    }
+    pthread_mutex_unlock(&as->mutex);
+    return NULL;
+}
+#endif
+
+// autosave_iniciar: prepara o estado e dispara a thread de gravação.
+// O autosave lê o baralho publicado em 'publicacao' com um slot de leitor próprio.
+
+void autosave_iniciar(Autosave *as, Publicacao *publicacao) {
+    memset(as, 0, sizeof(*as));
+    as->publicacao = publicacao;
+    as->leitor = leitor_registrar(publicacao);
+    if (as->leitor < 0) return; // sem slot: só a gravação manual
+#ifndef _WIN32
+    pthread_mutex_init(&as->mutex, NULL);
+    pthread_cond_init(&as->cond, NULL);
+    as->ativo = pthread_create(&as->thread, NULL, thread_autosave, as) == 0;
+#endif
+}
+
+// autosave_agendar:
+// - Avisa que uma alteração foi publicada; a gravação lê o instantâneo
+//   mais recente quando chegar a hora.
+// - Se já havia alteração esperando, as duas saem na mesma gravação.
+
+void autosave_agendar(Autosave *as) {
+    if (as->leitor < 0) return;
+#ifndef _WIN32
+    if (as->ativo) {
+        pthread_mutex_lock(&as->mutex);
+        if (as->pendente) as->coalescidos++;
+        else as->prazo = time(NULL) + AUTOSAVE_INTERVALO_SEG;
+        as->pendente = 1;
+        as->edicoes++;
+        pthread_cond_signal(&as->cond);
+        pthread_mutex_unlock(&as->mutex);
+        return;
+    }
+#endif
+    // Sem thread: grava de forma síncrona a cada AUTOSAVE_EDICOES alterações
+    if (++as->edicoes >= AUTOSAVE_EDICOES) {
+        as->edicoes = 0;
+        const Instantaneo *snap = leitor_entrar(as->publicacao, as->leitor);
+        if (snap && salvar_instantaneo_arquivo(ARQUIVO_CARTAS, snap)) { as->concluidos++; as->cartas_gravadas = snap->n; }
+        else as->falhas++;
+        leitor_sair(as->publicacao, as->leitor);
+    }
+}
+
+// autosave_tem_relato: 1 se autosave_relatar tem algo a imprimir.
+
+int autosave_tem_relato(Autosave *as) {
+    int tem;
+#ifndef _WIN32
+    if (as->ativo) pthread_mutex_lock(&as->mutex);
+#endif
+    tem = as->concluidos > 0 || as->falhas > 0;
+#ifndef _WIN32
+    if (as->ativo) pthread_mutex_unlock(&as->mutex);
+#endif
+    return tem;
+}
+
+// autosave_relatar:
+// - Chamado pelo menu a cada volta: informa gravações concluídas desde a
+//   última chamada, sem esperar pela thread.
+// - Retorna 1 se imprimiu algo.
+
+int autosave_relatar(Autosave *as) {
+    int concluidos, falhas, coalescidos, cartas;
+#ifndef _WIN32
+    if (as->ativo) pthread_mutex_lock(&as->mutex);
+#endif
+    concluidos = as->concluidos; falhas = as->falhas; coalescidos = as->coalescidos;
+    cartas = as->cartas_gravadas;
+    as->concluidos = as->falhas = 0;
+    if (concluidos > 0 || falhas > 0) as->coalescidos = 0;
+#ifndef _WIN32
+    if (as->ativo) pthread_mutex_unlock(&as->mutex);
+#endif
+    if (concluidos > 0) {
+        set_color(32);
+        printf("Autosave: %d cartas gravadas em %s", cartas, ARQUIVO_CARTAS);
+        if (coalescidos > 0) printf(" (%d alterações agrupadas)", coalescidos);
+        printf(".\n");
+        reset_color();
+    }
+    if (falhas > 0) {
+        set_color(33);
+        printf("Autosave: falha ao gravar %s.\n", ARQUIVO_CARTAS);
+        reset_color();
+    }
+    return concluidos > 0 || falhas > 0;
+}
+
+// autosave_encerrar:
+// - Grava imediatamente o que estiver pendente e finaliza a thread.
+
+void autosave_encerrar(Autosave *as) {
+#ifndef _WIN32
+    if (as->ativo) {
+        pthread_mutex_lock(&as->mutex);
+        as->encerrar = 1;
+        pthread_cond_signal(&as->cond);
+        pthread_mutex_unlock(&as->mutex);
+        pthread_join(as->thread, NULL);
+        pthread_mutex_destroy(&as->mutex);
+        pthread_cond_destroy(&as->cond);
+        as->ativo = 0;
+    }
+#endif
+    leitor_liberar(as->publicacao, as->leitor);
+    as->leitor = -1;
+}
+
+// Execução paralela:
+// executar_em_paralelo:
+// - Roda tarefa(ctx, i) para i = 0..n_tarefas-1, uma thread por tarefa.
+// - Sem pthreads (Windows) as tarefas rodam em sequência.
+
+#ifndef _WIN32
+typedef struct TarefaThread {
+    void (*tarefa)(void *ctx, int i);
+    void *ctx;
+    int i;
+} TarefaThread;
+
+static void *executar_tarefa_thread(void *arg) {
+    TarefaThread *t = (TarefaThread *)arg;
+    t->tarefa(t->ctx, t->i);
+    return NULL;
+}
+#endif
+
+void executar_em_paralelo(int n_tarefas, void (*tarefa)(void *ctx, int i), void *ctx) {
+#ifndef _WIN32
+    pthread_t *threads = malloc((size_t)(n_tarefas > 0 ? n_tarefas : 1) * sizeof(pthread_t));
+    TarefaThread *args = malloc((size_t)(n_tarefas > 0 ? n_tarefas : 1) * sizeof(TarefaThread));
+    unsigned char *criada = calloc((size_t)(n_tarefas > 0 ? n_tarefas : 1), 1);
+    if (threads && args && criada) {
+        for (int i = 0; i < n_tarefas; ++i) {
+            args[i].tarefa = tarefa;
+            args[i].ctx = ctx;
+            args[i].i = i;
+            criada[i] = pthread_create(&threads[i], NULL, executar_tarefa_thread, &args[i]) == 0;
+            if (!criada[i]) tarefa(ctx, i); // sem recursos para outra thread: roda aqui mesmo
+        }
+        for (int i = 0; i < n_tarefas; ++i) if (criada[i]) pthread_join(threads[i], NULL);
+        free(threads); free(args); free(criada);
+        return;
+    }
+    free(threads); free(args); free(criada);
+#endif
+    for (int i = 0; i < n_tarefas; ++i) tarefa(ctx, i);
+}
+
+// Catálogo de baralhos:
+// calcular_zona: mínimos/máximos dos atributos filtráveis de n cartas.
+
+void calcular_zona(const Carta *cartas, int n, ZonaBloco *z) {
+    z->pop_min = INT32_MAX; z->pop_max = INT32_MIN;
+    z->area_min = FLT_MAX; z->area_max = -FLT_MAX;
+    z->pib_min = FLT_MAX; z->pib_max = -FLT_MAX;
+    z->estados = 0;
+    for (int i = 0; i < n; ++i) {
+        const Carta *c = &cartas[i];
+        if (c->populacao < z->pop_min) z->pop_min = c->populacao;
+        if (c->populacao > z->pop_max) z->pop_max = c->populacao;
+        if (c->area < z->area_min) z->area_min = c->area;
+        if (c->area > z->area_max) z->area_max = c->area;
+        if (c->pib < z->pib_min) z->pib_min = c->pib;
+        if (c->pib > z->pib_max) z->pib_max = c->pib;
+        if (c->estado >= 'A' && c->estado <= 'Z') z->estados |= 1u << (c->estado - 'A');
+    }
+}
+
+// valida_nome_baralho: letras, dígitos, '_' e '-' (o nome vira parte do nome dos arquivos).
+
+int valida_nome_baralho(const char *nome) {
+    size_t L = strlen(nome);
+    if (L == 0 || L >= MAX_NOME_BARALHO) return 0;
+    for (size_t i = 0; i < L; ++i)
+        if (!isalnum((unsigned char)nome[i]) && nome[i] != '_' && nome[i] != '-') return 0;
+    return 1;
+}
+
+void liberar_catalogo(Catalogo *cat) {
+    free(cat->shards);
+    memset(cat, 0, sizeof(*cat));
+}
+
+static int catalogo_adicionar(Catalogo *cat, const EntradaCatalogo *e) {
+    if (cat->n == cat->cap) {
+        int nova = cat->cap ? cat->cap * 2 : 16;
+        EntradaCatalogo *novo = realloc(cat->shards, (size_t)nova * sizeof(EntradaCatalogo));
+        if (!novo) return 0;
+        cat->shards = novo;
+        cat->cap = nova;
+    }
+    cat->shards[cat->n++] = *e;
+    return 1;
+}
+
+// carregar_catalogo:
+// - Lê o manifesto. Linhas malformadas são ignoradas.
+// - Retorna a quantidade de shards (0 se o catálogo não existir).
+
+int carregar_catalogo(Catalogo *cat) {
+    memset(cat, 0, sizeof(*cat));
+    FILE *f = fopen(ARQUIVO_CATALOGO, "r");
+    if (!f) return 0;
+    char linha[256];
+    while (fgets(linha, sizeof(linha), f)) {
+        EntradaCatalogo e;
+        memset(&e, 0, sizeof(e));
+        int campos = sscanf(linha, "%31s %d %63s %d %d %d %g %g %g %g %x", e.baralho, &e.indice, e.arquivo, &e.n_cartas,
+                            &e.zona.pop_min, &e.zona.pop_max, &e.zona.area_min, &e.zona.area_max,
+                            &e.zona.pib_min, &e.zona.pib_max, &e.zona.estados);
+        if (campos < 4) continue;
+        e.tem_zona = campos == 11;
+        if (!valida_nome_baralho(e.baralho) || e.indice < 0 || e.n_cartas < 0) continue;
+        if (!catalogo_adicionar(cat, &e)) break;
+    }
+    fclose(f);
+    return cat->n;
+}
+
+// salvar_catalogo:
+// - Regrava o manifesto em um arquivo temporário e o renomeia por cima do antigo,
+//   para nunca deixar um manifesto pela metade.
+// - Só retorna 1 depois que o manifesto novo está gravado no disco.
+
+int salvar_catalogo(const Catalogo *cat) {
+    const char *tmp = ARQUIVO_CATALOGO ".tmp";
+    FILE *f = fopen(tmp, "w");
+    if (!f) return 0;
+    for (int i = 0; i < cat->n; ++i) {
+        const EntradaCatalogo *e = &cat->shards[i];
+        fprintf(f, "%s %d %s %d", e->baralho, e->indice, e->arquivo, e->n_cartas);
+        if (e->tem_zona)
+            fprintf(f, " %d %d %.9g %.9g %.9g %.9g %x", (int)e->zona.pop_min, (int)e->zona.pop_max,
+                    e->zona.area_min, e->zona.area_max, e->zona.pib_min, e->zona.pib_max, (unsigned)e->zona.estados);
+        fprintf(f, "\n");
+    }
+    int sincronizado = arquivo_sincronizar(f);
+    if (fclose(f) != 0 || !sincronizado) { remove(tmp); return 0; }
+#ifdef _WIN32
+    remove(ARQUIVO_CATALOGO); // rename não sobrescreve no Windows
+#endif
+    if (rename(tmp, ARQUIVO_CATALOGO) != 0) { remove(tmp); return 0; }
+    diretorio_sincronizar();
+    return 1;
+}
+
+// Contexto compartilhado pelas threads de gravação e leitura de shards.
+typedef struct TrabalhoShards {
+    EntradaCatalogo *shards;          // shards a processar (um por thread)
+    const Carta *origem;              // gravação: baralho completo
+    const int *inicio;                // gravação: primeira carta de cada shard
+    Baralho *partes;                  // leitura: resultado de cada shard
+    int *ok;                          // 1 se o shard foi processado sem erro
+} TrabalhoShards;
+
+// gravar_shard: grava o shard e calcula o mapa de zona que vai para o manifesto.
+static void gravar_shard(void *ctx, int i) {
+    TrabalhoShards *t = (TrabalhoShards *)ctx;
+    EntradaCatalogo *e = &t->shards[i];
+    calcular_zona(t->origem + t->inicio[i], e->n_cartas, &e->zona);
+    e->tem_zona = 1;
+    t->ok[i] = salvar_cartas_arquivo(e->arquivo, t->origem + t->inicio[i], e->n_cartas);
+}
+
+// ler_shard: carrega o shard e já recalcula os derivados dele na mesma thread.
+static void ler_shard(void *ctx, int i) {
+    TrabalhoShards *t = (TrabalhoShards *)ctx;
+    Baralho *b = &t->partes[i];
+    memset(b, 0, sizeof(*b));
+    t->ok[i] = carregar_cartas_arquivo(t->shards[i].arquivo, b) == t->shards[i].n_cartas;
+    if (t->ok[i]) derivar_cartas_thread(b->cartas, b->n);
+}
+
+// geracao_shard: geração gravada no nome de um shard do baralho 'nome'
+// (0 para shards sem geração no nome, do formato <nome>.<índice>.bin).
+static unsigned geracao_shard(const char *nome, const char *arquivo) {
+    unsigned g = 0;
+    size_t L = strlen(nome);
+    if (strncmp(arquivo, nome, L) == 0 && arquivo[L] == '.' && sscanf(arquivo + L + 1, "g%u.", &g) == 1) return g;
+    return 0;
+}
+
+// salvar_baralho_catalogo:
+// - Divide o baralho em n_shards partes contíguas e grava uma por thread.
+// - Os shards novos recebem uma geração nova no nome, então os da versão
+//   anterior ficam intactos até o manifesto novo estar gravado; só então
+//   são apagados. Em caso de falha os shards novos são removidos e o
+//   catálogo (em memória e em disco) continua como estava.
+// - Retorna 1 em sucesso.
+
+int salvar_baralho_catalogo(Catalogo *cat, const char *nome, const Carta *cartas, int n, int n_shards) {
+    if (!valida_nome_baralho(nome)) return 0;
+    if (n_shards > n) n_shards = n;
+    if (n_shards < 1) n_shards = 1;
+
+    unsigned geracao = 0;
+    for (int i = 0; i < cat->n; ++i) {
+        if (strcmp(cat->shards[i].baralho, nome) != 0) continue;
+        unsigned g = geracao_shard(nome, cat->shards[i].arquivo);
+        if (g > geracao) geracao = g;
+    }
+    ++geracao;
+
+    EntradaCatalogo *novos = calloc((size_t)n_shards, sizeof(EntradaCatalogo));
+    int *inicio = malloc((size_t)n_shards * sizeof(int));
+    int *ok = calloc((size_t)n_shards, sizeof(int));
+    if (!novos || !inicio || !ok) { free(novos); free(inicio); free(ok); return 0; }
+    for (int i = 0; i < n_shards; ++i) {
+        inicio[i] = (int)((long long)n * i / n_shards);
+        int fim = (int)((long long)n * (i + 1) / n_shards);
+        snprintf(novos[i].baralho, sizeof(novos[i].baralho), "%s", nome);
+        snprintf(novos[i].arquivo, sizeof(novos[i].arquivo), "%s.g%u.%03d.bin", nome, geracao, i);
+        novos[i].indice = i;
+        novos[i].n_cartas = fim - inicio[i];
+    }
+
+    TrabalhoShards t = { novos, cartas, inicio, NULL, ok };
+    executar_em_paralelo(n_shards, gravar_shard, &t);
+    int sucesso = 1;
+    for (int i = 0; i < n_shards; ++i) if (!ok[i]) sucesso = 0;
+
+    // Manifesto novo: outros baralhos como estão e as entradas novas deste
+    Catalogo novo;
+    memset(&novo, 0, sizeof(novo));
+    for (int i = 0; i < cat->n && sucesso; ++i)
+        if (strcmp(cat->shards[i].baralho, nome) != 0) sucesso = catalogo_adicionar(&novo, &cat->shards[i]);
+    for (int i = 0; i < n_shards && sucesso; ++i) sucesso = catalogo_adicionar(&novo, &novos[i]);
+    if (sucesso) sucesso = salvar_catalogo(&novo);
+
+    if (sucesso) {
+        for (int i = 0; i < cat->n; ++i)
+            if (strcmp(cat->shards[i].baralho, nome) == 0) remove(cat->shards[i].arquivo);
+        liberar_catalogo(cat);
+        *cat = novo;
+    } else {
+        for (int i = 0; i < n_shards; ++i) remove(novos[i].arquivo);
+        liberar_catalogo(&novo);
+    }
+    free(novos); free(inicio); free(ok);
+    return sucesso;
+}
+
+// carregar_baralho_catalogo:
+// - Lê os shards do baralho 'nome' (uma thread por shard, cada uma já
+//   recalculando os derivados) e os concatena em 'saida', na ordem dos índices.
+// - selecionar(entrada, ctx), se não for NULL, decide quais shards ler;
+//   shards descartados nem são abertos.
+// - Retorna a quantidade de shards lidos, ou -1 em erro.
+
+int carregar_baralho_catalogo(const Catalogo *cat, const char *nome, Baralho *saida,
+                              int (*selecionar)(const EntradaCatalogo *e, void *ctx), void *ctx) {
+    memset(saida, 0, sizeof(*saida));
+    EntradaCatalogo *escolhidos = malloc((size_t)(cat->n > 0 ? cat->n : 1) * sizeof(EntradaCatalogo));
+    if (!escolhidos) return -1;
+    int n = 0;
+    for (int i = 0; i < cat->n; ++i) {
+        const EntradaCatalogo *e = &cat->shards[i];
+        if (strcmp(e->baralho, nome) != 0) continue;
+        if (selecionar && !selecionar(e, ctx)) continue;
+        // inserção ordenada por índice (o manifesto pode estar fora de ordem)
+        int j = n++;
+        while (j > 0 && escolhidos[j - 1].indice > e->indice) { escolhidos[j] = escolhidos[j - 1]; --j; }
+        escolhidos[j] = *e;
+    }
+
+    Baralho *partes = calloc((size_t)(n > 0 ? n : 1), sizeof(Baralho));
+    int *ok = calloc((size_t)(n > 0 ? n : 1), sizeof(int));
+    if (!partes || !ok) { free(escolhidos); free(partes); free(ok); return -1; }
+    TrabalhoShards t = { escolhidos, NULL, NULL, partes, ok };
+    executar_em_paralelo(n, ler_shard, &t);
+
+    long long total = 0;
+    int sucesso = 1;
+    for (int i = 0; i < n; ++i) { total += partes[i].n; if (!ok[i]) sucesso = 0; }
+    if (sucesso && (total > MAX_CARTAS || !baralho_reservar(saida, (int)total))) sucesso = 0;
+    for (int i = 0; i < n; ++i) {
+        if (sucesso) {
+            memcpy(saida->cartas + saida->n, partes[i].cartas, (size_t)partes[i].n * sizeof(Carta));
+            saida->n += partes[i].n;
+        }
+        baralho_liberar(&partes[i]);
+    }
+    free(escolhidos); free(partes); free(ok);
+    if (!sucesso) { baralho_liberar(saida); return -1; }
+    return n;
+}
+
+// exibir_catalogo:
+// - Lista os baralhos do catálogo com quantidade de shards e cartas.
+
+void exibir_catalogo(const Catalogo *cat) {
+    if (cat->n == 0) {
+        printf("Catálogo vazio.\n");
+        return;
+    }
+    printf("Baralhos no catálogo:\n");
+    for (int i = 0; i < cat->n; ++i) {
+        int repetido = 0;
+        for (int k = 0; k < i; ++k) if (strcmp(cat->shards[k].baralho, cat->shards[i].baralho) == 0) { repetido = 1; break; }
+        if (repetido) continue;
+        int shards = 0;
+        long long cartas = 0;
+        for (int k = i; k < cat->n; ++k) {
+            if (strcmp(cat->shards[k].baralho, cat->shards[i].baralho) != 0) continue;
+            shards++;
+            cartas += cat->shards[k].n_cartas;
+        }
+        printf("- %s | shards: %d | cartas: %lld\n", cat->shards[i].baralho, shards, cartas);
+    }
+}
+
+// Consultas sobre o baralho:
+// consulta_padrao: consulta sem filtros, sem ordenação e sem limite.
+
+void consulta_padrao(Consulta *q) {
+    memset(q, 0, sizeof(*q));
+    q->pop_min = INT32_MIN; q->pop_max = INT32_MAX;
+    q->area_min = -FLT_MAX; q->area_max = FLT_MAX;
+    q->pib_min = -FLT_MAX; q->pib_max = FLT_MAX;
+}
+
+// interpretar_consulta:
+// - Lê termos separados por espaço, por exemplo:
+//     estado=A,B populacao>=100000 area<=500 pib>=10 prefixo="Porto A" ordem=-populacao limite=10
+// - Campos numéricos (populacao, area, pib) aceitam >=, <= e =.
+// - ordem: populacao, area, pib, pontos, super_poder ou nome ('-' na frente = decrescente).
+// - Retorna 1 se a consulta é válida; senão imprime o termo problemático e retorna 0.
+
+int interpretar_consulta(const char *texto, Consulta *q) {
+    consulta_padrao(q);
+    const char *p = texto;
+    char termo[128];
+    for (;;) {
+        while (*p == ' ' || *p == '\t') ++p;
+        if (*p == '\0') return 1;
+
+        // Copia o termo respeitando aspas (prefixos com espaço)
+        size_t L = 0;
+        int aspas = 0;
+        while (*p && (aspas || (*p != ' ' && *p != '\t'))) {
+            if (*p == '"') { aspas = !aspas; ++p; continue; }
+            if (L + 1 < sizeof(termo)) termo[L++] = *p;
+            ++p;
+        }
+        termo[L] = '\0';
+
+        char *op = strpbrk(termo, "<>=");
+        if (!op) { printf("Termo inválido: %s\n", termo); return 0; }
+        char campo[32];
+        size_t lc = (size_t)(op - termo);
+        if (lc >= sizeof(campo)) lc = sizeof(campo) - 1;
+        memcpy(campo, termo, lc);
+        campo[lc] = '\0';
+        int cmp = 0; // -1: <=, 0: =, 1: >=
+        if (op[0] == '>' && op[1] == '=') { cmp = 1; op += 2; }
+        else if (op[0] == '<' && op[1] == '=') { cmp = -1; op += 2; }
+        else if (op[0] == '=') { op += 1; }
+        else { printf("Operador inválido em: %s (use >=, <= ou =)\n", termo); return 0; }
+        const char *valor = op;
+        char *end;
+
+        if (strcmp(campo, "populacao") == 0 || strcmp(campo, "pop") == 0) {
+            long long v = strtoll(valor, &end, 10);
+            if (end == valor || *end != '\0') { printf("Valor inválido em: %s\n", termo); return 0; }
+            if (v < INT32_MIN) v = INT32_MIN;
+            if (v > INT32_MAX) v = INT32_MAX;
+            if (cmp >= 0 && (int32_t)v > q->pop_min) q->pop_min = (int32_t)v;
+            if (cmp <= 0 && (int32_t)v < q->pop_max) q->pop_max = (int32_t)v;
+        } else if (strcmp(campo, "area") == 0 || strcmp(campo, "pib") == 0) {
+            float v = strtof(valor, &end);
+            if (end == valor || *end != '\0') { printf("Valor inválido em: %s\n", termo); return 0; }
+            float *mn = campo[0] == 'a' ? &q->area_min : &q->pib_min;
+            float *mx = campo[0] == 'a' ? &q->area_max : &q->pib_max;
+            if (cmp >= 0 && v > *mn) *mn = v;
+            if (cmp <= 0 && v < *mx) *mx = v;
+        } else if (strcmp(campo, "estado") == 0 && cmp == 0) {
+            for (const char *c = valor; *c; ++c) {
+                if (*c == ',') continue;
+                if (!valida_estado(*c)) { printf("Estado inválido em: %s\n", termo); return 0; }
+                q->estados |= 1u << (toupper((unsigned char)*c) - 'A');
+            }
+        } else if ((strcmp(campo, "prefixo") == 0 || strcmp(campo, "nome") == 0) && cmp == 0) {
+            snprintf(q->prefixo, sizeof(q->prefixo), "%s", valor);
+        } else if (strcmp(campo, "ordem") == 0 && cmp == 0) {
+            q->decrescente = valor[0] == '-';
+            if (valor[0] == '-' || valor[0] == '+') ++valor;
+            if (strcmp(valor, "populacao") == 0 || strcmp(valor, "pop") == 0) q->ordem = ORDEM_POPULACAO;
+            else if (strcmp(valor, "area") == 0) q->ordem = ORDEM_AREA;
+            else if (strcmp(valor, "pib") == 0) q->ordem = ORDEM_PIB;
+            else if (strcmp(valor, "pontos") == 0) q->ordem = ORDEM_PONTOS;
+            else if (strcmp(valor, "super_poder") == 0 || strcmp(valor, "super") == 0) q->ordem = ORDEM_SUPER_PODER;
+            else if (strcmp(valor, "nome") == 0) q->ordem = ORDEM_NOME;
+            else { printf("Ordem inválida em: %s\n", termo); return 0; }
+        } else if (strcmp(campo, "limite") == 0 && cmp == 0) {
+            long v = strtol(valor, &end, 10);
+            if (end == valor || *end != '\0' || v < 0 || v > INT32_MAX) { printf("Limite inválido em: %s\n", termo); return 0; }
+            q->limite = (int)v;
+        } else {
+            printf("Termo inválido: %s\n", termo);
+            return 0;
+        }
+    }
+}
+
+// zona_descartavel / zona_contida:
+// - Descartável: nenhuma carta do bloco pode satisfazer a consulta.
+// - Contida: todas as cartas do bloco satisfazem os filtros numéricos e de estado
+//   (dispensa a avaliação carta a carta; o prefixo ainda é conferido).
+
+static int zona_descartavel(const ZonaBloco *z, const Consulta *q) {
+    return z->pop_max < q->pop_min || z->pop_min > q->pop_max
+        || z->area_max < q->area_min || z->area_min > q->area_max
+        || z->pib_max < q->pib_min || z->pib_min > q->pib_max
+        || (q->estados && !(z->estados & q->estados));
+}
+
+static int zona_contida(const ZonaBloco *z, const Consulta *q) {
+    return z->pop_min >= q->pop_min && z->pop_max <= q->pop_max
+        && z->area_min >= q->area_min && z->area_max <= q->area_max
+        && z->pib_min >= q->pib_min && z->pib_max <= q->pib_max
+        && (!q->estados || !(z->estados & ~q->estados));
+}
+
+// shard_atende_consulta: filtro de shards para carregar_baralho_catalogo.
+int shard_atende_consulta(const EntradaCatalogo *e, void *ctx) {
+    return !e->tem_zona || !zona_descartavel(&e->zona, (const Consulta *)ctx);
+}
+
+void liberar_indice_consulta(IndiceConsulta *idx) {
+    free(idx->populacao); free(idx->area); free(idx->pib);
+    free(idx->estado_bit); free(idx->zonas);
+    memset(idx, 0, sizeof(*idx));
+}
+
+// atualizar_indice_consulta:
+// - (Re)constrói as colunas e os mapas de zona se o baralho mudou.
+// - Retorna 0 se faltar memória.
+
+int atualizar_indice_consulta(IndiceConsulta *idx, const Baralho *b) {
+    if (idx->populacao && idx->cartas == b->cartas && idx->n == b->n && idx->versao == b->versao) return 1;
+    liberar_indice_consulta(idx);
+    size_t n = (size_t)(b->n > 0 ? b->n : 1);
+    int n_blocos = (b->n + BLOCO_CONSULTA - 1) / BLOCO_CONSULTA;
+    idx->populacao = malloc(n * sizeof(int32_t));
+    idx->area = malloc(n * sizeof(float));
+    idx->pib = malloc(n * sizeof(float));
+    idx->estado_bit = malloc(n * sizeof(uint32_t));
+    idx->zonas = malloc((size_t)(n_blocos > 0 ? n_blocos : 1) * sizeof(ZonaBloco));
+    if (!idx->populacao || !idx->area || !idx->pib || !idx->estado_bit || !idx->zonas) {
+        liberar_indice_consulta(idx);
+        return 0;
+    }
+    for (int i = 0; i < b->n; ++i) {
+        const Carta *c = &b->cartas[i];
+        idx->populacao[i] = c->populacao;
+        idx->area[i] = c->area;
+        idx->pib[i] = c->pib;
+        idx->estado_bit[i] = (c->estado >= 'A' && c->estado <= 'Z') ? 1u << (c->estado - 'A') : 0u;
+    }
+    for (int k = 0; k < n_blocos; ++k) {
+        int ini = k * BLOCO_CONSULTA;
+        int fim = ini + BLOCO_CONSULTA < b->n ? ini + BLOCO_CONSULTA : b->n;
+        calcular_zona(b->cartas + ini, fim - ini, &idx->zonas[k]);
+    }
+    idx->cartas = b->cartas;
+    idx->n = b->n;
+    idx->versao = b->versao;
+    idx->n_blocos = n_blocos;
+    return 1;
+}
+
+// comparar_cartas_ordem: compara duas cartas pelo critério da consulta.
+static int comparar_cartas_ordem(Carta *a, Carta *b, const Consulta *q) {
+    int r = 0;
+    switch (q->ordem) {
+    case ORDEM_POPULACAO: r = (a->populacao > b->populacao) - (a->populacao < b->populacao); break;
+    case ORDEM_AREA: r = (a->area > b->area) - (a->area < b->area); break;
+    case ORDEM_PIB: r = (a->pib > b->pib) - (a->pib < b->pib); break;
+    case ORDEM_PONTOS: r = (a->num_pontos_turisticos > b->num_pontos_turisticos) - (a->num_pontos_turisticos < b->num_pontos_turisticos); break;
+    case ORDEM_SUPER_PODER: {
+        carta_super_poder(a);
+        carta_super_poder(b);
+        r = comparar_super_poder(a, b);
+        break;
+    }
+    case ORDEM_NOME: r = strcmp(a->nome_cidade, b->nome_cidade); break;
+    default: break;
+    }
+    if (q->decrescente) r = -r;
+    return r != 0 ? r : (a < b ? -1 : a > b); // desempate estável pela posição
+}
+
+// Heap de "piores" resultados: mantém só os 'limite' melhores sem ordenar tudo.
+static void heap_descer(int *h, int n, int i, Carta *cartas, const Consulta *q) {
+    for (;;) {
+        int maior = i, e = 2 * i + 1, d = e + 1;
+        if (e < n && comparar_cartas_ordem(&cartas[h[e]], &cartas[h[maior]], q) > 0) maior = e;
+        if (d < n && comparar_cartas_ordem(&cartas[h[d]], &cartas[h[maior]], q) > 0) maior = d;
+        if (maior == i) return;
+        int tmp = h[i]; h[i] = h[maior]; h[maior] = tmp;
+        i = maior;
+    }
+}
+
+// executar_consulta:
+// - Avalia os filtros coluna a coluna, bloco a bloco: blocos descartados pelo
+//   mapa de zona não são lidos; nos demais, cada filtro é um laço simples sobre
+//   a coluna (vetorizável) que zera a máscara de seleção.
+// - Com ordem e limite, mantém apenas os 'limite' melhores em um heap.
+// - Retorna a quantidade de resultados; os índices (no baralho) ficam em
+//   *resultado (liberar com free). *blocos_lidos informa quantos blocos não
+//   foram descartados. Retorna -1 se faltar memória.
+
+int executar_consulta(IndiceConsulta *idx, Carta *cartas, const Consulta *q, int **resultado, int *blocos_lidos) {
+    int cap = q->limite > 0 && q->limite < idx->n ? q->limite : idx->n;
+    int *res = malloc((size_t)(cap > 0 ? cap : 1) * sizeof(int));
+    if (!res) return -1;
+    int n_res = 0;
+    size_t len_prefixo = strlen(q->prefixo);
+    int com_heap = q->ordem != ORDEM_NENHUMA && q->limite > 0;
+    unsigned char sel[BLOCO_CONSULTA];
+    *blocos_lidos = 0;
+
+    for (int k = 0; k < idx->n_blocos; ++k) {
+        const ZonaBloco *z = &idx->zonas[k];
+        if (zona_descartavel(z, q)) continue;
+        (*blocos_lidos)++;
+        int ini = k * BLOCO_CONSULTA;
+        int m = idx->n - ini < BLOCO_CONSULTA ? idx->n - ini : BLOCO_CONSULTA;
+
+        if (zona_contida(z, q)) {
+            memset(sel, 1, (size_t)m);
+        } else {
+            const int32_t *pop = idx->populacao + ini;
+            const float *area = idx->area + ini;
+            const float *pib = idx->pib + ini;
+            const uint32_t *est = idx->estado_bit + ini;
+            for (int i = 0; i < m; ++i) sel[i] = (unsigned char)((pop[i] >= q->pop_min) & (pop[i] <= q->pop_max));
+            for (int i = 0; i < m; ++i) sel[i] &= (unsigned char)((area[i] >= q->area_min) & (area[i] <= q->area_max));
+            for (int i = 0; i < m; ++i) sel[i] &= (unsigned char)((pib[i] >= q->pib_min) & (pib[i] <= q->pib_max));
+            if (q->estados)
+                for (int i = 0; i < m; ++i) sel[i] &= (unsigned char)((est[i] & q->estados) != 0);
+        }
+
+        for (int i = 0; i < m; ++i) {
+            if (!sel[i]) continue;
+            int c = ini + i;
+            if (len_prefixo && strncmp(cartas[c].nome_cidade, q->prefixo, len_prefixo) != 0) continue;
+            if (com_heap) {
+                if (n_res < cap) {
+                    // insere e sobe no heap
+                    int j = n_res++;
+                    res[j] = c;
+                    while (j > 0 && comparar_cartas_ordem(&cartas[res[(j - 1) / 2]], &cartas[res[j]], q) < 0) {
+                        int pai = (j - 1) / 2, tmp = res[pai];
+                        res[pai] = res[j]; res[j] = tmp;
+                        j = pai;
+                    }
+                } else if (comparar_cartas_ordem(&cartas[c], &cartas[res[0]], q) < 0) {
+                    res[0] = c;
+                    heap_descer(res, n_res, 0, cartas, q);
+                }
+            } else {
+                res[n_res++] = c;
+                if (q->ordem == ORDEM_NENHUMA && n_res == cap) goto fim; // limite atingido
+            }
+        }
+    }
+
+fim:
+    if (q->ordem != ORDEM_NENHUMA) {
+        // Ordenação final por heap sort in-place (sem heap ainda, monta-o antes)
+        if (!com_heap) {
+            for (int i = n_res / 2 - 1; i >= 0; --i) heap_descer(res, n_res, i, cartas, q);
+        }
+        for (int fim_h = n_res - 1; fim_h > 0; --fim_h) {
+            int tmp = res[0]; res[0] = res[fim_h]; res[fim_h] = tmp;
+            heap_descer(res, fim_h, 0, cartas, q);
+        }
+    }
+    *resultado = res;
+    return n_res;
+}
+
+// exibir_resultado_consulta: lista os resultados e o tempo gasto.
+
+void exibir_resultado_consulta(Carta *cartas, const int *res, int n_res, int blocos_lidos, int n_blocos, double ms) {
+    for (int i = 0; i < n_res; ++i) {
+        Carta *c = &cartas[res[i]];
+        printf("%d - %s (%s) | Estado: %c | População: %d | Área: %.2f km² | PIB: %.2f | Super poder: %.2f\n",
+               res[i] + 1, c->nome_cidade, c->codigo, c->estado, c->populacao, c->area, c->pib, carta_super_poder(c));
+    }
+    printf("%d resultado(s) | blocos lidos: %d de %d | %.3f ms\n", n_res, blocos_lidos, n_blocos, ms);
+}
+
+// consultar_baralho:
+// - Roda a consulta sobre o baralho atual (reaproveitando o índice colunar).
+
+void consultar_baralho(Baralho *b, IndiceConsulta *idx, const char *texto) {
+    Consulta q;
+    if (!interpretar_consulta(texto, &q)) return;
+    if (!atualizar_indice_consulta(idx, b)) { printf("Memória insuficiente para a consulta.\n"); return; }
+    int *res, blocos;
+    clock_t inicio = clock();
+    int n_res = executar_consulta(idx, b->cartas, &q, &res, &blocos);
+    double ms = (double)(clock() - inicio) * 1000.0 / CLOCKS_PER_SEC;
+    if (n_res < 0) { printf("Memória insuficiente para a consulta.\n"); return; }
+    exibir_resultado_consulta(b->cartas, res, n_res, blocos, idx->n_blocos, ms);
+    free(res);
+}
+
+// consultar_catalogo:
+// - Lê apenas os shards do baralho cujo mapa de zona pode atender a consulta
+//   e roda a consulta sobre eles. Retorna 0 em sucesso.
+
+int consultar_catalogo(const char *nome, const char *texto) {
+    Consulta q;
+    if (!interpretar_consulta(texto, &q)) return 1;
+    Catalogo cat;
+    carregar_catalogo(&cat);
+    int total_shards = 0;
+    for (int i = 0; i < cat.n; ++i) if (strcmp(cat.shards[i].baralho, nome) == 0) total_shards++;
+    if (total_shards == 0) { printf("Baralho '%s' não encontrado no catálogo.\n", nome); liberar_catalogo(&cat); return 1; }
+
+    Baralho b;
+    int lidos = carregar_baralho_catalogo(&cat, nome, &b, shard_atende_consulta, &q);
+    liberar_catalogo(&cat);
+    if (lidos < 0) { printf("Erro ao ler os shards do baralho '%s'.\n", nome); return 1; }
+    printf("Shards lidos: %d de %d\n", lidos, total_shards);
+    IndiceConsulta idx;
+    memset(&idx, 0, sizeof(idx));
+    consultar_baralho(&b, &idx, texto);
+    liberar_indice_consulta(&idx);
+    baralho_liberar(&b);
+    return 0;
+}
+
+// Replay de partidas:
+// impressao_baralho:
+// - Hash FNV-1a (ver fnv1a) dos campos originais de cada carta, na ordem do baralho.
+//   Campos derivados ficam de fora pois são recalculados ao carregar; uma
+//   fórmula de pontuação diferente da padrão entra no hash.
+
+static uint32_t impressao_carta(uint32_t h, const Carta *c) {
+    h = fnv1a(h, &c->estado, 1);
+    h = fnv1a(h, c->codigo, comprimento_limitado(c->codigo, sizeof(c->codigo)));
+    h = fnv1a(h, c->nome_cidade, comprimento_limitado(c->nome_cidade, sizeof(c->nome_cidade)));
+    h = fnv1a(h, &c->populacao, sizeof(c->populacao));
+    h = fnv1a(h, &c->area, sizeof(c->area));
+    h = fnv1a(h, &c->pib, sizeof(c->pib));
+    return fnv1a(h, &c->num_pontos_turisticos, sizeof(c->num_pontos_turisticos));
+}
+
+uint32_t impressao_baralho(const Carta *cartas, int n) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < n; ++i) h = impressao_carta(h, &cartas[i]);
+    // Outra fórmula muda os resultados: replays dela não valem para a padrão
+    const Formula *f = formula_atual();
+    if (!f->padrao) {
+        h = fnv1a(h, f->op, (size_t)f->n_ops);
+        h = fnv1a(h, f->arg, (size_t)f->n_ops);
+        h = fnv1a(h, f->constantes, (size_t)f->n_constantes * sizeof(float));
+        h = fnv1a(h, f->termo_campo, (size_t)f->n_termos);
+        h = fnv1a(h, f->termo_peso, (size_t)f->n_termos * sizeof(float));
+    }
+    if (f->fixa) h = fnv1a(h, "fixa", 4); // empates e desempates podem mudar
+    // Outras regras de distribuição dão outras mãos para a mesma semente
+    if (regras_distribuicao.equilibrada) {
+        h = fnv1a(h, "equilibrada", 11);
+        h = fnv1a(h, &regras_distribuicao.tolerancia, sizeof(float));
+        h = fnv1a(h, &regras_distribuicao.max_por_estado, sizeof(int));
+    }
+    return h;
+}
+
+// impressao_bloco:
+// - Impressão dos instantâneos publicados: polinômio em IMPRESSAO_BASE dos
+//   hashes FNV-1a de cada carta (mod 2^64), com *potencia = IMPRESSAO_BASE^n.
+// - Blocos se compõem na ordem com h = h * potencia + impressao, então uma
+//   publicação só recalcula os blocos novos. Não é a impressão dos replays.
+
+static uint64_t impressao_bloco(const Carta *cartas, int n, uint64_t *potencia) {
+    uint64_t h = 0, p = 1;
+    for (int i = 0; i < n; ++i) {
+        h = h * IMPRESSAO_BASE + impressao_carta(2166136261u, &cartas[i]);
+        p *= IMPRESSAO_BASE;
+    }
+    *potencia = p;
+    return h;
+}
+
+// iniciar_replay / registrar_acao_replay:
+// - Preparam o registro da partida e anotam cada escolha ou comando do turno.
+
+void iniciar_replay(Replay *r, const Carta *baralho, int n_cartas, uint32_t semente, int modo_computador) {
+    memset(r, 0, sizeof(*r));
+    memset(r->acoes, ACAO_NENHUMA, sizeof(r->acoes));
+    r->semente = semente;
+    r->impressao_baralho = impressao_baralho(baralho, n_cartas);
+    r->n_cartas = n_cartas;
+    r->modo_computador = (unsigned char)(modo_computador ? 1 : 0);
+}
+
+void registrar_acao_replay(Replay *r, int turno, int jogador, int escolha, int cmd) {
+    if (turno < 0 || turno >= CARTAS_POR_JOGADOR || jogador < 0 || jogador >= MAX_JOGADORES) return;
+    if (escolha < 0) escolha = 0;
+    r->acoes[turno][jogador] = (unsigned char)((cmd << 4) | (escolha & 0x0F));
+    if (r->n_turnos < turno + 1) r->n_turnos = (unsigned char)(turno + 1);
+}
+
+// gravar_replays / gravar_replay:
+// - Acrescentam n registros (ou um) ao final do arquivo de replays (modo binário).
+// - gravar_replays não imprime nada (roda na thread do servidor); retorna 1 em sucesso.
+
+int gravar_replays(const Replay *r, int n) {
+    FILE *f = fopen(ARQUIVO_REPLAYS, "ab");
+    if (!f) return 0;
+    size_t escritos = fwrite(r, sizeof(Replay), (size_t)n, f);
+    return fclose(f) == 0 && escritos == (size_t)n;
+}
+
+void gravar_replay(const Replay *r) {
+    if (!gravar_replays(r, 1)) printf("Aviso: não foi possível gravar o replay da partida.\n");
+}
+
+// carregar_replays:
+// - Lê todos os registros do arquivo. Retorna a quantidade lida e o vetor
+//   alocado em *saida (liberar com free), ou 0 se falha ou não existir.
+
+int carregar_replays(const char *arquivo, Replay **saida) {
+    *saida = NULL;
+    FILE *f = fopen(arquivo, "rb");
+    if (!f) return 0;
+    int n = 0, cap = 0;
+    Replay *v = NULL;
+    Replay r;
+    while (fread(&r, sizeof(Replay), 1, f) == 1) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            Replay *novo = realloc(v, (size_t)cap * sizeof(Replay));
+            if (!novo) break;
+            v = novo;
+        }
+        v[n++] = r;
+    }
+    fclose(f);
+    *saida = v;
+    return n;
+}
+
+// Distribuição equilibrada:
+// carregar_regras_distribuicao:
+// - Lê distribuicao.txt: "distribuicao = equilibrada|embaralhada",
+//   "tolerancia = <fração>" e "max_por_estado = <n>" (# inicia comentário).
+// - Sem o arquivo a distribuição continua uniforme. Avisos vão para stderr.
+
+void carregar_regras_distribuicao(const char *arquivo) {
+    FILE *f = fopen(arquivo, "r");
+    if (!f) return;
+    RegrasDistribuicao r = regras_distribuicao;
+    char linha[256];
+    while (fgets(linha, sizeof(linha), f)) {
+        linha[strcspn(linha, "\r\n")] = '\0';
+        char *p = linha;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '#' || *p == '\0') continue;
+        char chave[32] = "", valor[32] = "";
+        if (sscanf(p, "%31[a-z_] = %31s", chave, valor) != 2) {
+            fprintf(stderr, "%s: linha ignorada (esperado chave = valor): %s\n", arquivo, p);
+            continue;
+        }
+        if (strcmp(chave, "distribuicao") == 0 && (strcmp(valor, "equilibrada") == 0 || strcmp(valor, "embaralhada") == 0))
+            r.equilibrada = strcmp(valor, "equilibrada") == 0;
+        else if (strcmp(chave, "tolerancia") == 0 && atof(valor) >= 0.0)
+            r.tolerancia = (float)atof(valor);
+        else if (strcmp(chave, "max_por_estado") == 0 && atoi(valor) >= 0)
+            r.max_por_estado = atoi(valor);
+        else
+            fprintf(stderr, "%s: valor inválido para %s: %s\n", arquivo, chave, valor);
+    }
+    fclose(f);
+    regras_distribuicao = r;
+}
+
+static int estado_indice(const Carta *c) {
+    int e = toupper((unsigned char)c->estado) - 'A';
+    return e >= 0 && e < 26 ? e : -1;
+}
+
+void liberar_distribuicao(Distribuicao *d) {
+    free(d->posicoes);
+    free(d->elegiveis);
+    memset(d, 0, sizeof(*d));
+}
+
+static int comparar_posicao_distribuicao(const void *a, const void *b) {
+    const PosicaoDistribuicao *x = a, *y = b;
+    if (x->forca != y->forca) return x->forca < y->forca ? -1 : 1;
+    return (x->carta > y->carta) - (x->carta < y->carta); // desempate fixo: mesma ordem em qualquer qsort
+}
+
+// preparar_distribuicao:
+// - Ordena o baralho por força, divide em CARTAS_POR_JOGADOR faixas e, para
+//   cada carta, guarda a janela de parceiros da mesma faixa cuja força difere
+//   no máximo folga = tolerancia * soma média de uma mão.
+// - Cartas sem parceiro na janela ficam fora do sorteio. Se uma faixa inteira
+//   ficar sem pares, ela usa os vizinhos imediatos (sem garantia da folga).
+// - Usa cartas_forca: os derivados já devem estar calculados.
+// - Retorna 1 em sucesso (0 se faltar memória ou cartas).
+
+int preparar_distribuicao(Distribuicao *d, const Carta *cartas, int n, const RegrasDistribuicao *regras) {
+    memset(d, 0, sizeof(*d));
+    if (n < CARTAS_POR_JOGADOR * MAX_JOGADORES) return 0;
+    d->posicoes = malloc((size_t)n * sizeof(PosicaoDistribuicao));
+    d->elegiveis = malloc((size_t)n * sizeof(PosicaoDistribuicao));
+    if (!d->posicoes || !d->elegiveis) {
+        liberar_distribuicao(d);
+        return 0;
+    }
+    d->n = n;
+    d->max_por_estado = regras->max_por_estado;
+
+    PosicaoDistribuicao *pos = d->posicoes;
+    int64_t soma = 0, forca[FORMULA_LOTE];
+    for (int i = 0; i < n; ++i) {
+        int e = estado_indice(&cartas[i]);
+        if (i % FORMULA_LOTE == 0) cartas_forca(cartas + i, n - i < FORMULA_LOTE ? n - i : FORMULA_LOTE, forca);
+        pos[i].forca = forca[i % FORMULA_LOTE];
+        pos[i].carta = i;
+        pos[i].estado = (unsigned char)(e >= 0 ? e : DISTRIBUICAO_ESTADOS - 1);
+        soma = fixo_soma(soma, pos[i].forca < 0 ? -pos[i].forca : pos[i].forca);
+    }
+    qsort(pos, (size_t)n, sizeof(*pos), comparar_posicao_distribuicao);
+    d->folga = fixo_mul(fixo_de_float(regras->tolerancia), fixo_muldiv(soma / n, CARTAS_POR_JOGADOR, 1));
+
+    int total = 0;
+    for (int f = 0; f < CARTAS_POR_JOGADOR; ++f) {
+        int ini = (int)((int64_t)f * n / CARTAS_POR_JOGADOR), fim = (int)((int64_t)(f + 1) * n / CARTAS_POR_JOGADOR);
+        int com_par = 0;
+        for (int s = ini; s < fim; ++s) {
+            int lo = s, hi = s;
+            while (lo > ini && lo > s - DISTRIBUICAO_JANELA && fixo_soma(pos[s].forca, -pos[lo - 1].forca) <= d->folga) lo--;
+            while (hi < fim - 1 && hi < s + DISTRIBUICAO_JANELA && fixo_soma(pos[hi + 1].forca, -pos[s].forca) <= d->folga) hi++;
+            pos[s].posicao = s;
+            pos[s].antes = (unsigned char)(s - lo);
+            pos[s].depois = (unsigned char)(hi - s);
+            com_par += hi > lo;
+        }
+        if (com_par == 0) { // nenhum par cabe na folga: vizinhos imediatos
+            d->faixas_sem_garantia++;
+            for (int s = ini; s < fim; ++s) {
+                pos[s].antes = s > ini;
+                pos[s].depois = s < fim - 1;
+            }
+        }
+        // Baldes por estado (contagem e depois cópias, em ordem de estado)
+        int *balde = d->balde[f];
+        memset(balde, 0, sizeof(d->balde[f]));
+        for (int s = ini; s < fim; ++s)
+            if (pos[s].antes + pos[s].depois > 0) balde[pos[s].estado + 1]++;
+        balde[0] = total;
+        for (int e = 0; e < DISTRIBUICAO_ESTADOS; ++e) balde[e + 1] += balde[e];
+        int proximo[DISTRIBUICAO_ESTADOS];
+        memcpy(proximo, balde, sizeof(proximo));
+        for (int s = ini; s < fim; ++s)
+            if (pos[s].antes + pos[s].depois > 0) d->elegiveis[proximo[pos[s].estado]++] = pos[s];
+        total = balde[DISTRIBUICAO_ESTADOS];
+    }
+    d->excluidas = n - total;
+    return 1;
+}
+
+// distribuir_equilibrado:
+// - Em cada faixa sorteia uma carta elegível e um parceiro da sua janela; a
+//   mais forte vai para quem está atrás na soma. Assim a diferença final entre
+//   as mãos nunca passa da maior diferença de um par, que é <= folga.
+// - Estados que já atingiram max_por_estado em alguma mão saem do sorteio
+//   (o sorteio pula os baldes bloqueados; não há nova tentativa).
+// - O(CARTAS_POR_JOGADOR) por partida, sem percorrer o baralho. A ordem das
+//   cartas em cada mão é embaralhada no fim.
+// - Retorna 1 se todas as regras foram cumpridas; 0 se algum estado teve de
+//   passar do limite (faixa sem outra opção).
+
+int distribuir_equilibrado(const Distribuicao *d, uint32_t *rng, int mao[MAX_JOGADORES][CARTAS_POR_JOGADOR]) {
+    unsigned char contagem[MAX_JOGADORES][DISTRIBUICAO_ESTADOS];
+    int bloqueados[MAX_JOGADORES * CARTAS_POR_JOGADOR]; // em ordem crescente
+    uint32_t mascara = 0;
+    int n_bloqueados = 0, ok = 1;
+    int64_t soma[MAX_JOGADORES] = {0, 0};
+    memset(contagem, 0, sizeof(contagem));
+
+    for (int f = 0; f < CARTAS_POR_JOGADOR; ++f) {
+        const int *balde = d->balde[f];
+        int livres = balde[DISTRIBUICAO_ESTADOS] - balde[0];
+        for (int k = 0; k < n_bloqueados; ++k) livres -= balde[bloqueados[k] + 1] - balde[bloqueados[k]];
+        int r;
+        if (livres > 0) {
+            r = balde[0] + (int)(rng_proximo(rng) % (uint32_t)livres);
+            for (int k = 0; k < n_bloqueados; ++k)
+                if (r >= balde[bloqueados[k]]) r += balde[bloqueados[k] + 1] - balde[bloqueados[k]];
+        } else {
+            ok = 0;
+            r = balde[0] + (int)(rng_proximo(rng) % (uint32_t)(balde[DISTRIBUICAO_ESTADOS] - balde[0]));
+        }
+        const PosicaoDistribuicao *a = &d->elegiveis[r];
+
+        // Parceiro: sorteio direto na janela; só percorre a janela se cair num estado
+        // bloqueado. Sem parceiro livre, serve um que caiba na mão de quem o recebe.
+        int atras = soma[0] < soma[1] ? 0 : soma[1] < soma[0] ? 1 : (int)(rng_proximo(rng) & 1u);
+        int ini = a->posicao - a->antes, fim = a->posicao + a->depois;
+        int sb = ini + (int)(rng_proximo(rng) % (uint32_t)(a->antes + a->depois));
+        if (sb >= a->posicao) sb++;
+        const PosicaoDistribuicao *b = &d->posicoes[sb];
+        if (mascara & (1u << b->estado)) {
+            int candidatos[2 * DISTRIBUICAO_JANELA], n_candidatos = 0;
+            for (int s = ini; s <= fim; ++s)
+                if (s != a->posicao && !(mascara & (1u << d->posicoes[s].estado))) candidatos[n_candidatos++] = s;
+            for (int s = ini; n_candidatos == 0 && s <= fim; ++s) {
+                const PosicaoDistribuicao *c = &d->posicoes[s];
+                int j = c->forca > a->forca ? atras : (atras + 1) % MAX_JOGADORES;
+                if (s != a->posicao && contagem[j][c->estado] < d->max_por_estado) candidatos[n_candidatos++] = s;
+            }
+            if (n_candidatos > 0) b = &d->posicoes[candidatos[rng_proximo(rng) % (uint32_t)n_candidatos]];
+            else ok = 0;
+        }
+
+        const PosicaoDistribuicao *forte = a->forca >= b->forca ? a : b, *fraca = forte == a ? b : a;
+        const PosicaoDistribuicao *carta_jogador[MAX_JOGADORES] = {forte, fraca};
+        for (int k = 0; k < MAX_JOGADORES; ++k) {
+            const PosicaoDistribuicao *c = carta_jogador[k];
+            int j = (atras + k) % MAX_JOGADORES, e = c->estado;
+            mao[j][f] = c->carta;
+            soma[j] = fixo_soma(soma[j], c->forca);
+            if (d->max_por_estado > 0 && ++contagem[j][e] >= d->max_por_estado && !(mascara & (1u << e))) {
+                mascara |= 1u << e;
+                int i = n_bloqueados++;
+                while (i > 0 && bloqueados[i - 1] > e) { bloqueados[i] = bloqueados[i - 1]; i--; }
+                bloqueados[i] = e;
+            }
+        }
+    }
+    // As faixas não podem ficar visíveis pela posição na mão
+    for (int j = 0; j < MAX_JOGADORES; ++j)
+        for (int i = CARTAS_POR_JOGADOR - 1; i > 0; --i) {
+            int k = (int)(rng_proximo(rng) % (uint32_t)(i + 1));
+            int tmp = mao[j][i]; mao[j][i] = mao[j][k]; mao[j][k] = tmp;
+        }
+    return ok;
+}
+
+// montar_mesa:
+// - Cópia das cartas na ordem de entrega de distribuir_cartas. Com a
+//   distribuição uniforme é o baralho inteiro embaralhado; com a equilibrada,
+//   só as cartas das mãos (mesmas mãos de partida_indices_iniciar), sorteadas
+//   com d já preparada para este baralho (ver distribuicao_da_versao).
+// - Retorna NULL se faltar memória (inclusive d == NULL na equilibrada).
+
+Carta *montar_mesa(const Carta *baralho, int n_cartas, const Distribuicao *d, uint32_t *rng) {
+    if (!regras_distribuicao.equilibrada) {
+        Carta *mesa = malloc((size_t)n_cartas * sizeof(Carta));
+        if (!mesa) return NULL;
+        memcpy(mesa, baralho, (size_t)n_cartas * sizeof(Carta));
+        embaralhar_cartas(mesa, n_cartas, rng);
+        return mesa;
+    }
+    if (!d) return NULL;
+    Carta *mesa = malloc((size_t)CARTAS_POR_JOGADOR * MAX_JOGADORES * sizeof(Carta));
+    if (!mesa) return NULL;
+    int mao[MAX_JOGADORES][CARTAS_POR_JOGADOR];
+    distribuir_equilibrado(d, rng, mao);
+    for (int c = 0; c < CARTAS_POR_JOGADOR; ++c)
+        for (int j = 0; j < MAX_JOGADORES; ++j) mesa[c * MAX_JOGADORES + j] = baralho[mao[j][c]];
+    return mesa;
+}
+
+// distribuicao_da_versao:
+// - Devolve a distribuição equilibrada do baralho lido, preparando-a só quando
+//   a versão publicada muda: partidas seguidas no mesmo instantâneo sorteiam
+//   em O(mão) em vez de reordenar o baralho (O(n log n)) a cada partida.
+// - Retorna NULL com embaralhamento uniforme ou se faltar memória.
+
+const Distribuicao *distribuicao_da_versao(CacheDistribuicao *cache, const Baralho *leitura) {
+    if (!regras_distribuicao.equilibrada) return NULL;
+    if (cache->pronta && cache->versao == leitura->versao && cache->n == leitura->n) return &cache->d;
+    if (cache->pronta) liberar_distribuicao(&cache->d);
+    cache->pronta = 0;
+    garantir_derivados(leitura->cartas, leitura->n);
+    if (!preparar_distribuicao(&cache->d, leitura->cartas, leitura->n, &regras_distribuicao)) return NULL;
+    cache->pronta = 1;
+    cache->versao = leitura->versao;
+    cache->n = leitura->n;
+    return &cache->d;
+}
+
+// Partida sobre índices (sem interface):
+// partida_indices_iniciar:
+// - Mesmo embaralhamento de embaralhar_cartas (mesma sequência de trocas, mas
+//   sobre índices) e mesma distribuição round-robin de distribuir_cartas.
+// - ordem: vetor auxiliar com n_cartas posições (evita alocar por partida).
+// - Com d (distribuição equilibrada ativa), as mãos saem de distribuir_equilibrado,
+//   como em montar_mesa.
+
+void partida_indices_iniciar(PartidaIndices *p, int n_cartas, uint32_t semente, int *ordem, const Distribuicao *d) {
+    memset(p, 0, sizeof(*p));
+    p->rng = semente;
+    if (d) {
+        distribuir_equilibrado(d, &p->rng, p->mao);
+        for (int j = 0; j < MAX_JOGADORES; ++j) p->restantes[j] = CARTAS_POR_JOGADOR;
+        return;
+    }
+    for (int i = 0; i < n_cartas; ++i) ordem[i] = i;
+    for (int i = n_cartas - 1; i > 0; --i) {
+        int j = (int)(rng_proximo(&p->rng) % (uint32_t)(i + 1));
+        int tmp = ordem[i]; ordem[i] = ordem[j]; ordem[j] = tmp;
+    }
+    int idx = 0;
+    for (int c = 0; c < CARTAS_POR_JOGADOR; ++c)
+        for (int j = 0; j < MAX_JOGADORES; ++j) p->mao[j][p->restantes[j]++] = ordem[idx++];
+}
+
+// partida_indices_jogar:
+// - Aplica um turno. desistente = -1 (ninguém) ou o jogador que desistiu;
+//   nesse caso, como na partida ao vivo, o adversário vence e ambos
+//   descartam a primeira carta da mão. Escolhas devem ser válidas.
+// - Retorna o jogador que venceu o turno ou -1 em empate.
+
+int partida_indices_jogar(PartidaIndices *p, const Carta *baralho, const int escolha[MAX_JOGADORES], int desistente) {
+    int vencedor = -1;
+    if (desistente >= 0) {
+        vencedor = 1 - desistente;
+        for (int j = 0; j < MAX_JOGADORES; ++j) {
+            if (p->restantes[j] > 0) {
+                memmove(&p->mao[j][0], &p->mao[j][1], (size_t)(p->restantes[j] - 1) * sizeof(int));
+                p->restantes[j]--;
+            }
+        }
+    } else {
+        int r = comparar_super_poder(&baralho[p->mao[0][escolha[0]]], &baralho[p->mao[1][escolha[1]]]);
+        if (r > 0) vencedor = 0;
+        else if (r < 0) vencedor = 1;
+        for (int j = 0; j < MAX_JOGADORES; ++j) {
+            memmove(&p->mao[j][escolha[j]], &p->mao[j][escolha[j] + 1],
+                    (size_t)(p->restantes[j] - escolha[j] - 1) * sizeof(int));
+            p->restantes[j]--;
+        }
+    }
+    if (vencedor >= 0) p->vitorias[vencedor]++;
+    else p->empates++;
+    return vencedor;
+}
+
+// partida_indices_resultado: RESULTADO_* pelo número de turnos vencidos.
+int partida_indices_resultado(const PartidaIndices *p) {
+    if (p->vitorias[0] > p->vitorias[1]) return RESULTADO_JOGADOR1;
+    if (p->vitorias[1] > p->vitorias[0]) return RESULTADO_JOGADOR2;
+    return RESULTADO_EMPATE;
+}
+
+// simular_replay:
+// - Reexecuta a partida gravada sobre índices, com as ações do replay.
+//   Escolhas do computador saem do gerador, na mesma ordem da partida ao vivo.
+// - Retorna o RESULTADO_* obtido e soma os turnos reexecutados em *turnos.
+
+int simular_replay(const Carta *baralho, int n_cartas, const Replay *r, int *ordem, const Distribuicao *d, long *turnos) {
+    PartidaIndices p;
+    partida_indices_iniciar(&p, n_cartas, r->semente, ordem, d);
+
+    for (int turno = 0; turno < r->n_turnos; ++turno) {
+        (*turnos)++;
+        int escolha[MAX_JOGADORES] = {0, 0};
+        int desistente = -1;
+        for (int j = 0; j < MAX_JOGADORES; ++j) {
+            if (j == 1 && r->modo_computador) {
+                if (p.restantes[1] <= 0) return RESULTADO_ABORTADA;
+                escolha[1] = (int)(rng_proximo(&p.rng) % (uint32_t)p.restantes[1]);
+                break;
+            }
+            unsigned char a = r->acoes[turno][j];
+            if (a == ACAO_NENHUMA) return RESULTADO_ABORTADA;
+            int cmd = a >> 4;
+            if (cmd == CMD_SAIR) return RESULTADO_ABORTADA;
+            if (cmd == CMD_DESISTIR) { desistente = j; break; }
+            escolha[j] = a & 0x0F;
+            if (escolha[j] >= p.restantes[j]) return RESULTADO_ABORTADA;
+        }
+        partida_indices_jogar(&p, baralho, escolha, desistente);
+    }
+
+    if (r->resultado == RESULTADO_ABORTADA) return RESULTADO_ABORTADA;
+    return partida_indices_resultado(&p);
+}
+
+// verificar_replays:
+// - Modo sem interface (--replay): confere cada registro contra o baralho salvo
+//   e mede a vazão da reexecução. Retorna 0 se todos conferem, 1 caso contrário.
+
+int verificar_replays(const char *arquivo, int repeticoes) {
+    Baralho baralho = {0};
+    carregar_cartas(&baralho);
+    Carta *cartas = baralho.cartas;
+    int n_cartas = baralho.n;
+    garantir_derivados(cartas, n_cartas);
+
+    Replay *replays;
+    int n = carregar_replays(arquivo, &replays);
+    int *ordem = malloc((size_t)(n_cartas > 0 ? n_cartas : 1) * sizeof(int));
+    if (n == 0 || !ordem) {
+        printf("Nenhum replay encontrado em %s.\n", arquivo);
+        free(replays);
+        free(ordem);
+        baralho_liberar(&baralho);
+        return 1;
+    }
+    // Distribuição equilibrada: índices preparados uma vez para todos os replays.
+    // Sem eles cada replay seria redistribuído de modo uniforme e "divergiria".
+    // (Com menos cartas que uma partida nenhum replay é deste baralho.)
+    Distribuicao distribuicao, *dist = NULL;
+    if (regras_distribuicao.equilibrada && n_cartas >= CARTAS_POR_JOGADOR * MAX_JOGADORES) {
+        if (!preparar_distribuicao(&distribuicao, cartas, n_cartas, &regras_distribuicao)) {
+            printf("Memória insuficiente para preparar a distribuição equilibrada.\n");
+            free(replays);
+            free(ordem);
+            baralho_liberar(&baralho);
+            return 1;
+        }
+        dist = &distribuicao;
+    }
+
+    uint32_t impressao = impressao_baralho(cartas, n_cartas);
+    int conferem = 0, divergem = 0, outro_baralho = 0;
+    long turnos = 0;
+    for (int i = 0; i < n; ++i) {
+        const Replay *r = &replays[i];
+        if (r->impressao_baralho != impressao || r->n_cartas != n_cartas) { outro_baralho++; continue; }
+        if (simular_replay(cartas, n_cartas, r, ordem, dist, &turnos) == r->resultado) conferem++;
+        else {
+            divergem++;
+            printf("Replay %d diverge do resultado gravado (semente %u).\n", i + 1, (unsigned)r->semente);
+        }
+    }
+
+    // Repetições extras servem apenas para medir a vazão do motor de replay
+    clock_t inicio = clock();
+    long turnos_medidos = 0;
+    for (int k = 0; k < repeticoes; ++k)
+        for (int i = 0; i < n; ++i)
+            if (replays[i].impressao_baralho == impressao && replays[i].n_cartas == n_cartas)
+                simular_replay(cartas, n_cartas, &replays[i], ordem, dist, &turnos_medidos);
+    double seg = (double)(clock() - inicio) / CLOCKS_PER_SEC;
+
+    printf("Replays: %d | conferem: %d | divergem: %d | outro baralho: %d | turnos: %ld\n",
+           n, conferem, divergem, outro_baralho, turnos);
+    if (turnos_medidos > 0 && seg > 0.0)
+        printf("Vazão: %.0f turnos/s (%ld turnos em %.3f s)\n", turnos_medidos / seg, turnos_medidos, seg);
+    free(replays);
+    free(ordem);
+    if (dist) liberar_distribuicao(dist);
+    baralho_liberar(&baralho);
+    return divergem > 0 ? 1 : 0;
+}
+
+// Gerador de baralhos sintéticos:
+// relogio_seg: tempo de parede em segundos (clock() soma o tempo de todas as threads).
+
+static double relogio_seg(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// rng_uniforme: valor em (0, 1). rng_normal: normal padrão (Box-Muller).
+static double rng_uniforme(uint32_t *rng) {
+    return ((double)(rng_proximo(rng) >> 8) + 0.5) / 16777216.0;
+}
+
+static double rng_normal(uint32_t *rng) {
+    double u1 = rng_uniforme(rng), u2 = rng_uniforme(rng);
+    return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+}
+
+static double limitar(double v, double minimo, double maximo) {
+    return v < minimo ? minimo : v > maximo ? maximo : v;
+}
+
+// gerar_carta_sintetica:
+// - Distribuições aproximadas das cidades reais: população log-normal (muitas
+//   cidades pequenas, poucas metrópoles), densidade maior nas cidades grandes,
+//   PIB per capita log-normal e pontos turísticos crescendo com a raiz da população.
+// - Nomes montados com sílabas; o código segue o formato de valida_codigo.
+
+void gerar_carta_sintetica(Carta *c, int indice, uint32_t *rng) {
+    static const char *prefixos[] = {"São ", "Santa ", "Porto ", "Vila ", "Nova ", "Campo ", "Rio ", "Serra "};
+    static const char *silabas[] = {"ba", "ca", "da", "fa", "ga", "ja", "la", "ma", "na", "pa",
+                                    "ra", "sa", "ta", "va", "be", "co", "du", "gi", "lu", "mo",
+                                    "ni", "po", "ri", "su", "ti", "xa", "qui", "tu", "bi", "no"};
+    memset(c, 0, sizeof(*c));
+    c->estado = (char)('A' + rng_proximo(rng) % 26);
+    snprintf(c->codigo, sizeof(c->codigo), "%c%02d", c->estado, indice % 99 + 1);
+
+    size_t L = 0;
+    if (rng_proximo(rng) % 3 == 0) {
+        const char *p = prefixos[rng_proximo(rng) % (sizeof(prefixos) / sizeof(prefixos[0]))];
+        L = strlen(p);
+        memcpy(c->nome_cidade, p, L);
+    }
+    size_t inicio_nome = L;
+    int n_silabas = 2 + (int)(rng_proximo(rng) % 3);
+    for (int k = 0; k < n_silabas; ++k) {
+        const char *s = silabas[rng_proximo(rng) % (sizeof(silabas) / sizeof(silabas[0]))];
+        size_t ls = strlen(s);
+        memcpy(c->nome_cidade + L, s, ls);
+        L += ls;
+    }
+    c->nome_cidade[L] = '\0';
+    c->nome_cidade[inicio_nome] = (char)toupper((unsigned char)c->nome_cidade[inicio_nome]);
+
+    double z_pop = rng_normal(rng);
+    double pop = limitar(50000.0 * exp(1.3 * z_pop), 1000.0, 15000000.0);
+    double dens = limitar(100.0 * exp(0.4 * z_pop + 0.9 * rng_normal(rng)), 2.0, 15000.0);
+    double ppc = limitar(30000.0 * exp(0.1 * z_pop + 0.5 * rng_normal(rng)), 5000.0, 300000.0);
+    c->populacao = (int)pop;
+    c->area = (float)(pop / dens);
+    c->pib = (float)(pop * ppc / 1e9);
+    c->num_pontos_turisticos = (int)limitar(sqrt(pop / 2000.0) * exp(0.5 * rng_normal(rng)), 0.0, 500.0);
+}
+
+typedef struct TrabalhoGerador {
+    Carta *cartas;
+    int n;
+    uint32_t semente;
+} TrabalhoGerador;
+
+// gerar_blocos: a tarefa i gera os blocos i, i + GERADOR_TAREFAS, ...
+// Cada bloco tem semente própria, então o resultado não depende das threads.
+static void gerar_blocos(void *ctx, int i) {
+    TrabalhoGerador *t = (TrabalhoGerador *)ctx;
+    int n_blocos = (t->n + GERADOR_BLOCO - 1) / GERADOR_BLOCO;
+    for (int b = i; b < n_blocos; b += GERADOR_TAREFAS) {
+        uint32_t rng = fnv1a(2166136261u ^ t->semente, &b, sizeof(b));
+        int fim = b == n_blocos - 1 ? t->n : (b + 1) * GERADOR_BLOCO;
+        for (int k = b * GERADOR_BLOCO; k < fim; ++k) gerar_carta_sintetica(&t->cartas[k], k, &rng);
+    }
+}
+
+// gerar_baralho_sintetico: substitui o conteúdo de b por n cartas geradas.
+// Retorna 1 em sucesso (0 se faltar memória).
+
+int gerar_baralho_sintetico(Baralho *b, int n, uint32_t semente) {
+    if (n < 0 || !baralho_reservar(b, n)) return 0;
+    TrabalhoGerador t = {b->cartas, n, semente};
+    executar_em_paralelo(GERADOR_TAREFAS, gerar_blocos, &t);
+    b->n = n;
+    calcular_super_poder_normalizado(b->cartas, b->n);
+    baralho_modificado(b);
+    return 1;
+}
+
+// Otimizador de equilíbrio:
+// Custo de um baralho candidato (menor é melhor):
+//  |ln(espalhamento / alvo)| + 4 * desvio_estados, onde espalhamento é a razão
+//  p90/p10 do super_poder e desvio_estados o desvio padrão da taxa de vitória
+//  dos estados em partidas sem interface (nenhum estado deve dominar).
+
+typedef struct AvaliacaoBaralho {
+    double custo;
+    double espalhamento;
+    double desvio_estados;
+} AvaliacaoBaralho;
+
+// Turnos das partidas de avaliação. As escolhas saem do gerador de cada
+// partida e não dependem dos atributos, então os pares de cartas que se
+// enfrentam são fixos: entre candidatos só muda quem vence cada turno.
+typedef struct TurnosAvaliacao {
+    int n_turnos;
+    int (*par)[MAX_JOGADORES];        // cartas do turno (jogador 1, jogador 2)
+    int *inicio;                      // turnos da carta c: turnos_carta[inicio[c] .. inicio[c + 1])
+    int *turnos_carta;
+    int jogos[26];                    // participações de cada estado
+} TurnosAvaliacao;
+
+// Super poderes de uma cadeia mantidos em ordem crescente: percentis em O(1)
+// e cada mutação só desloca os valores entre a posição antiga e a nova.
+static int comparar_float(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+// ordenado_posicao: primeira posição de v com valor >= x (busca binária).
+static int ordenado_posicao(const float *v, int n, float x) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int meio = lo + (hi - lo) / 2;
+        if (v[meio] < x) lo = meio + 1;
+        else hi = meio;
+    }
+    return lo;
+}
+
+// ordenado_trocar: substitui em v (ordenado) o valor antigo pelo novo.
+static void ordenado_trocar(float *v, int n, float antigo, float novo) {
+    int i = ordenado_posicao(v, n, antigo);
+    if (novo > antigo) {
+        int destino = ordenado_posicao(v, n, novo) - 1; // última posição < novo
+        memmove(&v[i], &v[i + 1], (size_t)(destino - i) * sizeof(float));
+        v[destino] = novo;
+    } else if (novo < antigo) {
+        int destino = ordenado_posicao(v, i, novo);
+        memmove(&v[destino + 1], &v[destino], (size_t)(i - destino) * sizeof(float));
+        v[destino] = novo;
+    }
+}
+
+// sortear_partida: distribui 5 cartas distintas a cada jogador sem embaralhar
+// o baralho inteiro (o custo não depende do tamanho do baralho).
+static void sortear_partida(PartidaIndices *p, int n_cartas, uint32_t *rng) {
+    memset(p, 0, sizeof(*p));
+    int sorteadas[CARTAS_POR_JOGADOR * MAX_JOGADORES];
+    for (int k = 0; k < CARTAS_POR_JOGADOR * MAX_JOGADORES; ++k) {
+        int repetida;
+        do {
+            sorteadas[k] = (int)(rng_proximo(rng) % (uint32_t)n_cartas);
+            repetida = 0;
+            for (int m = 0; m < k; ++m) if (sorteadas[m] == sorteadas[k]) repetida = 1;
+        } while (repetida);
+        p->mao[k % MAX_JOGADORES][p->restantes[k % MAX_JOGADORES]++] = sorteadas[k];
+    }
+    p->rng = rng_proximo(rng);
+}
+
+void liberar_turnos_avaliacao(TurnosAvaliacao *t) {
+    free(t->par);
+    free(t->inicio);
+    free(t->turnos_carta);
+    memset(t, 0, sizeof(*t));
+}
+
+// preparar_turnos_avaliacao:
+// - Joga n_partidas sem interface, com escolhas aleatórias dos dois lados,
+//   e guarda os pares de cada turno mais o índice carta -> turnos.
+// - Retorna 1 em sucesso (0 se faltar memória).
+
+int preparar_turnos_avaliacao(TurnosAvaliacao *t, const Carta *cartas, int n, int n_partidas, uint32_t semente) {
+    memset(t, 0, sizeof(*t));
+    t->par = malloc((size_t)n_partidas * CARTAS_POR_JOGADOR * sizeof(*t->par));
+    t->inicio = calloc((size_t)n + 1, sizeof(int));
+    t->turnos_carta = malloc((size_t)n_partidas * CARTAS_POR_JOGADOR * MAX_JOGADORES * sizeof(int));
+    if (!t->par || !t->inicio || !t->turnos_carta) { liberar_turnos_avaliacao(t); return 0; }
+
+    uint32_t rng = semente;
+    for (int k = 0; k < n_partidas; ++k) {
+        PartidaIndices p;
+        sortear_partida(&p, n, &rng);
+        for (int turno = 0; turno < CARTAS_POR_JOGADOR; ++turno) {
+            int escolha[MAX_JOGADORES];
+            for (int j = 0; j < MAX_JOGADORES; ++j) {
+                escolha[j] = (int)(rng_proximo(&p.rng) % (uint32_t)p.restantes[j]);
+                t->par[t->n_turnos][j] = p.mao[j][escolha[j]];
+                t->inicio[p.mao[j][escolha[j]] + 1]++;
+                int e = estado_indice(&cartas[p.mao[j][escolha[j]]]);
+                if (e >= 0) t->jogos[e]++;
+            }
+            partida_indices_jogar(&p, cartas, escolha, -1);
+            t->n_turnos++;
+        }
+    }
+    for (int c = 0; c < n; ++c) t->inicio[c + 1] += t->inicio[c];
+    int *pos = malloc((size_t)n * sizeof(int));
+    if (!pos) { liberar_turnos_avaliacao(t); return 0; }
+    memcpy(pos, t->inicio, (size_t)n * sizeof(int));
+    for (int i = 0; i < t->n_turnos; ++i)
+        for (int j = 0; j < MAX_JOGADORES; ++j) t->turnos_carta[pos[t->par[i][j]]++] = i;
+    free(pos);
+    return 1;
+}
+
+// pontos_turno: meios pontos da primeira carta contra a segunda
+// (2 vitória, 1 empate, 0 derrota), com comparar_super_poder como nas
+// partidas (no modo fixo, empates e vitórias vêm do valor inteiro).
+static int pontos_turno(const Carta *a, const Carta *oponente) {
+    int c = comparar_super_poder(a, oponente);
+    return c > 0 ? 2 : c == 0 ? 1 : 0;
+}
+
+// contar_pontos_estados: meios pontos de cada estado em todos os turnos.
+static void contar_pontos_estados(const Carta *cartas, const TurnosAvaliacao *t, int pontos[26]) {
+    memset(pontos, 0, 26 * sizeof(int));
+    for (int i = 0; i < t->n_turnos; ++i) {
+        const Carta *a = &cartas[t->par[i][0]], *b = &cartas[t->par[i][1]];
+        int ea = estado_indice(a), eb = estado_indice(b);
+        int pa = pontos_turno(a, b);
+        if (ea >= 0) pontos[ea] += pa;
+        if (eb >= 0) pontos[eb] += 2 - pa;
+    }
+}
+
+// atualizar_pontos_estados: refaz só os turnos da carta k, que antes da
+// mutação era 'antiga'.
+static void atualizar_pontos_estados(const Carta *cartas, const TurnosAvaliacao *t, int k, const Carta *antiga, int pontos[26]) {
+    int ek = estado_indice(&cartas[k]);
+    for (int m = t->inicio[k]; m < t->inicio[k + 1]; ++m) {
+        const int *par = t->par[t->turnos_carta[m]];
+        int outra = par[0] == k ? par[1] : par[0];
+        int delta = pontos_turno(&cartas[k], &cartas[outra]) - pontos_turno(antiga, &cartas[outra]);
+        int eo = estado_indice(&cartas[outra]);
+        if (ek >= 0) pontos[ek] += delta;
+        if (eo >= 0) pontos[eo] -= delta;
+    }
+}
+
+// avaliar_baralho: custo a partir dos pontos por estado e dos super poderes
+// em ordem crescente (ordenado, n valores).
+
+void avaliar_baralho(const float *ordenado, int n, const TurnosAvaliacao *t, const int pontos[26],
+                     double alvo, AvaliacaoBaralho *av) {
+    float p10 = ordenado[n / 10];
+    float p90 = ordenado[n * 9 / 10];
+    av->espalhamento = p10 > 0.0f ? (double)p90 / p10 : 1e9;
+
+    double soma = 0.0, soma2 = 0.0;
+    int n_estados = 0;
+    for (int e = 0; e < 26; ++e) {
+        if (t->jogos[e] == 0) continue;
+        double taxa = pontos[e] / (2.0 * t->jogos[e]);
+        soma += taxa;
+        soma2 += taxa * taxa;
+        n_estados++;
+    }
+    double media = n_estados ? soma / n_estados : 0.0;
+    av->desvio_estados = n_estados ? sqrt(fmax(0.0, soma2 / n_estados - media * media)) : 0.0;
+    av->custo = fabs(log(av->espalhamento / alvo)) + 4.0 * av->desvio_estados;
+}
+
+// mutar_carta: altera um atributo original em até ±30% (pontos: ±1) e
+// recalcula os derivados. Retorna 0 se a carta ficou implausível
+// (densidade ou PIB per capita fora das faixas do gerador).
+static int mutar_carta(Carta *c, uint32_t *rng) {
+    double fator = exp(0.3 * (2.0 * rng_uniforme(rng) - 1.0));
+    switch (rng_proximo(rng) % 4) {
+    case 0: c->populacao = (int)limitar(c->populacao * fator, 1000.0, 15000000.0); break;
+    case 1: c->area = (float)limitar(c->area * fator, 0.05, 100000.0); break;
+    case 2: c->pib = (float)limitar(c->pib * fator, 0.001, 5000.0); break;
+    default: c->num_pontos_turisticos = (int)limitar(c->num_pontos_turisticos + (int)(rng_proximo(rng) % 3) - 1, 0.0, 500.0); break;
+    }
+    invalidar_derivados(c);
+    carta_super_poder(c);
+    float dens = carta_densidade(c), ppc = carta_pib_per_capita(c);
+    return dens >= 1.0f && dens <= 20000.0f && ppc >= 3000.0f && ppc <= 400000.0f;
+}
+
+// Estado compartilhado pelas cadeias (uma por thread).
+typedef struct Otimizador {
+    Carta *cadeias[OTIMIZADOR_CADEIAS];
+    float *ordenado[OTIMIZADOR_CADEIAS];
+    int pontos[OTIMIZADOR_CADEIAS][26];
+    AvaliacaoBaralho av[OTIMIZADOR_CADEIAS];
+    int n;
+    const TurnosAvaliacao *turnos;
+    double alvo;
+    int passos;                       // passos por cadeia nesta rodada
+    int rodada;
+    uint32_t semente;
+} Otimizador;
+
+// otimizar_cadeia: uma rodada de têmpera simulada sobre a cópia da cadeia i.
+// A temperatura cai geometricamente de 0.02 a 0.00002 ao longo das rodadas.
+static void otimizar_cadeia(void *ctx, int i) {
+    Otimizador *o = (Otimizador *)ctx;
+    Carta *cartas = o->cadeias[i];
+    uint32_t rng = o->semente ^ ((uint32_t)i * 0x9E3779B9u) ^ ((uint32_t)(o->rodada + 1) * 0x85EBCA6Bu);
+    AvaliacaoBaralho atual = o->av[i], nova;
+    int pontos[26];
+    double total = (double)o->passos * OTIMIZADOR_RODADAS;
+    for (int passo = 0; passo < o->passos; ++passo) {
+        double temperatura = 0.02 * pow(0.001, ((double)o->rodada * o->passos + passo) / total);
+        int k = (int)(rng_proximo(&rng) % (uint32_t)o->n);
+        Carta antes = cartas[k];
+        if (!mutar_carta(&cartas[k], &rng)) { cartas[k] = antes; continue; }
+        memcpy(pontos, o->pontos[i], sizeof(pontos));
+        atualizar_pontos_estados(cartas, o->turnos, k, &antes, pontos);
+        ordenado_trocar(o->ordenado[i], o->n, antes.super_poder, cartas[k].super_poder);
+        avaliar_baralho(o->ordenado[i], o->n, o->turnos, pontos, o->alvo, &nova);
+        double delta = nova.custo - atual.custo;
+        if (delta <= 0.0 || rng_uniforme(&rng) < exp(-delta / temperatura)) {
+            atual = nova;
+            memcpy(o->pontos[i], pontos, sizeof(pontos));
+        } else {
+            ordenado_trocar(o->ordenado[i], o->n, cartas[k].super_poder, antes.super_poder);
+            cartas[k] = antes;
+        }
+    }
+    o->av[i] = atual;
+}
+
+// otimizar_baralho:
+// - Têmpera simulada em OTIMIZADOR_CADEIAS cadeias paralelas; ao fim de cada
+//   rodada todas recomeçam da cadeia de menor custo. O resultado fica em cartas.
+// - Retorna 1 em sucesso (0 se faltar memória).
+
+int otimizar_baralho(Carta *cartas, int n, double alvo, int passos, uint32_t semente,
+                     AvaliacaoBaralho *inicial, AvaliacaoBaralho *final) {
+    if (n < CARTAS_POR_JOGADOR * MAX_JOGADORES) return 0;
+    Otimizador o;
+    TurnosAvaliacao turnos;
+    memset(&o, 0, sizeof(o));
+    calcular_super_poder_normalizado(cartas, n);
+    int ok = preparar_turnos_avaliacao(&turnos, cartas, n, OTIMIZADOR_PARTIDAS, semente);
+    float *ordenado = malloc((size_t)n * sizeof(float));
+    ok = ok && ordenado;
+    for (int i = 0; ok && i < OTIMIZADOR_CADEIAS; ++i) {
+        o.cadeias[i] = malloc((size_t)n * sizeof(Carta));
+        o.ordenado[i] = malloc((size_t)n * sizeof(float));
+        ok = o.cadeias[i] && o.ordenado[i];
+    }
+    if (ok) {
+        int pontos[26];
+        for (int i = 0; i < n; ++i) ordenado[i] = cartas[i].super_poder;
+        qsort(ordenado, (size_t)n, sizeof(float), comparar_float);
+        contar_pontos_estados(cartas, &turnos, pontos);
+        avaliar_baralho(ordenado, n, &turnos, pontos, alvo, inicial);
+        *final = *inicial;
+
+        o.n = n;
+        o.turnos = &turnos;
+        o.alvo = alvo;
+        o.passos = passos / OTIMIZADOR_RODADAS > 0 ? passos / OTIMIZADOR_RODADAS : 1;
+        o.semente = semente;
+        for (int r = 0; passos > 0 && r < OTIMIZADOR_RODADAS; ++r) {
+            for (int i = 0; i < OTIMIZADOR_CADEIAS; ++i) {
+                memcpy(o.cadeias[i], cartas, (size_t)n * sizeof(Carta));
+                memcpy(o.ordenado[i], ordenado, (size_t)n * sizeof(float));
+                memcpy(o.pontos[i], pontos, sizeof(pontos));
+                o.av[i] = *final;
+            }
+            o.rodada = r;
+            executar_em_paralelo(OTIMIZADOR_CADEIAS, otimizar_cadeia, &o);
+            int melhor = 0;
+            for (int i = 1; i < OTIMIZADOR_CADEIAS; ++i) if (o.av[i].custo < o.av[melhor].custo) melhor = i;
+            if (o.av[melhor].custo < final->custo) {
+                memcpy(cartas, o.cadeias[melhor], (size_t)n * sizeof(Carta));
+                memcpy(ordenado, o.ordenado[melhor], (size_t)n * sizeof(float));
+                memcpy(pontos, o.pontos[melhor], sizeof(pontos));
+                *final = o.av[melhor];
+            }
+            printf("Rodada %d/%d | custo %.4f | espalhamento p90/p10 %.2f (alvo %.2f) | desvio por estado %.4f\n",
+                   r + 1, OTIMIZADOR_RODADAS, final->custo, final->espalhamento, alvo, final->desvio_estados);
+        }
+    }
+    for (int i = 0; i < OTIMIZADOR_CADEIAS; ++i) { free(o.cadeias[i]); free(o.ordenado[i]); }
+    free(ordenado);
+    liberar_turnos_avaliacao(&turnos);
+    return ok;
+}
+
+// executar_gerador:
+// - Modo sem interface (--gerar): gera n cartas, otimiza o equilíbrio com
+//   'passos' passos por cadeia (0 = só gerar) e grava o baralho em 'arquivo'.
+
+int executar_gerador(int n, const char *arquivo, int passos, double alvo) {
+    if (n < CARTAS_POR_JOGADOR * MAX_JOGADORES || n > MAX_CARTAS) {
+        printf("Quantidade inválida: use de %d a %d cartas.\n", CARTAS_POR_JOGADOR * MAX_JOGADORES, MAX_CARTAS);
+        return 1;
+    }
+    if (alvo <= 1.0) alvo = ALVO_ESPALHAMENTO_PADRAO;
+    uint32_t semente = (uint32_t)time(NULL) ^ 0x9E3779B9u;
+    Baralho b = {0};
+    double inicio = relogio_seg();
+    if (!gerar_baralho_sintetico(&b, n, semente)) {
+        printf("Memória insuficiente para gerar %d cartas.\n", n);
+        return 1;
+    }
+    printf("%d cartas geradas em %.2f s (semente %u).\n", n, relogio_seg() - inicio, (unsigned)semente);
+
+    AvaliacaoBaralho antes, depois;
+    inicio = relogio_seg();
+    if (!otimizar_baralho(b.cartas, b.n, alvo, passos, semente, &antes, &depois)) {
+        printf("Memória insuficiente para otimizar o baralho.\n");
+        baralho_liberar(&b);
+        return 1;
+    }
+    printf("Antes:  custo %.4f | espalhamento %.2f | desvio por estado %.4f\n",
+           antes.custo, antes.espalhamento, antes.desvio_estados);
+    printf("Depois: custo %.4f | espalhamento %.2f | desvio por estado %.4f (%.2f s)\n",
+           depois.custo, depois.espalhamento, depois.desvio_estados, relogio_seg() - inicio);
+
+    int ok = salvar_cartas_arquivo(arquivo, b.cartas, b.n);
+    if (ok) printf("Baralho gravado em %s.\n", arquivo);
+    else printf("Erro ao gravar %s.\n", arquivo);
+    baralho_liberar(&b);
+    return ok ? 0 : 1;
+}
+
+// Teste de estresse da publicação (--estresse):
+// - Um escritor altera e publica o baralho sem parar enquanto os leitores
+//   leem instantâneos. Cada leitura confere a marca do instantâneo, que a
+//   versão nunca volta para trás e que as cartas amostradas têm derivados
+//   válidos; a cada ESTRESSE_CONFERENCIA leituras a impressão inteira é refeita.
+// - Instantâneos liberados cedo demais ou alterados depois de publicados
+//   aparecem como erro (com -fsanitize=address, como acesso inválido).
+
+typedef struct Estresse {
+    Publicacao publicacao;
+    Baralho baralho;
+    double segundos;
+    atomic_int parar;
+    long leituras[MAX_LEITORES], erros[MAX_LEITORES];
+    double soma[MAX_LEITORES];        // impede que as leituras sejam descartadas
+} Estresse;
+
+static void estresse_escritor(Estresse *e) {
+    uint32_t rng = 0x5EED1234u;
+    double fim = relogio_seg() + e->segundos;
+    while (relogio_seg() < fim) {
+        Baralho *b = &e->baralho;
+        uint32_t op = rng_proximo(&rng) % 3;
+        if (op == 0 && baralho_reservar(b, b->n + 1)) {
+            gerar_carta_sintetica(&b->cartas[b->n], b->n, &rng);
+            b->n++;
+            baralho_alterado(b, b->n - 1, 1);
+        } else if (op == 1 && b->n > CARTAS_POR_JOGADOR * MAX_JOGADORES) {
+            int i = (int)(rng_proximo(&rng) % (uint32_t)b->n);
+            memmove(b->cartas + i, b->cartas + i + 1, (size_t)(b->n - i - 1) * sizeof(Carta));
+            b->n--;
+            baralho_alterado(b, i, 0);
+        } else if (b->n > 0) {
+            int i = (int)(rng_proximo(&rng) % (uint32_t)b->n);
+            b->cartas[i].pib *= 1.01f;
+            invalidar_derivados(&b->cartas[i]);
+            baralho_alterado(b, i, 1);
+        }
+        publicar_baralho(&e->publicacao, b);
+    }
+    atomic_store(&e->parar, 1);
+}
+
+static void estresse_leitor(Estresse *e, int i) {
+    int slot = leitor_registrar(&e->publicacao);
+    if (slot < 0) { e->erros[i]++; return; }
+    uint32_t rng = 0x9E3779B9u * (uint32_t)(i + 1);
+    uint32_t ultima_versao = 0;
+    long leituras = 0, erros = 0;
+    double soma = 0.0;
+    while (!atomic_load(&e->parar)) {
+        const Instantaneo *s = leitor_entrar(&e->publicacao, slot);
+        if (!s || s->marca != MARCA_INSTANTANEO || s->versao < ultima_versao) {
+            erros++;
+        } else {
+            ultima_versao = s->versao;
+            for (int k = 0; k < ESTRESSE_AMOSTRA && s->n > 0; ++k) {
+                const Carta *c = instantaneo_carta(s, (int)(rng_proximo(&rng) % (uint32_t)s->n));
+                if (c->derivados_validos != (DERIVADO_DENSIDADE | DERIVADO_PIB_PER_CAPITA | DERIVADO_SUPER_PODER)) erros++;
+                soma += c->super_poder;
+            }
+            if (leituras % ESTRESSE_CONFERENCIA == 0 && !instantaneo_conferir(s)) erros++;
+        }
+        leitor_sair(&e->publicacao, slot);
+        leituras++;
+    }
+    leitor_liberar(&e->publicacao, slot);
+    e->leituras[i] = leituras;
+    e->erros[i] = erros;
+    e->soma[i] = soma;
+}
+
+// tarefa_estresse: a tarefa 0 é o escritor; as demais são leitores.
+static void tarefa_estresse(void *ctx, int i) {
+    if (i == 0) estresse_escritor((Estresse *)ctx);
+    else estresse_leitor((Estresse *)ctx, i - 1);
+}
+
+// executar_estresse:
+// - Roda rodadas com 1, 2, 4, ... até max_leitores leitores, cada uma por
+//   'segundos', e mostra a vazão de leitura e a de publicação.
+// - A vazão total só mostra se a leitura escala com os núcleos quando há
+//   núcleos para o escritor e todos os leitores; com menos, o resumo diz
+//   que a escalabilidade não foi medida.
+// - Retorna 0 se nenhuma rodada teve erro e toda memória retirada foi liberada.
+// - Sem pthreads (Windows) as tarefas rodam em sequência: não há leitura concorrente.
+
+int executar_estresse(int max_leitores, double segundos, int n_cartas) {
+    if (max_leitores < 1) max_leitores = 1;
+    if (max_leitores > MAX_LEITORES - 1) max_leitores = MAX_LEITORES - 1;
+    if (segundos <= 0.0) segundos = ESTRESSE_SEGUNDOS_PADRAO;
+    if (n_cartas < CARTAS_POR_JOGADOR * MAX_JOGADORES) n_cartas = ESTRESSE_CARTAS_PADRAO;
+    Estresse *e = malloc(sizeof(Estresse));
+    if (!e) { printf("Memória insuficiente.\n"); return 1; }
+    int nucleos = 1;
+#ifndef _WIN32
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online > 0) nucleos = (int)online;
+#endif
+    printf("Estresse: %d cartas, %.1f s por rodada, %d núcleo(s), leitores nunca bloqueiam o escritor.\n",
+           n_cartas, segundos, nucleos);
+    printf("Leitores | leituras/s | por leitor | publicações/s | retirados (máx) | erros\n");
+    int falhou = 0;
+    double vazao_um = 0.0, vazao_max = 0.0;
+    long publicacoes = 0, copiadas = 0;
+    for (int leitores = 1;; leitores *= 2) {
+        if (leitores > max_leitores) leitores = max_leitores;
+        memset(e, 0, sizeof(*e));
+        publicacao_iniciar(&e->publicacao);
+        atomic_init(&e->parar, 0);
+        e->segundos = segundos;
+        if (!gerar_baralho_sintetico(&e->baralho, n_cartas, 42) || !publicar_baralho(&e->publicacao, &e->baralho)) {
+            printf("Memória insuficiente.\n");
+            baralho_liberar(&e->baralho);
+            publicacao_encerrar(&e->publicacao);
+            falhou = 1;
+            break;
+        }
+        long copiadas_inicio = e->publicacao.copiadas;
+        double inicio = relogio_seg();
+        executar_em_paralelo(leitores + 1, tarefa_estresse, e);
+        double seg = relogio_seg() - inicio;
+        publicacoes += e->publicacao.publicados - 1;
+        copiadas += e->publicacao.copiadas - copiadas_inicio;
+
+        long leituras = 0, erros = 0;
+        for (int i = 0; i < leitores; ++i) { leituras += e->leituras[i]; erros += e->erros[i]; }
+        // Sem leitores ativos tudo que foi retirado pode ser liberado
+        publicacao_recolher(&e->publicacao);
+        if (e->publicacao.liberados != e->publicacao.publicados - 1) erros++;
+        printf("%8d | %10.0f | %10.0f | %13.0f | %15d | %ld\n", leitores, leituras / seg, leituras / seg / leitores,
+               (e->publicacao.publicados - 1) / seg, e->publicacao.max_retirados, erros);
+        if (leitores == 1) vazao_um = leituras / seg;
+        vazao_max = leituras / seg;
+        if (erros > 0) falhou = 1;
+        publicacao_encerrar(&e->publicacao);
+        baralho_liberar(&e->baralho);
+        if (leitores == max_leitores) break;
+    }
+    free(e);
+    if (!falhou && max_leitores > 1 && vazao_um > 0.0) {
+        if (nucleos > max_leitores)
+            printf("Leitura com %d leitores: %.2fx a vazão de 1 leitor (%d núcleos).\n",
+                   max_leitores, vazao_max / vazao_um, nucleos);
+        else
+            printf("Escalabilidade da leitura NÃO medida: %d núcleo(s) para %d threads (escritor + %d leitores).\n",
+                   nucleos, max_leitores + 1, max_leitores);
+    }
+    if (publicacoes > 0)
+        printf("Cartas copiadas por publicação: %.0f em média (baralho de %d, blocos de %d).\n",
+               (double)copiadas / publicacoes, n_cartas, VERSAO_BLOCO);
+    printf(falhou ? "FALHA: o instantâneo publicado foi visto inconsistente.\n" : "OK: nenhuma leitura inconsistente.\n");
+    return falhou;
+}
+
+// Distribuição equilibrada em simulação (--distribuir):
+// medir_maos: acumula a diferença relativa entre as somas das mãos e conta
+// mãos que passam do limite por estado.
+typedef struct MedidaDistribuicao {
+    double soma_diferenca, max_diferenca;
+    long dentro_tolerancia, acima_limite_estado, partidas;
+} MedidaDistribuicao;
+
+static void medir_maos(MedidaDistribuicao *m, const Carta *cartas, const int64_t *forca,
+                       int mao[MAX_JOGADORES][CARTAS_POR_JOGADOR], double media_mao, const RegrasDistribuicao *regras) {
+    double soma[MAX_JOGADORES] = {0.0, 0.0};
+    for (int j = 0; j < MAX_JOGADORES; ++j) {
+        int acima = 0;
+        for (int c = 0; c < CARTAS_POR_JOGADOR; ++c) {
+            soma[j] += (double)forca[mao[j][c]] / FIXO_UM;
+            int iguais = 0;
+            for (int k = 0; k < CARTAS_POR_JOGADOR; ++k) iguais += cartas[mao[j][k]].estado == cartas[mao[j][c]].estado;
+            acima |= regras->max_por_estado > 0 && iguais > regras->max_por_estado;
+        }
+        m->acima_limite_estado += acima;
+    }
+    double dif = media_mao > 0.0 ? fabs(soma[0] - soma[1]) / media_mao : 0.0;
+    m->soma_diferenca += dif;
+    if (dif > m->max_diferenca) m->max_diferenca = dif;
+    m->dentro_tolerancia += dif <= regras->tolerancia * (1.0 + 1e-6);
+    m->partidas++;
+}
+
+// executar_distribuicao:
+// - Sorteia 'partidas' mãos com a distribuição uniforme (sortear_partida) e
+//   com a equilibrada (regras de distribuicao.txt, ou as padrão), mostra a
+//   vazão de cada uma e o quanto as mãos ficaram parelhas.
+// - n_cartas > 0 usa um baralho sintético desse tamanho em vez de cartas.bin.
+
+int executar_distribuicao(int partidas, int n_cartas) {
+    if (partidas <= 0) partidas = DISTRIBUICAO_PARTIDAS_PADRAO;
+    Baralho b = {0};
+    if (n_cartas > 0) {
+        if (!gerar_baralho_sintetico(&b, n_cartas, 42)) { printf("Memória insuficiente.\n"); return 1; }
+    } else {
+        carregar_cartas(&b);
+    }
+    if (b.n < CARTAS_POR_JOGADOR * MAX_JOGADORES) {
+        printf("São necessárias pelo menos %d cartas.\n", CARTAS_POR_JOGADOR * MAX_JOGADORES);
+        baralho_liberar(&b);
+        return 1;
+    }
+    garantir_derivados(b.cartas, b.n);
+    RegrasDistribuicao regras = regras_distribuicao;
+    regras.equilibrada = 1;
+    Distribuicao d;
+    double inicio = relogio_seg();
+    if (!preparar_distribuicao(&d, b.cartas, b.n, &regras)) {
+        printf("Memória insuficiente.\n");
+        baralho_liberar(&b);
+        return 1;
+    }
+    double preparo = relogio_seg() - inicio;
+    int64_t *forca = malloc((size_t)b.n * sizeof(int64_t));
+    if (!forca) {
+        printf("Memória insuficiente.\n");
+        liberar_distribuicao(&d);
+        baralho_liberar(&b);
+        return 1;
+    }
+    cartas_forca(b.cartas, b.n, forca);
+    double media_mao = 0.0;
+    for (int i = 0; i < b.n; ++i) media_mao += fabs((double)forca[i] / FIXO_UM);
+    media_mao = media_mao / b.n * CARTAS_POR_JOGADOR;
+
+    printf("Distribuição: %d cartas | tolerância %.0f%% da mão média | máx. %d por estado\n",
+           b.n, regras.tolerancia * 100.0, regras.max_por_estado);
+    printf("Preparo: %.3f s | cartas fora do sorteio: %d | faixas sem garantia: %d\n",
+           preparo, d.excluidas, d.faixas_sem_garantia);
+
+    // Vazão: só o sorteio (o checksum impede que o laço seja descartado)
+    uint32_t rng = 12345u, checksum = 0;
+    long regras_cumpridas = 0;
+    int mao[MAX_JOGADORES][CARTAS_POR_JOGADOR];
+    inicio = relogio_seg();
+    for (int k = 0; k < partidas; ++k) {
+        regras_cumpridas += distribuir_equilibrado(&d, &rng, mao);
+        checksum += (uint32_t)mao[0][0] ^ (uint32_t)mao[1][CARTAS_POR_JOGADOR - 1];
+    }
+    double seg_equilibrada = relogio_seg() - inicio;
+    rng = 12345u;
+    inicio = relogio_seg();
+    for (int k = 0; k < partidas; ++k) {
+        PartidaIndices p;
+        sortear_partida(&p, b.n, &rng);
+        checksum += (uint32_t)p.mao[0][0] ^ (uint32_t)p.mao[1][CARTAS_POR_JOGADOR - 1];
+    }
+    double seg_uniforme = relogio_seg() - inicio;
+
+    // Qualidade: amostra das mesmas duas distribuições
+    MedidaDistribuicao uniforme, equilibrada;
+    memset(&uniforme, 0, sizeof(uniforme));
+    memset(&equilibrada, 0, sizeof(equilibrada));
+    int amostra = partidas < 1000000 ? partidas : 1000000;
+    rng = 777u;
+    for (int k = 0; k < amostra; ++k) {
+        PartidaIndices p;
+        sortear_partida(&p, b.n, &rng);
+        medir_maos(&uniforme, b.cartas, forca, p.mao, media_mao, &regras);
+        distribuir_equilibrado(&d, &rng, mao);
+        medir_maos(&equilibrada, b.cartas, forca, mao, media_mao, &regras);
+    }
+
+    printf("Modo        | partidas/s | diferença média | diferença máx. | dentro da tolerância | mãos acima do limite\n");
+    const MedidaDistribuicao *medidas[2] = {&uniforme, &equilibrada};
+    const char *nomes[2] = {"uniforme", "equilibrada"};
+    double segs[2] = {seg_uniforme, seg_equilibrada};
+    for (int i = 0; i < 2; ++i) {
+        const MedidaDistribuicao *m = medidas[i];
+        printf("%-11s | %10.0f | %14.1f%% | %13.1f%% | %19.1f%% | %ld\n", nomes[i], partidas / segs[i],
+               100.0 * m->soma_diferenca / m->partidas, 100.0 * m->max_diferenca,
+               100.0 * m->dentro_tolerancia / m->partidas, m->acima_limite_estado);
+    }
+    printf("Partidas em que o limite por estado não coube: %ld de %d (checksum %08x)\n",
+           partidas - regras_cumpridas, partidas, (unsigned)checksum);
+    free(forca);
+    liberar_distribuicao(&d);
+    baralho_liberar(&b);
+    return 0;
+}
+
+// Exportação de dados:
+// Formatos: CSV, JSON Lines (um objeto por linha) e colunar binário.
+// Arquivo colunar ("STCC"): magic, versão, linhas, colunas e linhas por
+// grupo (uint32 cada); o esquema, por coluna: tamanho do nome (uint8), nome e
+// tipo (uint8: 'i' int32, 'f' float32, 'c' 1 byte, 's' texto); depois os
+// grupos de linhas, cada um com todas as colunas em sequência. Texto: m + 1
+// deslocamentos uint32 (relativos ao grupo) seguidos dos bytes. Números na
+// ordem de bytes da máquina. Os grupos mantêm as cartas lidas no cache
+// enquanto as colunas delas são gravadas.
+
+// Saída com buffer próprio: cada registro é montado direto no buffer e o
+// sistema só recebe blocos de EXPORTACAO_BUFFER bytes.
+typedef struct Saida {
+    FILE *f;
+    char *buf;
+    size_t n, cap;
+    long long gravados;
+    int erro;
+} Saida;
+
+static void saida_descarregar(Saida *s) {
+    if (s->n > 0 && fwrite(s->buf, 1, s->n, s->f) != s->n) s->erro = 1;
+    s->gravados += (long long)s->n;
+    s->n = 0;
+}
+
+// saida_reservar: garante espaço para mais 'tam' bytes e devolve onde escrever.
+static char *saida_reservar(Saida *s, size_t tam) {
+    if (s->n + tam > s->cap) saida_descarregar(s);
+    return s->buf + s->n;
+}
+
+static void saida_bytes(Saida *s, const void *dados, size_t tam) {
+    if (tam > s->cap) {
+        saida_descarregar(s);
+        if (fwrite(dados, 1, tam, s->f) != tam) s->erro = 1;
+        s->gravados += (long long)tam;
+        return;
+    }
+    memcpy(saida_reservar(s, tam), dados, tam);
+    s->n += tam;
+}
+
+static void saida_u32(Saida *s, uint32_t v) { saida_bytes(s, &v, sizeof(v)); }
+
+// formatar_inteiro / formatar_float: conversão para texto sem printf.
+// Floats saem com 9 dígitos significativos (FLT_DECIMAL_DIG: o bastante
+// para recuperar o float exato), em ponto fixo e sem zeros à direita.
+// Valores abaixo de 1e-6 ou acima de 1e15 usam a forma com expoente.
+static const char digitos_pares[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static char *formatar_inteiro(char *p, long long v) {
+    char tmp[24];
+    char *q = tmp + sizeof(tmp);
+    unsigned long long u = v < 0 ? 0ull - (unsigned long long)v : (unsigned long long)v;
+    if (v < 0) *p++ = '-';
+    while (u >= 100) { q -= 2; memcpy(q, &digitos_pares[(u % 100) * 2], 2); u /= 100; }
+    if (u >= 10) { q -= 2; memcpy(q, &digitos_pares[u * 2], 2); }
+    else *--q = (char)('0' + u);
+    size_t L = (size_t)(tmp + sizeof(tmp) - q);
+    memcpy(p, q, L);
+    return p + L;
+}
+
+static char *formatar_float(char *p, float f) {
+    static const double potencias[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                       1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14};
+    double v = f;
+    if (v != v || v >= 1e15 || v <= -1e15) return p + sprintf(p, "%.9g", v); // NaN/infinito/enorme
+    if (signbit(v)) { *p++ = '-'; v = -v; } // inclusive -0
+    if (v == 0.0) { *p++ = '0'; return p; }
+    if (v < 1e-6) return p + sprintf(p, "%.9g", v);
+    // casas decimais para 9 dígitos significativos
+    int casas = 8;
+    for (double lim = 10.0; casas > 0 && v >= lim; lim *= 10.0) casas--;
+    for (double lim = 1.0; v < lim; lim *= 0.1) casas++;
+    // Com 9 dígitos o passo decimal é no máximo 1/6 do espaçamento entre
+    // floats, então mesmo um empate (ou o erro do double) no último dígito
+    // ainda lê de volta o mesmo float.
+    unsigned long long x = (unsigned long long)(v * potencias[casas] + 0.5);
+    unsigned long long escala = (unsigned long long)potencias[casas];
+    p = formatar_inteiro(p, (long long)(x / escala));
+    unsigned long long frac = x % escala;
+    if (frac) {
+        *p++ = '.';
+        int d = casas;
+        for (; d >= 2; d -= 2) { memcpy(p + d - 2, &digitos_pares[(frac % 100) * 2], 2); frac /= 100; }
+        if (d) p[0] = (char)('0' + frac);
+        p += casas;
+        while (p[-1] == '0') p--;
+    }
+    return p;
+}
+
+// formatar_texto_csv / formatar_texto_json: texto com escape do formato.
+// Destino precisa de 6 * strlen(s) + 2 bytes no pior caso.
+static char *formatar_texto_csv(char *p, const char *s) {
+    if (!strpbrk(s, ",\"\r\n")) { size_t L = strlen(s); memcpy(p, s, L); return p + L; }
+    *p++ = '"';
+    for (; *s; ++s) { if (*s == '"') *p++ = '"'; *p++ = *s; }
+    *p++ = '"';
+    return p;
+}
+
+static char *formatar_texto_json(char *p, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    *p++ = '"';
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') { *p++ = '\\'; *p++ = (char)c; }
+        else if (c < 0x20) { memcpy(p, "\\u00", 4); p[4] = hex[c >> 4]; p[5] = hex[c & 15]; p += 6; }
+        else *p++ = (char)c;
+    }
+    *p++ = '"';
+    return p;
+}
+
+// interpretar_formato: "csv", "jsonl" ou "colunas" -> FORMATO_* (-1 se inválido).
+int interpretar_formato(const char *nome) {
+    if (strcmp(nome, "csv") == 0) return FORMATO_CSV;
+    if (strcmp(nome, "jsonl") == 0 || strcmp(nome, "json") == 0) return FORMATO_JSONL;
+    if (strcmp(nome, "colunas") == 0) return FORMATO_COLUNAS;
+    return -1;
+}
 
-        // Remove cartas jogadas (remover maior índice primeiro para evitar deslocamento incorreto)
-        if (escolha_h > escolha_c) {
-            remover_carta(&jogadores[0], escolha_h);
-            remover_carta(&jogadores[1], escolha_c);
+static void exportar_cartas_texto(Saida *s, Carta *cartas, int n, int formato) {
+    if (formato == FORMATO_CSV) {
+        static const char cabecalho[] = "estado,codigo,nome_cidade,populacao,area,pib,num_pontos_turisticos,"
+                                        "densidade_populacional,pib_per_capita,super_poder\n";
+        saida_bytes(s, cabecalho, sizeof(cabecalho) - 1);
+    }
+    for (int i = 0; i < n; ++i) {
+        Carta *c = &cartas[i];
+        char *inicio = saida_reservar(s, EXPORTACAO_REGISTRO), *p = inicio;
+        if (formato == FORMATO_CSV) {
+            *p++ = c->estado; *p++ = ',';
+            p = formatar_texto_csv(p, c->codigo); *p++ = ',';
+            p = formatar_texto_csv(p, c->nome_cidade); *p++ = ',';
+            p = formatar_inteiro(p, c->populacao); *p++ = ',';
+            p = formatar_float(p, c->area); *p++ = ',';
+            p = formatar_float(p, c->pib); *p++ = ',';
+            p = formatar_inteiro(p, c->num_pontos_turisticos); *p++ = ',';
+            p = formatar_float(p, c->densidade_populacional); *p++ = ',';
+            p = formatar_float(p, c->pib_per_capita); *p++ = ',';
+            p = formatar_float(p, c->super_poder);
         } else {
-            remover_carta(&jogadores[1], escolha_c);
-            remover_carta(&jogadores[0], escolha_h);
+            char estado[2] = {c->estado, '\0'};
+            memcpy(p, "{\"estado\":", 10); p += 10; p = formatar_texto_json(p, estado);
+            memcpy(p, ",\"codigo\":", 10); p += 10; p = formatar_texto_json(p, c->codigo);
+            memcpy(p, ",\"nome_cidade\":", 15); p += 15; p = formatar_texto_json(p, c->nome_cidade);
+            memcpy(p, ",\"populacao\":", 13); p += 13; p = formatar_inteiro(p, c->populacao);
+            memcpy(p, ",\"area\":", 8); p += 8; p = formatar_float(p, c->area);
+            memcpy(p, ",\"pib\":", 7); p += 7; p = formatar_float(p, c->pib);
+            memcpy(p, ",\"num_pontos_turisticos\":", 25); p += 25; p = formatar_inteiro(p, c->num_pontos_turisticos);
+            memcpy(p, ",\"densidade_populacional\":", 26); p += 26; p = formatar_float(p, c->densidade_populacional);
+            memcpy(p, ",\"pib_per_capita\":", 18); p += 18; p = formatar_float(p, c->pib_per_capita);
+            memcpy(p, ",\"super_poder\":", 15); p += 15; p = formatar_float(p, c->super_poder);
+            *p++ = '}';
         }
+        *p++ = '\n';
+        s->n += (size_t)(p - inicio);
     }
+}
 
-    // Atualiza estatísticas gerais
-    estat->jogos_jogados++;
-    if (vitorias_turno[0] > vitorias_turno[1]) {
-        estat->vitorias[0]++; // vitória do humano
-    } else if (vitorias_turno[1] > vitorias_turno[0]) {
-        estat->vitorias[1]++; // vitória do jogador 2/computador
-        estat->computador_vitorias++; // contador específico para computador
-    } else {
-        estat->empates++;
-    }
+// Colunas: cabeçalho do arquivo, esquema e valores de um campo de um grupo.
+static void exportar_colunas_cabecalho(Saida *s, uint32_t linhas, uint32_t n_colunas, uint32_t por_grupo) {
+    saida_u32(s, 0x43435453u); // "STCC"
+    saida_u32(s, 2);
+    saida_u32(s, linhas);
+    saida_u32(s, n_colunas);
+    saida_u32(s, por_grupo);
+}
 
-    // Exibe resultado final
-    set_color(31);
-    printf("Resultado final da partida (Humano x Computador):\n");
-    reset_color();
+static void exportar_coluna_esquema(Saida *s, const char *nome, char tipo) {
+    unsigned char tam = (unsigned char)strlen(nome);
+    saida_bytes(s, &tam, 1);
+    saida_bytes(s, nome, tam);
+    saida_bytes(s, &tipo, 1);
+}
 
-    if (vitorias_turno[0] > vitorias_turno[1]) {
-        set_color(32);
-        printf("Humano venceu a partida!\n");
-        reset_color();
-    } else if (vitorias_turno[1] > vitorias_turno[0]) {
-        set_color(34);
-        printf("Computador venceu a partida!\n");
-        reset_color();
-    } else {
-        set_color(36);
-        printf("A partida terminou empatada!\n");
-        reset_color();
+// Depois das colunas de texto o buffer não fica alinhado: cada valor passa
+// por uma variável local e é copiado com memcpy (como em saida_u32).
+#define EXPORTAR_COLUNA(s, cartas, m, campo, tipo_c)                          \
+    do {                                                                       \
+        char *v_ = saida_reservar(s, (size_t)(m) * sizeof(tipo_c));            \
+        for (int i_ = 0; i_ < (m); ++i_) {                                     \
+            tipo_c x_ = (tipo_c)(cartas)[i_].campo;                            \
+            memcpy(v_ + (size_t)i_ * sizeof(tipo_c), &x_, sizeof(tipo_c));     \
+        }                                                                      \
+        (s)->n += (size_t)(m) * sizeof(tipo_c);                                \
+    } while (0)
+
+static void exportar_coluna_texto(Saida *s, const char *(*texto)(const Carta *), const Carta *cartas, int m) {
+    uint32_t desloc = 0;
+    saida_u32(s, desloc);
+    for (int i = 0; i < m; ++i) { desloc += (uint32_t)strlen(texto(&cartas[i])); saida_u32(s, desloc); }
+    for (int i = 0; i < m; ++i) { const char *t = texto(&cartas[i]); saida_bytes(s, t, strlen(t)); }
+}
+
+static const char *texto_codigo(const Carta *c) { return c->codigo; }
+static const char *texto_nome(const Carta *c) { return c->nome_cidade; }
+
+static void exportar_cartas_colunas(Saida *s, const Carta *cartas, int n) {
+    exportar_colunas_cabecalho(s, (uint32_t)n, 10, EXPORTACAO_GRUPO);
+    exportar_coluna_esquema(s, "estado", 'c');
+    exportar_coluna_esquema(s, "codigo", 's');
+    exportar_coluna_esquema(s, "nome_cidade", 's');
+    exportar_coluna_esquema(s, "populacao", 'i');
+    exportar_coluna_esquema(s, "area", 'f');
+    exportar_coluna_esquema(s, "pib", 'f');
+    exportar_coluna_esquema(s, "num_pontos_turisticos", 'i');
+    exportar_coluna_esquema(s, "densidade_populacional", 'f');
+    exportar_coluna_esquema(s, "pib_per_capita", 'f');
+    exportar_coluna_esquema(s, "super_poder", 'f');
+    for (int g = 0; g < n; g += EXPORTACAO_GRUPO) {
+        const Carta *grupo = cartas + g;
+        int m = n - g < EXPORTACAO_GRUPO ? n - g : EXPORTACAO_GRUPO;
+        EXPORTAR_COLUNA(s, grupo, m, estado, char);
+        exportar_coluna_texto(s, texto_codigo, grupo, m);
+        exportar_coluna_texto(s, texto_nome, grupo, m);
+        EXPORTAR_COLUNA(s, grupo, m, populacao, int32_t);
+        EXPORTAR_COLUNA(s, grupo, m, area, float);
+        EXPORTAR_COLUNA(s, grupo, m, pib, float);
+        EXPORTAR_COLUNA(s, grupo, m, num_pontos_turisticos, int32_t);
+        EXPORTAR_COLUNA(s, grupo, m, densidade_populacional, float);
+        EXPORTAR_COLUNA(s, grupo, m, pib_per_capita, float);
+        EXPORTAR_COLUNA(s, grupo, m, super_poder, float);
     }
 }
 
-// Utilitários de entrada e validação
+static void exportar_estatisticas_formato(Saida *s, const Estatisticas *e, int formato) {
+    static const char *nomes[] = {"jogos_jogados", "vitorias_jogador1", "vitorias_jogador2",
+                                  "computador_vitorias", "empates"};
+    int valores[] = {e->jogos_jogados, e->vitorias[0], e->vitorias[1], e->computador_vitorias, e->empates};
+    if (formato == FORMATO_COLUNAS) {
+        exportar_colunas_cabecalho(s, 1, 5, 1);
+        for (int k = 0; k < 5; ++k) exportar_coluna_esquema(s, nomes[k], 'i');
+        for (int k = 0; k < 5; ++k) { int32_t v = valores[k]; saida_bytes(s, &v, sizeof(v)); }
+        return;
+    }
+    char *inicio = saida_reservar(s, EXPORTACAO_REGISTRO), *p = inicio;
+    if (formato == FORMATO_CSV) {
+        for (int k = 0; k < 5; ++k) { size_t L = strlen(nomes[k]); memcpy(p, nomes[k], L); p += L; *p++ = k < 4 ? ',' : '\n'; }
+        for (int k = 0; k < 5; ++k) { p = formatar_inteiro(p, valores[k]); *p++ = k < 4 ? ',' : '\n'; }
+    } else {
+        *p++ = '{';
+        for (int k = 0; k < 5; ++k) {
+            p = formatar_texto_json(p, nomes[k]);
+            *p++ = ':';
+            p = formatar_inteiro(p, valores[k]);
+            *p++ = k < 4 ? ',' : '}';
+        }
+        *p++ = '\n';
+    }
+    s->n += (size_t)(p - inicio);
+}
 
+// exportar_dados:
+// - Exporta o baralho (cartas != NULL) e/ou as estatísticas (estat != NULL)
+//   no formato FORMATO_*; no colunar cada um vira um bloco "STCC" próprio. arquivo "-" = saída padrão (para pipelines).
+// - Os derivados que faltarem são calculados antes. Não imprime nada em
+//   stdout (ela pode ser a própria saída). Retorna os bytes gravados ou -1 em erro.
+
+long long exportar_dados(const char *arquivo, int formato, Carta *cartas, int n, const Estatisticas *estat) {
+    int padrao = strcmp(arquivo, "-") == 0;
+    Saida s = {0};
+    s.f = padrao ? stdout : fopen(arquivo, "wb");
+    s.cap = EXPORTACAO_BUFFER;
+    s.buf = malloc(s.cap);
+    if (!s.f || !s.buf) {
+        if (s.f && !padrao) fclose(s.f);
+        free(s.buf);
+        return -1;
+    }
+    if (padrao) fflush(stdout); // o que já estava no buffer do stdio sai antes
+    else setvbuf(s.f, NULL, _IONBF, 0); // o buffer de Saida já agrupa as escritas
 
-//  limpar_buffer_stdin: Consome tudo até o fim da linha para evitar lixo no stdin.
+    if (cartas) {
+        garantir_derivados(cartas, n);
+        if (formato == FORMATO_COLUNAS) exportar_cartas_colunas(&s, cartas, n);
+        else exportar_cartas_texto(&s, cartas, n, formato);
+    }
+    if (estat) exportar_estatisticas_formato(&s, estat, formato);
+    saida_descarregar(&s);
+    if (padrao) { if (fflush(stdout) != 0) s.erro = 1; }
+    else if (fclose(s.f) != 0) s.erro = 1;
+    free(s.buf);
+    return s.erro ? -1 : s.gravados;
+}
 
-void limpar_buffer_stdin(void) {
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF) {}
+#ifdef __linux__
+// Servidor multiplayer (Linux):
+// Protocolo de linhas (cliente -> servidor):
+//   "1x1" ou "computador"        escolhe o modo (logo após conectar)
+//   "<n>"                         joga a carta n da mão (1-based)
+//   "desistir" / "sair"           mesmos comandos da partida no terminal
+// Servidor -> cliente: MODO?, AGUARDANDO, PARTIDA <mesa> JOGADOR <n>,
+//   TURNO <t>/<total>, CARTA <n> <super_poder> <nome>, ESCOLHA?,
+//   COMPUTADOR <n> <nome>, RESULTADO <sp_voce> <sp_oponente> VITORIA|DERROTA|EMPATE,
+//   RESULTADO DESISTENCIA VITORIA|DERROTA, FIM VITORIA|DERROTA|EMPATE <v_voce> <v_oponente>,
+//   FIM ABANDONADA, ERRO <motivo>.
+
+static void servidor_interesse(Servidor *sv, Conexao *c) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (c->n_saida > 0 ? EPOLLOUT : 0);
+    ev.data.fd = c->fd;
+    epoll_ctl(sv->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
 }
 
-// ler_inteiro_prompt: Lê uma linha do stdin e converte para inteiro com validação. 
-// Retorna 0 em caso de falha na leitura.
+static void servidor_fechar(Servidor *sv, Conexao *c);
+
+// servidor_descarregar: envia o que der sem bloquear; o resto espera EPOLLOUT.
+static void servidor_descarregar(Servidor *sv, Conexao *c) {
+    size_t enviado = 0;
+    while (enviado < c->n_saida) {
+        ssize_t r = send(c->fd, c->saida + enviado, c->n_saida - enviado, MSG_NOSIGNAL);
+        if (r > 0) { enviado += (size_t)r; continue; }
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        servidor_fechar(sv, c); // conexão quebrada
+        return;
+    }
+    if (enviado > 0) {
+        memmove(c->saida, c->saida + enviado, c->n_saida - enviado);
+        c->n_saida -= enviado;
+    }
+    // Encerra só a escrita: fechar com entrada não lida faria o sistema enviar
+    // RST e o cliente poderia perder a última linha (FIM). O close acontece
+    // quando o cliente fechar a conexão dele.
+    if (c->fechar && c->n_saida == 0 && !c->meio_fechada) {
+        shutdown(c->fd, SHUT_WR);
+        c->meio_fechada = 1;
+    }
+    servidor_interesse(sv, c);
+}
 
-int ler_inteiro_prompt(const char *prompt) {
-    char buf[64];
-    long v;
-    char *end;
-    while (1) {
-        printf("%s", prompt);
-        if (!fgets(buf, sizeof(buf), stdin)) return 0;
-        buf[strcspn(buf, "\n")] = '\0';
-        v = strtol(buf, &end, 10);
-        if (end != buf && *end == '\0') return (int)v;
-        printf("Entrada inválida. Tente novamente.\n");
+// servidor_enviar: acrescenta uma linha formatada à saída da conexão.
+static void servidor_enviar(Conexao *c, const char *fmt, ...) {
+    char linha[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(linha, sizeof(linha) - 1, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n > sizeof(linha) - 2) n = (int)sizeof(linha) - 2;
+    linha[n++] = '\n';
+    if (c->n_saida + (size_t)n > c->cap_saida) {
+        size_t nova = c->cap_saida ? c->cap_saida * 2 : 512;
+        while (nova < c->n_saida + (size_t)n) nova *= 2;
+        char *novo = realloc(c->saida, nova);
+        if (!novo) { c->fechar = 1; return; }
+        c->saida = novo;
+        c->cap_saida = nova;
     }
+    memcpy(c->saida + c->n_saida, linha, (size_t)n);
+    c->n_saida += (size_t)n;
 }
 
-// Funções de validação simples para os campos das cartas:
+static Conexao *servidor_conexao(Servidor *sv, int fd) {
+    return fd >= 0 && fd < sv->cap_conexoes ? sv->conexoes[fd] : NULL;
+}
 
-// Verifica e valida se caractere corresponde a A..Z (nao aceita minúsculas).
+// Envia a mão e o pedido de escolha ao jogador (humano) da mesa.
+static void mesa_pedir_escolha(Servidor *sv, Mesa *m, int j) {
+    Conexao *c = servidor_conexao(sv, m->fd[j]);
+    if (!c) return;
+    servidor_enviar(c, "TURNO %d/%d", m->turno + 1, CARTAS_POR_JOGADOR);
+    for (int i = 0; i < m->partida.restantes[j]; ++i) {
+        const Carta *carta = &sv->baralho[m->partida.mao[j][i]];
+        servidor_enviar(c, "CARTA %d %.2f %s", i + 1, carta->super_poder, carta->nome_cidade);
+    }
+    servidor_enviar(c, "ESCOLHA? (1-%d | desistir | sair)", m->partida.restantes[j]);
+}
 
-int valida_estado(char c) {
-    c = toupper((unsigned char)c);
-    return (c >= 'A' && c <= 'Z');
+// Gravador de replays:
+// thread_gravador_replays troca a fila cheia por uma vazia sob o lock e grava
+// o lote fora dele, então o laço epoll nunca espera pelo disco. A fila é
+// gravada ao atingir REPLAYS_LOTE ou a cada REPLAYS_INTERVALO_SEG segundos.
+
+static void *thread_gravador_replays(void *arg) {
+    GravadorReplays *g = (GravadorReplays *)arg;
+    Replay *lote = NULL;
+    int cap_lote = 0;
+    pthread_mutex_lock(&g->mutex);
+    for (;;) {
+        if (g->n < REPLAYS_LOTE && !g->encerrar) {
+            struct timespec limite = { time(NULL) + REPLAYS_INTERVALO_SEG, 0 };
+            pthread_cond_timedwait(&g->cond, &g->mutex, &limite);
+        }
+        if (g->n == 0) {
+            if (g->encerrar) break;
+            continue;
+        }
+        // Troca de buffers: o laço epoll continua enchendo a fila vazia
+        Replay *cheia = g->fila;
+        int n = g->n, cap_cheia = g->cap;
+        g->fila = lote;
+        g->cap = cap_lote;
+        g->n = 0;
+        lote = cheia;
+        cap_lote = cap_cheia;
+        pthread_mutex_unlock(&g->mutex);
+
+        int ok = gravar_replays(lote, n);
+
+        pthread_mutex_lock(&g->mutex);
+        if (!ok) g->perdidos += n;
+    }
+    pthread_mutex_unlock(&g->mutex);
+    free(lote);
+    return NULL;
 }
 
-// valida_codigo:
-// Verifica se a string tem formato: letra + digits (tamanho 2..4), loop para digitar novamente..
+static void gravador_iniciar(GravadorReplays *g) {
+    memset(g, 0, sizeof(*g));
+    pthread_mutex_init(&g->mutex, NULL);
+    pthread_cond_init(&g->cond, NULL);
+    g->ativo = pthread_create(&g->thread, NULL, thread_gravador_replays, g) == 0;
+}
 
-int valida_codigo(const char *s) {
-    size_t L = strlen(s);
-    if (L < 2 || L > 4) return 0;
-    if (!isalpha((unsigned char)s[0])) return 0;
-    for (size_t i = 1; i < L; ++i) if (!isdigit((unsigned char)s[i])) return 0;
-    return 1;
+// gravador_enfileirar: copia o replay para a fila (sem esperar pelo disco).
+// Sem a thread, ou se a fila não puder crescer, grava na hora.
+static void gravador_enfileirar(GravadorReplays *g, const Replay *r) {
+    if (g->ativo) {
+        pthread_mutex_lock(&g->mutex);
+        if (g->n == g->cap) {
+            int nova = g->cap ? g->cap * 2 : REPLAYS_LOTE;
+            Replay *novo = realloc(g->fila, (size_t)nova * sizeof(Replay));
+            if (novo) { g->fila = novo; g->cap = nova; }
+        }
+        int enfileirado = g->n < g->cap;
+        if (enfileirado) {
+            g->fila[g->n++] = *r;
+            if (g->n >= REPLAYS_LOTE) pthread_cond_signal(&g->cond);
+        }
+        pthread_mutex_unlock(&g->mutex);
+        if (enfileirado) return;
+    }
+    if (!gravar_replays(r, 1)) g->perdidos++;
 }
 
-// valida_nome: Garante que o nome não é vazio, loop para digitar novamente.
+// gravador_encerrar: grava o que restou na fila e finaliza a thread.
+static void gravador_encerrar(GravadorReplays *g) {
+    if (g->ativo) {
+        pthread_mutex_lock(&g->mutex);
+        g->encerrar = 1;
+        pthread_cond_signal(&g->cond);
+        pthread_mutex_unlock(&g->mutex);
+        pthread_join(g->thread, NULL);
+        g->ativo = 0;
+    }
+    pthread_mutex_destroy(&g->mutex);
+    pthread_cond_destroy(&g->cond);
+    free(g->fila);
+    if (g->perdidos > 0) printf("Aviso: %ld replays não puderam ser gravados.\n", g->perdidos);
+}
 
-int valida_nome(const char *nome) {
-    return nome != NULL && strlen(nome) > 0;
+// mesa_encerrar: enfileira o replay, avisa os jogadores e libera a mesa.
+static void mesa_encerrar(Servidor *sv, int id, int abortada) {
+    Mesa *m = &sv->mesas[id];
+    m->rep.resultado = (unsigned char)(abortada ? RESULTADO_ABORTADA : partida_indices_resultado(&m->partida));
+    gravador_enfileirar(&sv->gravador, &m->rep);
+    for (int j = 0; j < MAX_JOGADORES; ++j) {
+        Conexao *c = servidor_conexao(sv, m->fd[j]);
+        if (!c) continue;
+        if (abortada) servidor_enviar(c, "FIM ABANDONADA");
+        else {
+            int v = m->partida.vitorias[j], o = m->partida.vitorias[1 - j];
+            servidor_enviar(c, "FIM %s %d %d", v > o ? "VITORIA" : v < o ? "DERROTA" : "EMPATE", v, o);
+        }
+        c->mesa = -1;
+        c->fechar = 1;
+    }
+    m->ativa = 0;
+    sv->mesas_livres[sv->n_livres++] = id;
+    if (!abortada) sv->partidas_concluidas++;
 }
 
-// valida_populacao / valida_area / valida_pib / valida_pontos:
-// Checagens simples de intervalo, loop para digitar novamente..
+// mesa_avancar: resolve o turno quando as ações necessárias chegaram.
+static void mesa_avancar(Servidor *sv, int id) {
+    Mesa *m = &sv->mesas[id];
+    for (int j = 0; j < MAX_JOGADORES; ++j)
+        if (m->pronto[j] && m->cmd[j] == CMD_SAIR) { mesa_encerrar(sv, id, 1); return; }
+
+    int desistente = -1;
+    if (m->pronto[0] && m->cmd[0] == CMD_DESISTIR) desistente = 0;
+    else if (m->pronto[1] && m->cmd[1] == CMD_DESISTIR) desistente = 1;
+
+    if (m->modo_computador) {
+        if (!m->pronto[0]) return;
+        registrar_acao_replay(&m->rep, m->turno, 0, m->escolha[0], m->cmd[0]);
+        if (desistente < 0) {
+            // Mesma ordem da partida ao vivo: o computador sorteia depois do humano
+            m->escolha[1] = (int)(rng_proximo(&m->partida.rng) % (uint32_t)m->partida.restantes[1]);
+            registrar_acao_replay(&m->rep, m->turno, 1, m->escolha[1], CMD_ESCOLHA);
+            Conexao *c = servidor_conexao(sv, m->fd[0]);
+            if (c) servidor_enviar(c, "COMPUTADOR %d %s", m->escolha[1] + 1,
+                                   sv->baralho[m->partida.mao[1][m->escolha[1]]].nome_cidade);
+        }
+    } else {
+        if (desistente < 0 && !(m->pronto[0] && m->pronto[1])) return;
+        // Desistência do jogador 2 equivale a: jogador 1 escolheu, jogador 2 desistiu
+        registrar_acao_replay(&m->rep, m->turno, 0, m->pronto[0] ? m->escolha[0] : 0,
+                              desistente == 0 ? CMD_DESISTIR : CMD_ESCOLHA);
+        if (desistente != 0) registrar_acao_replay(&m->rep, m->turno, 1, m->escolha[1], m->cmd[1]);
+    }
 
-int valida_populacao(int p) { return p > 0; }
-int valida_area(float a) { return a > 0.0f; }
-int valida_pib(float p) { return p > 0.0f; }
-int valida_pontos(int n) { return n >= 0; }
+    float sp[MAX_JOGADORES] = {0.0f, 0.0f};
+    if (desistente < 0)
+        for (int j = 0; j < MAX_JOGADORES; ++j) sp[j] = sv->baralho[m->partida.mao[j][m->escolha[j]]].super_poder;
+    int vencedor = partida_indices_jogar(&m->partida, sv->baralho, m->escolha, desistente);
+
+    for (int j = 0; j < MAX_JOGADORES; ++j) {
+        Conexao *c = servidor_conexao(sv, m->fd[j]);
+        if (!c) continue;
+        const char *res = vencedor < 0 ? "EMPATE" : vencedor == j ? "VITORIA" : "DERROTA";
+        if (desistente >= 0) servidor_enviar(c, "RESULTADO DESISTENCIA %s", res);
+        else servidor_enviar(c, "RESULTADO %.2f %.2f %s", sp[j], sp[1 - j], res);
+    }
 
-// Cálculos derivados e normalização
+    m->turno++;
+    m->pronto[0] = m->pronto[1] = 0;
+    if (m->turno >= CARTAS_POR_JOGADOR) { mesa_encerrar(sv, id, 0); return; }
+    for (int j = 0; j < MAX_JOGADORES; ++j) mesa_pedir_escolha(sv, m, j);
+}
 
-// calcula_campos_derivados:
+// mesa_abrir: cria uma mesa, sorteia a semente e distribui as cartas.
+static int mesa_abrir(Servidor *sv, int fd0, int fd1, int modo_computador) {
+    int id;
+    if (sv->n_livres > 0) id = sv->mesas_livres[--sv->n_livres];
+    else {
+        if (sv->n_mesas == sv->cap_mesas) {
+            int nova = sv->cap_mesas ? sv->cap_mesas * 2 : 256;
+            Mesa *novas = realloc(sv->mesas, (size_t)nova * sizeof(Mesa));
+            if (!novas) return -1;
+            int *livres = realloc(sv->mesas_livres, (size_t)nova * sizeof(int));
+            if (!livres) { sv->mesas = novas; return -1; }
+            sv->mesas = novas;
+            sv->mesas_livres = livres;
+            sv->cap_mesas = nova;
+        }
+        id = sv->n_mesas++;
+    }
+    Mesa *m = &sv->mesas[id];
+    memset(m, 0, sizeof(*m));
+    m->ativa = 1;
+    m->modo_computador = modo_computador;
+    m->fd[0] = fd0;
+    m->fd[1] = fd1;
+    uint32_t semente = rng_proximo(&rng_sessao);
+    iniciar_replay(&m->rep, sv->baralho, sv->n_cartas, semente, modo_computador);
+    partida_indices_iniciar(&m->partida, sv->n_cartas, semente, sv->ordem, sv->distribuicao);
+
+    for (int j = 0; j < MAX_JOGADORES; ++j) {
+        Conexao *c = servidor_conexao(sv, m->fd[j]);
+        if (!c) continue;
+        c->estado = CONEXAO_JOGANDO;
+        c->mesa = id;
+        c->jogador = j;
+        c->oponente_fd = m->fd[1 - j];
+        servidor_enviar(c, "PARTIDA %d JOGADOR %d", id, j + 1);
+        mesa_pedir_escolha(sv, m, j);
+    }
+    return id;
+}
 
-// A partir dos atributos básicos calcula:
-// - densidade_populacional
-// - pib_per_capita
-// - super_poder (valor bruto)
+// servidor_linha: trata uma linha recebida conforme o estado da conexão.
+static void servidor_linha(Servidor *sv, Conexao *c, char *linha) {
+    size_t L = strlen(linha);
+    while (L > 0 && (linha[L - 1] == '\r' || linha[L - 1] == ' ')) linha[--L] = '\0';
+
+    if (c->fechar) return; // encerrando: entradas tardias são ignoradas
+    if (c->estado == CONEXAO_MODO) {
+        if (strcmp(linha, "sair") == 0) { c->fechar = 1; return; }
+        if (strcmp(linha, "computador") == 0) {
+            if (mesa_abrir(sv, c->fd, -1, 1) < 0) servidor_enviar(c, "ERRO servidor sem memória");
+        } else if (strcmp(linha, "1x1") == 0) {
+            Conexao *outro = servidor_conexao(sv, sv->aguardando_fd);
+            if (outro && outro != c && outro->estado == CONEXAO_AGUARDANDO) {
+                sv->aguardando_fd = -1;
+                if (mesa_abrir(sv, outro->fd, c->fd, 0) < 0) servidor_enviar(c, "ERRO servidor sem memória");
+            } else {
+                sv->aguardando_fd = c->fd;
+                c->estado = CONEXAO_AGUARDANDO;
+                servidor_enviar(c, "AGUARDANDO");
+            }
+        } else {
+            servidor_enviar(c, "ERRO modo inválido");
+            servidor_enviar(c, "MODO? (1x1 | computador)");
+        }
+        return;
+    }
+    if (c->estado == CONEXAO_AGUARDANDO) {
+        if (strcmp(linha, "sair") == 0) { sv->aguardando_fd = -1; c->fechar = 1; }
+        else servidor_enviar(c, "AGUARDANDO");
+        return;
+    }
 
-void calcula_campos_derivados(struct Carta *c) {
-    if (c->area > 0.0f)
-        c->densidade_populacional = (float)c->populacao / c->area;
-    else
-        c->densidade_populacional = 0.0f;
-    if (c->populacao > 0)
-        c->pib_per_capita = (c->pib * 1e9f) / c->populacao; // reais por habitante
-    else
-        c->pib_per_capita = 0.0f;
+    if (c->mesa < 0) return; // mesa já encerrada; conexão só aguarda o cliente fechar
+    Mesa *m = &sv->mesas[c->mesa];
+    int j = c->jogador;
+    if (m->pronto[j]) { servidor_enviar(c, "ERRO aguarde o oponente"); return; }
+    char *end;
+    long v = strtol(linha, &end, 10);
+    if (strcmp(linha, "sair") == 0) { m->cmd[j] = CMD_SAIR; m->escolha[j] = 0; }
+    else if (strcmp(linha, "desistir") == 0) { m->cmd[j] = CMD_DESISTIR; m->escolha[j] = 0; }
+    else if (end != linha && *end == '\0' && v >= 1 && v <= m->partida.restantes[j]) {
+        m->cmd[j] = CMD_ESCOLHA;
+        m->escolha[j] = (int)(v - 1);
+    } else {
+        servidor_enviar(c, "ERRO escolha inválida");
+        servidor_enviar(c, "ESCOLHA? (1-%d | desistir | sair)", m->partida.restantes[j]);
+        return;
+    }
+    m->pronto[j] = 1;
+    mesa_avancar(sv, c->mesa);
+}
 
-    // super_poder inicial (soma simples dos campos)
-    c->super_poder = (float)c->populacao + c->area + c->pib + (float)c->num_pontos_turisticos + c->densidade_populacional + c->pib_per_capita;
+// servidor_fechar: desconexão equivale a "sair" na mesa em andamento.
+static void servidor_fechar(Servidor *sv, Conexao *c) {
+    int fd = c->fd;
+    if (sv->aguardando_fd == fd) sv->aguardando_fd = -1;
+    if (c->mesa >= 0 && sv->mesas[c->mesa].ativa) {
+        Mesa *m = &sv->mesas[c->mesa];
+        m->fd[c->jogador] = -1;
+        m->pronto[c->jogador] = 1;
+        m->cmd[c->jogador] = CMD_SAIR;
+        int id = c->mesa;
+        c->mesa = -1;
+        mesa_avancar(sv, id);
+        // o oponente recebeu FIM e está marcado para fechar; descarrega sua saída
+        for (int j = 0; j < MAX_JOGADORES; ++j) {
+            Conexao *o = servidor_conexao(sv, m->fd[j]);
+            if (o && o != c) servidor_descarregar(sv, o);
+        }
+    }
+    epoll_ctl(sv->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    sv->conexoes[fd] = NULL;
+    free(c->saida);
+    free(c);
 }
 
-// Calcula o Super Poder sem normalização:
-//  soma direta dos componentes numéricos (população, área, PIB, número de pontos turísticos,
-//  PIB per capita e inverso da densidade). Mantém proteção contra divisão por zero.
+static void servidor_aceitar(Servidor *sv) {
+    for (;;) {
+        int fd = accept(sv->escuta_fd, NULL, NULL);
+        if (fd < 0) return; // EAGAIN: não há mais conexões pendentes
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (fd >= sv->cap_conexoes) {
+            int nova = sv->cap_conexoes ? sv->cap_conexoes : 1024;
+            while (nova <= fd) nova *= 2;
+            Conexao **novo = realloc(sv->conexoes, (size_t)nova * sizeof(Conexao *));
+            if (!novo) { close(fd); continue; }
+            memset(novo + sv->cap_conexoes, 0, (size_t)(nova - sv->cap_conexoes) * sizeof(Conexao *));
+            sv->conexoes = novo;
+            sv->cap_conexoes = nova;
+        }
+        Conexao *c = calloc(1, sizeof(Conexao));
+        if (!c) { close(fd); continue; }
+        c->fd = fd;
+        c->mesa = -1;
+        c->oponente_fd = -1;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(sv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) { close(fd); free(c); continue; }
+        sv->conexoes[fd] = c;
+        servidor_enviar(c, "SUPER TRUNFO C");
+        servidor_enviar(c, "MODO? (1x1 | computador)");
+        servidor_descarregar(sv, c);
+    }
+}
 
-void calcular_super_poder_normalizado(Carta *cartas, int n) {
-     if (n <= 0) return;
-     for (int i = 0; i < n; ++i) {
-          float dens = cartas[i].densidade_populacional;
-          // evita divisão por zero; densidades muito pequenas geram inverso grande,
-          // Aqui mantemos o comportamento de usar o inverso
-          float inv_dens = 0.0f;
-          if (dens > 1e-9f) inv_dens = 1.0f / dens;
-
-          float soma = 0.0f;
-          soma += (float)cartas[i].populacao;                    // população (valor bruto)
-          soma += cartas[i].area;                                // área em km²
-          soma += cartas[i].pib;                                 // PIB em bilhões
-          soma += (float)cartas[i].num_pontos_turisticos;        // pontos turísticos
-          soma += cartas[i].pib_per_capita;                      // PIB per capita em reais
-          soma += inv_dens;                                      // inverso da densidade
-
-          cartas[i].super_poder = soma;
-     }
+// servidor_ler: lê o que houver e processa cada linha completa.
+static void servidor_ler(Servidor *sv, Conexao *c) {
+    char buf[4096];
+    for (;;) {
+        ssize_t r = recv(c->fd, buf, sizeof(buf), 0);
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            servidor_fechar(sv, c);
+            return;
+        }
+        if (r < 0) break;
+        for (ssize_t i = 0; i < r; ++i) {
+            if (buf[i] == '\n') {
+                c->entrada[c->n_entrada] = '\0';
+                c->n_entrada = 0;
+                servidor_linha(sv, c, c->entrada);
+            } else if (c->n_entrada + 1 < sizeof(c->entrada)) {
+                c->entrada[c->n_entrada++] = buf[i];
+            }
+        }
+    }
+    // Descarrega esta conexão e a do oponente, que pode ter recebido o
+    // resultado do turno ou o FIM (a mesa já pode ter sido liberada aqui).
+    // Se o fd do oponente foi reaproveitado, descarregar outra conexão é inócuo.
+    int oponente_fd = c->oponente_fd;
+    servidor_descarregar(sv, c);
+    Conexao *o = servidor_conexao(sv, oponente_fd);
+    if (o) servidor_descarregar(sv, o);
 }
 
-// Funções de arquivo:
-// salvar_cartas:
-// Grava o número de cartas seguido do array de cartas em modo binário.
-void salvar_cartas(const Carta *cartas, int n) {
-    FILE *f = fopen(ARQUIVO_CARTAS, "wb");
-    if (!f) { printf("Erro ao salvar cartas!\n"); return; }
-    fwrite(&n, sizeof(int), 1, f);
-    fwrite(cartas, sizeof(Carta), n, f);
-    fclose(f);
-    set_color(32);
-    printf("Cartas salvas com sucesso!\n");
-    reset_color();
+// servidor_escutar: abre o socket de escuta. Endereço só com dígitos = porta
+// TCP; qualquer outro texto = caminho de socket Unix.
+static int servidor_escutar(const char *endereco) {
+    int so_digitos = endereco[0] != '\0';
+    for (const char *p = endereco; *p; ++p) if (!isdigit((unsigned char)*p)) so_digitos = 0;
+    int fd;
+    if (so_digitos) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        int um = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &um, sizeof(um));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons((uint16_t)atoi(endereco));
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) { close(fd); return -1; }
+    } else {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", endereco);
+        unlink(endereco);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) { close(fd); return -1; }
+    }
+    if (listen(fd, 4096) != 0) { close(fd); return -1; }
+    return fd;
 }
 
-// carregar_cartas:
-// Lê o número de cartas e depois as cartas do arquivo binário.
-// Retorna a quantidade de cartas lidas (0 se falha ou não existir).
+// SIGINT/SIGTERM encerram o laço para que os replays na fila sejam gravados.
+static volatile sig_atomic_t servidor_parar = 0;
 
-int carregar_cartas(Carta *cartas) {
-    FILE *f = fopen(ARQUIVO_CARTAS, "rb");
-    if (!f) return 0;
-    int n = 0;
-    if (fread(&n, sizeof(int), 1, f) != 1) { fclose(f); return 0; }
-    if (n < 0 || n > MAX_CARTAS) { fclose(f); return 0; }
-    if (fread(cartas, sizeof(Carta), n, f) != (size_t)n) { fclose(f); return 0; }
-    fclose(f);
-    return n;
+static void servidor_sinal(int sinal) {
+    (void)sinal;
+    servidor_parar = 1;
+}
+
+// executar_servidor:
+// - Modo --servidor [porta|caminho]: carrega cartas.bin e atende mesas 1x1
+//   e 1xComputador até ser interrompido (Ctrl+C ou SIGTERM grava os replays
+//   pendentes antes de sair). Retorna 1 em erro de inicialização.
+
+int executar_servidor(const char *endereco) {
+    Servidor sv;
+    memset(&sv, 0, sizeof(sv));
+    sv.aguardando_fd = -1;
+
+    Baralho b = {0};
+    carregar_cartas(&b);
+    if (b.n < CARTAS_POR_JOGADOR * MAX_JOGADORES) {
+        printf("Cadastre pelo menos %d cartas para iniciar o servidor!\n", CARTAS_POR_JOGADOR * MAX_JOGADORES);
+        baralho_liberar(&b);
+        return 1;
+    }
+    garantir_derivados(b.cartas, b.n);
+    sv.baralho = b.cartas;
+    sv.n_cartas = b.n;
+    sv.ordem = malloc((size_t)b.n * sizeof(int));
+    Distribuicao distribuicao;
+    if (regras_distribuicao.equilibrada) {
+        if (!preparar_distribuicao(&distribuicao, b.cartas, b.n, &regras_distribuicao)) {
+            printf("Memória insuficiente para preparar a distribuição.\n");
+            baralho_liberar(&b);
+            free(sv.ordem);
+            return 1;
+        }
+        sv.distribuicao = &distribuicao;
+    }
+
+    // Cada mesa 1x1 usa duas conexões: sobe o limite de descritores ao máximo permitido
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    sv.escuta_fd = servidor_escutar(endereco);
+    sv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (!sv.ordem || sv.escuta_fd < 0 || sv.epoll_fd < 0) {
+        printf("Erro ao iniciar o servidor em %s.\n", endereco);
+        if (sv.distribuicao) liberar_distribuicao(sv.distribuicao);
+        baralho_liberar(&b);
+        free(sv.ordem);
+        return 1;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = sv.escuta_fd;
+    epoll_ctl(sv.epoll_fd, EPOLL_CTL_ADD, sv.escuta_fd, &ev);
+    gravador_iniciar(&sv.gravador);
+    signal(SIGINT, servidor_sinal);
+    signal(SIGTERM, servidor_sinal);
+    printf("Servidor Super Trunfo em %s com %d cartas.\n", endereco, b.n);
+    fflush(stdout);
+
+    struct epoll_event eventos[256];
+    while (!servidor_parar) {
+        int n = epoll_wait(sv.epoll_fd, eventos, 256, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        for (int i = 0; i < n; ++i) {
+            int fd = eventos[i].data.fd;
+            if (fd == sv.escuta_fd) { servidor_aceitar(&sv); continue; }
+            Conexao *c = servidor_conexao(&sv, fd);
+            if (!c) continue; // fechada por um evento anterior deste lote
+            if (eventos[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) servidor_ler(&sv, c);
+            else if (eventos[i].events & EPOLLOUT) servidor_descarregar(&sv, c);
+        }
+    }
+    close(sv.epoll_fd);
+    close(sv.escuta_fd);
+    gravador_encerrar(&sv.gravador);
+    printf("Servidor encerrado: %ld partidas concluídas.\n", sv.partidas_concluidas);
+    if (sv.distribuicao) liberar_distribuicao(sv.distribuicao);
+    baralho_liberar(&b);
+    free(sv.ordem);
+    return 0;
 }
+#endif
 
 // Cadastro, exibição e remoção de cartas:
 // cadastrar_carta:
@@ -347,9 +5746,7 @@ void cadastrar_carta(Carta *c) {
 
     // Estado
     while (1) {
-        printf("Informe a letra do Estado (A-Z) ou 'sair': ");
-        if (!fgets(buf, sizeof(buf), stdin)) return;
-        buf[strcspn(buf, "\n")] = '\0';
+        if (!ler_texto_prompt("Informe a letra do Estado (A-Z) ou 'sair': ", buf, sizeof(buf))) return;
         if (strcmp(buf, "sair") == 0) return;
         if (strlen(buf) == 1 && valida_estado(buf[0])) {
             c->estado = toupper((unsigned char)buf[0]);
@@ -360,9 +5757,7 @@ void cadastrar_carta(Carta *c) {
 
     // Código
     while (1) {
-        printf("Informe o Código da Carta (ex: A01) ou 'sair': ");
-        if (!fgets(buf, sizeof(buf), stdin)) return;
-        buf[strcspn(buf, "\n")] = '\0';
+        if (!ler_texto_prompt("Informe o Código da Carta (ex: A01) ou 'sair': ", buf, sizeof(buf))) return;
         if (strcmp(buf, "sair") == 0) return;
         if (valida_codigo(buf)) {
             /* copia segura limitando ao tamanho do destino menos 1 e garantindo '\0' */
@@ -374,9 +5769,7 @@ void cadastrar_carta(Carta *c) {
 
     // Nome da cidade
     while (1) {
-        printf("Informe o Nome da Cidade ou 'sair': ");
-        if (!fgets(buf, sizeof(buf), stdin)) return;
-        buf[strcspn(buf, "\n")] = '\0';
+        if (!ler_texto_prompt("Informe o Nome da Cidade ou 'sair': ", buf, sizeof(buf))) return;
         if (strcmp(buf, "sair") == 0) return;
         if (valida_nome(buf)) {
             /* copiar de forma segura garantindo terminação nula e evitando warnings */
@@ -389,9 +5782,7 @@ void cadastrar_carta(Carta *c) {
 
     // População
     while (1) {
-        printf("Informe a População ou 'sair': ");
-        if (!fgets(buf, sizeof(buf), stdin)) return;
-        buf[strcspn(buf, "\n")] = '\0';
+        if (!ler_texto_prompt("Informe a População ou 'sair': ", buf, sizeof(buf))) return;
         if (strcmp(buf, "sair") == 0) return;
         char *end;
         long v = strtol(buf, &end, 10);
@@ -404,9 +5795,7 @@ void cadastrar_carta(Carta *c) {
 
     // Área
     while (1) {
-        printf("Informe a Área (km²) ou 'sair': ");
-        if (!fgets(buf, sizeof(buf), stdin)) return;
-        buf[strcspn(buf, "\n")] = '\0';
+        if (!ler_texto_prompt("Informe a Área (km²) ou 'sair': ", buf, sizeof(buf))) return;
         if (strcmp(buf, "sair") == 0) return;
         char *end;
         float v = strtof(buf, &end);
@@ -419,9 +5808,7 @@ void cadastrar_carta(Carta *c) {
 
     // PIB
     while (1) {
-        printf("Informe o PIB (em bilhões de reais) ou 'sair': ");
-        if (!fgets(buf, sizeof(buf), stdin)) return;
-        buf[strcspn(buf, "\n")] = '\0';
+        if (!ler_texto_prompt("Informe o PIB (em bilhões de reais) ou 'sair': ", buf, sizeof(buf))) return;
         if (strcmp(buf, "sair") == 0) return;
         char *end;
         float v = strtof(buf, &end);
@@ -434,9 +5821,7 @@ void cadastrar_carta(Carta *c) {
 
     // Pontos turísticos
     while (1) {
-        printf("Informe o Número de Pontos Turísticos ou 'sair': ");
-        if (!fgets(buf, sizeof(buf), stdin)) return;
-        buf[strcspn(buf, "\n")] = '\0';
+        if (!ler_texto_prompt("Informe o Número de Pontos Turísticos ou 'sair': ", buf, sizeof(buf))) return;
         if (strcmp(buf, "sair") == 0) return;
         char *end;
         long v = strtol(buf, &end, 10);
@@ -447,15 +5832,15 @@ void cadastrar_carta(Carta *c) {
         printf("Número inválido.\n");
     }
 
-    // Recalcula campos derivados ao final do cadastro
-    calcula_campos_derivados(c);
+    // Campos originais mudaram: derivados serão recalculados no próximo acesso
+    invalidar_derivados(c);
     printf("Carta cadastrada: %s (%s)\n", c->nome_cidade, c->codigo);
 }
 
 // exibir_carta:
 // - Mostra todos os atributos (originais e derivados) de uma carta.
 
-void exibir_carta(const Carta *c) {
+void exibir_carta(Carta *c) {
     printf("-----------------------------------\n");
     printf("Estado: %c\n", c->estado);
     printf("Código: %s\n", c->codigo);
@@ -464,56 +5849,69 @@ void exibir_carta(const Carta *c) {
     printf("Área: %.2f km²\n", c->area);
     printf("PIB: %.2f bilhões de reais\n", c->pib);
     printf("Número de Pontos Turísticos: %d\n", c->num_pontos_turisticos);
-    printf("Densidade Populacional: %.2f hab/km²\n", c->densidade_populacional);
-    printf("PIB per capita: R$ %.2f\n", c->pib_per_capita);
-    printf("Super poder: %.2f\n", c->super_poder);
+    printf("Densidade Populacional: %.2f hab/km²\n", carta_densidade(c));
+    printf("PIB per capita: R$ %.2f\n", carta_pib_per_capita(c));
+    printf("Super poder: %.2f\n", carta_super_poder(c));
     printf("-----------------------------------\n");
 }
 
 // exibir_cartas_resumido:
 // - Lista as cartas cadastradas em forma resumida com índice e super_poder.
 
-void exibir_cartas_resumido(const Carta *cartas, int n) {
+void exibir_cartas_resumido(Carta *cartas, int n) {
     if (n == 0) {
         printf("Nenhuma carta cadastrada.\n");
         return;
     }
     printf("Cartas cadastradas:\n");
     for (int i = 0; i < n; ++i) {
-        printf("%d - %s | Super poder: %.2f\n", i+1, cartas[i].nome_cidade, cartas[i].super_poder);
+        printf("%d - %s | Super poder: %.2f\n", i+1, cartas[i].nome_cidade, carta_super_poder(&cartas[i]));
     }
 }
 
 // apagar_carta:
 // - Permite ao usuário escolher uma carta por índice e a remove do array,
 // - compactando o vetor e decrementando o contador.
+// - Retorna o índice da carta apagada, ou -1 se nada foi apagado.
 
-void apagar_carta(Carta *cartas, int *n_cartas) {
+int apagar_carta(Carta *cartas, int *n_cartas) {
     if (*n_cartas == 0) {
         printf("Nenhuma carta para apagar.\n");
-        return;
+        return -1;
     }
     while (1) {
         printf("Escolha a carta para apagar (1-%d) ou 0 para voltar: ", *n_cartas);
         int opt = ler_inteiro_prompt("");
-        if (opt == 0) return;
+        if (opt == 0) return -1;
         if (opt >= 1 && opt <= *n_cartas) {
             for (int i = opt-1; i < *n_cartas - 1; ++i) cartas[i] = cartas[i+1];
             (*n_cartas)--;
             printf("Carta apagada.\n");
-            return;
+            return opt - 1;
         }
         printf("Opção inválida.\n");
     }
 }
 
 // Embaralhar, distribuir e "animação":
+// rng_proximo:
+// - Gerador xorshift32. Usado no lugar de rand() para que a mesma semente
+//   produza a mesma partida em qualquer plataforma (necessário para o replay).
+
+uint32_t rng_proximo(uint32_t *estado) {
+    uint32_t x = *estado ? *estado : 2463534242u; // estado 0 travaria o gerador
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *estado = x;
+}
+
 // - Embaralha o array de cartas usando Fisher-Yates.
 
-void embaralhar_cartas(Carta *cartas, int n) {
+void embaralhar_cartas(Carta *cartas, int n, uint32_t *rng) {
     if (n <= 1) return;
     for (int i = n - 1; i > 0; --i) {
-        int j = rand() % (i + 1);
+        int j = (int)(rng_proximo(rng) % (uint32_t)(i + 1));
         Carta tmp = cartas[i];
         cartas[i] = cartas[j];
         cartas[j] = tmp;
@@ -569,7 +5967,7 @@ void animacao_entrega_cartas(int jogador, int carta_idx, int modo_computador) {
 
 // void para batalha jogador x jogador:
 // - Inicia uma partida entre dois jogadores humanos.
-void jogar_partida_1x1(Carta *baralho, int n_cartas, Estatisticas *estat) {
+void jogar_partida_1x1(Carta *baralho, int n_cartas, const Distribuicao *dist, Estatisticas *estat) {
     if (n_cartas < CARTAS_POR_JOGADOR * MAX_JOGADORES) {
         printf("Não há cartas suficientes para iniciar a partida.\n");
         return;
@@ -583,9 +5981,17 @@ void jogar_partida_1x1(Carta *baralho, int n_cartas, Estatisticas *estat) {
         jogadores[i].empates = 0;
     }
 
-    // Embaralha e distribui cartas
-    embaralhar_cartas(baralho, n_cartas);
-    distribuir_cartas(baralho, n_cartas, jogadores, 0); // modo 1x1
+    // Derivados do baralho inteiro só são calculados quando há partida
+    garantir_derivados(baralho, n_cartas);
+
+    // Embaralha uma cópia (o baralho cadastrado mantém a ordem) e distribui cartas
+    Replay rep;
+    uint32_t rng = rng_proximo(&rng_sessao);
+    iniciar_replay(&rep, baralho, n_cartas, rng, 0);
+    Carta *mesa = montar_mesa(baralho, n_cartas, dist, &rng);
+    if (!mesa) { printf("Memória insuficiente para iniciar a partida.\n"); return; }
+    distribuir_cartas(mesa, CARTAS_POR_JOGADOR * MAX_JOGADORES, jogadores, 0); // modo 1x1
+    free(mesa);
 
     // Estatísticas do turno
     int vitorias_turno[2] = {0, 0};
@@ -600,13 +6006,15 @@ void jogar_partida_1x1(Carta *baralho, int n_cartas, Estatisticas *estat) {
         // Jogador 1 escolhe uma carta
         int cmd0 = 0;
         int escolha1 = escolher_carta_comandos(&jogadores[0], 0, &cmd0);
-        if (cmd0 == 2) { // voltar -> abortar partida
-            limpar_buffer_stdin();
+        registrar_acao_replay(&rep, turno, 0, escolha1, cmd0);
+        if (cmd0 == CMD_SAIR) { // voltar -> abortar partida
+            rep.resultado = RESULTADO_ABORTADA;
+            gravar_replay(&rep);
             memset(estat, 0, sizeof(*estat));
             printf("Retornando ao menu principal. Estatísticas da partida atual descartadas.\n");
             return;
         }
-        if (cmd0 == 1) {
+        if (cmd0 == CMD_DESISTIR) {
             // Jogador 1 desistiu do turno
             printf("Jogador 1 desistiu do turno! Jogador 2 vence este turno.\n");
             vitorias_turno[1]++;
@@ -618,13 +6026,15 @@ void jogar_partida_1x1(Carta *baralho, int n_cartas, Estatisticas *estat) {
         // Jogador 2 escolhe uma carta
         int cmd1 = 0;
         int escolha2 = escolher_carta_comandos(&jogadores[1], 1, &cmd1);
-        if (cmd1 == 2) { // voltar -> abortar partida
-            limpar_buffer_stdin();
+        registrar_acao_replay(&rep, turno, 1, escolha2, cmd1);
+        if (cmd1 == CMD_SAIR) { // voltar -> abortar partida
+            rep.resultado = RESULTADO_ABORTADA;
+            gravar_replay(&rep);
             memset(estat, 0, sizeof(*estat));
             printf("Retornando ao menu principal. Estatísticas da partida atual descartadas.\n");
             return;
         }
-        if (cmd1 == 1) {
+        if (cmd1 == CMD_DESISTIR) {
             // Jogador 2 desistiu do turno
             printf("Jogador 2 desistiu do turno! Jogador 1 vence este turno.\n");
             vitorias_turno[0]++;
@@ -634,11 +6044,9 @@ void jogar_partida_1x1(Carta *baralho, int n_cartas, Estatisticas *estat) {
         }
 
         // Ambos escolheram normalmente -> compara escolhas
-        float sp1 = jogadores[0].cartas[escolha1].super_poder;
-        float sp2 = jogadores[1].cartas[escolha2].super_poder;
-
         // Exibe resultado do turno
-        exibir_resultado_turno(sp1, sp2, &vitorias_turno[0], &vitorias_turno[1], &empates_turno);
+        exibir_resultado_turno(&jogadores[0].cartas[escolha1], &jogadores[1].cartas[escolha2],
+                               &vitorias_turno[0], &vitorias_turno[1], &empates_turno);
 
         // Remove cartas jogadas (remover maior índice primeiro)
         if (escolha1 > escolha2) {
@@ -650,6 +6058,12 @@ void jogar_partida_1x1(Carta *baralho, int n_cartas, Estatisticas *estat) {
         }
     }
 
+    // Grava o replay da partida
+    if (vitorias_turno[0] > vitorias_turno[1]) rep.resultado = RESULTADO_JOGADOR1;
+    else if (vitorias_turno[1] > vitorias_turno[0]) rep.resultado = RESULTADO_JOGADOR2;
+    else rep.resultado = RESULTADO_EMPATE;
+    gravar_replay(&rep);
+
     // Atualiza estatísticas gerais
     estat->jogos_jogados++;
     if (vitorias_turno[0] > vitorias_turno[1]) estat->vitorias[0]++;
@@ -763,12 +6177,13 @@ void remover_carta(Jogador *j, int idx) {
 // - Compara os super_poderes das duas cartas, exibe resultado e
 // - Ajusta contadores de vitórias/empates para o turno.
 
-void exibir_resultado_turno(float sp1, float sp2, int *v1, int *v2, int *empates) {
-    printf("Super poder Jogador 1: %.2f | Super poder Jogador 2: %.2f\n", sp1, sp2);
-    if (sp1 > sp2) {
+void exibir_resultado_turno(const Carta *c1, const Carta *c2, int *v1, int *v2, int *empates) {
+    printf("Super poder Jogador 1: %.2f | Super poder Jogador 2: %.2f\n", c1->super_poder, c2->super_poder);
+    int r = comparar_super_poder(c1, c2);
+    if (r > 0) {
         printf("Jogador 1 venceu o turno!\n");
         (*v1)++;
-    } else if (sp2 > sp1) {
+    } else if (r < 0) {
         printf("Jogador 2 venceu o turno!\n");
         (*v2)++;
     } else {
@@ -780,14 +6195,15 @@ void exibir_resultado_turno(float sp1, float sp2, int *v1, int *v2, int *empates
 // exibir_resultado_turno_computador:
 // - Versão especial para modo computador que mostra "Computador" em vez de "Jogador 2"
 
-void exibir_resultado_turno_computador(float sp1, float sp2, int *v1, int *v2, int *empates) {
-    printf("Super poder Jogador 1: %.2f | Super poder Computador: %.2f\n", sp1, sp2);
-    if (sp1 > sp2) {
+void exibir_resultado_turno_computador(const Carta *c1, const Carta *c2, int *v1, int *v2, int *empates) {
+    printf("Super poder Jogador 1: %.2f | Super poder Computador: %.2f\n", c1->super_poder, c2->super_poder);
+    int r = comparar_super_poder(c1, c2);
+    if (r > 0) {
         set_color(32); // Verde para vitória do jogador
         printf("Jogador 1 venceu o turno!\n");
         reset_color();
         (*v1)++;
-    } else if (sp2 > sp1) {
+    } else if (r < 0) {
         set_color(31); // Vermelho para vitória do computador
         printf("Computador venceu o turno!\n");
         reset_color();
@@ -836,7 +6252,11 @@ void exibe_menu_principal() {
     printf("║ 3 - Exibir cartas cadastradas              ║\n");
     printf("║ 4 - Apagar cartas                          ║\n");
     printf("║ 5 - Exibir estatísticas                    ║\n");
-    printf("║ 6 - Salvar e sair                          ║\n");
+    printf("║ 6 - Catálogo de baralhos                   ║\n");
+    printf("║ 7 - Consultar cartas                       ║\n");
+    printf("║ 8 - Exportar dados                         ║\n");
+    printf("║ 9 - Versões (desfazer/refazer)             ║\n");
+    printf("║ 0 - Salvar e sair                          ║\n");
     printf("╚════════════════════════════════════════════╝\n");
     reset_color();
 }
@@ -850,6 +6270,7 @@ void exibe_menu_antes_do_batalha() {
     printf("╚════════════════════════════════════════════╝\n");
     printf("║ 1 - Modo de Jogo: 1x1                      ║\n");
     printf("║ 2 - Modo de Jogo: 1xComputador             ║\n");
+    printf("║ 0 - Voltar ao menu principal               ║\n");
     printf("╚════════════════════════════════════════════╝\n");
     reset_color();
 }
@@ -861,8 +6282,10 @@ void exibe_menu_batalha() {
     printf("╔════════════════════════════════════════════╗\n");
     printf("║                MENU DE BATALHA             ║\n");
     printf("╚════════════════════════════════════════════╝\n");
-    printf("║ digite \"desistir\" para desistir do turno   ║\n");
-    printf("║ digite \"sair\" e aperte Enter 2x para sair  ║\n");
+    char linha[64];
+    snprintf(linha, sizeof(linha), " 1-%d - escolhe a carta (uma tecla)", CARTAS_POR_JOGADOR);
+    printf("║%-44s║\n", linha);
+    printf("║ d - desiste do turno | s ou Esc - sai      ║\n");
     printf("╚════════════════════════════════════════════╝\n");
     reset_color();
 }
@@ -875,14 +6298,231 @@ void exibe_menu_cadastro() {
     printf("║          MENU DE CADASTRO DE CARTAS        ║\n");
     printf("╚════════════════════════════════════════════╝\n");
     printf("║ 1 - Cadastrar nova carta                   ║\n");
-    printf("║ 2 - Voltar ao menu principal               ║\n");
+    printf("║ 0 - Voltar ao menu principal               ║\n");
+    printf("╚════════════════════════════════════════════╝\n");
+    reset_color();
+}
+
+// exibe_menu_catalogo: mostra opções do catálogo de baralhos
+
+void exibe_menu_catalogo() {
+    set_color(36);
+    printf("╔════════════════════════════════════════════╗\n");
+    printf("║            CATÁLOGO DE BARALHOS            ║\n");
+    printf("╚════════════════════════════════════════════╝\n");
+    printf("║ 1 - Listar baralhos                        ║\n");
+    printf("║ 2 - Salvar baralho atual no catálogo       ║\n");
+    printf("║ 3 - Carregar baralho do catálogo           ║\n");
+    printf("║ 4 - Consultar baralho do catálogo          ║\n");
+    printf("║ 0 - Voltar ao menu principal               ║\n");
+    printf("╚════════════════════════════════════════════╝\n");
+    reset_color();
+}
+
+// exibe_menu_versoes: mostra opções do histórico de versões
+
+void exibe_menu_versoes() {
+    set_color(36);
+    printf("╔════════════════════════════════════════════╗\n");
+    printf("║            VERSÕES DO BARALHO              ║\n");
+    printf("╚════════════════════════════════════════════╝\n");
+    printf("║ 1 - Desfazer                               ║\n");
+    printf("║ 2 - Refazer                                ║\n");
+    printf("║ 3 - Salvar versão nomeada                  ║\n");
+    printf("║ 4 - Listar versões                         ║\n");
+    printf("║ 5 - Comparar versões                       ║\n");
+    printf("║ 6 - Restaurar versão                       ║\n");
+    printf("║ 0 - Voltar ao menu principal               ║\n");
     printf("╚════════════════════════════════════════════╝\n");
     reset_color();
 }
 
+// menu_catalogo:
+// - Salva o baralho atual como baralho nomeado (em shards) ou substitui
+//   o baralho atual por um baralho do catálogo.
+
+void menu_catalogo(Baralho *baralho, Historico *historico) {
+    Catalogo cat;
+    char nome[64];
+    for (;;) {
+        carregar_catalogo(&cat);
+        exibe_menu_catalogo();
+        int op = ler_opcao("Escolha uma opção: ", 4, 1);
+        if (op == 1) {
+            exibir_catalogo(&cat);
+        } else if (op == 2) {
+            if (!ler_texto_prompt("Nome do baralho (letras, dígitos, _ ou -): ", nome, sizeof(nome)) || !valida_nome_baralho(nome)) {
+                printf("Nome inválido.\n");
+            } else {
+                int n_shards = ler_inteiro_prompt("Quantidade de shards: ");
+                if (salvar_baralho_catalogo(&cat, nome, baralho->cartas, baralho->n, n_shards)) {
+                    set_color(32);
+                    printf("Baralho '%s' salvo no catálogo.\n", nome);
+                    reset_color();
+                } else {
+                    printf("Erro ao salvar o baralho no catálogo!\n");
+                }
+            }
+        } else if (op == 3) {
+            Baralho novo;
+            if (!ler_texto_prompt("Nome do baralho: ", nome, sizeof(nome)) || !valida_nome_baralho(nome)) {
+                printf("Nome inválido.\n");
+            } else {
+                int lidos = carregar_baralho_catalogo(&cat, nome, &novo, NULL, NULL);
+                if (lidos <= 0) {
+                    printf("Baralho não encontrado ou com erro de leitura.\n");
+                } else {
+                    baralho_liberar(baralho);
+                    *baralho = novo;
+                    baralho_modificado(baralho);
+                    char descricao[MAX_DESCRICAO_VERSAO];
+                    snprintf(descricao, sizeof(descricao), "carga do baralho '%.*s'", MAX_NOME_BARALHO, nome);
+                    historico_substituir(historico, baralho->cartas, baralho->n, descricao);
+                    printf("%d cartas carregadas de %d shards.\n", baralho->n, lidos);
+                }
+            }
+        } else if (op == 4) {
+            char consulta[256];
+            if (!ler_texto_prompt("Nome do baralho: ", nome, sizeof(nome)) || !valida_nome_baralho(nome)) {
+                printf("Nome inválido.\n");
+            } else if (ler_texto_prompt("Consulta (ex: estado=A populacao>=100000 ordem=-pib limite=10): ", consulta, sizeof(consulta))) {
+                consultar_catalogo(nome, consulta);
+            }
+        } else if (op == 0) {
+            liberar_catalogo(&cat);
+            return;
+        } else {
+            printf("Opção inválida.\n");
+        }
+        liberar_catalogo(&cat);
+    }
+}
+
+// menu_versoes:
+// - Desfaz/refaz cadastros, remoções e cargas do catálogo.
+// - Versões nomeadas valem para a sessão; para guardar em disco use o catálogo.
+
+void menu_versoes(Historico *h, Baralho *baralho) {
+    char nome[MAX_DESCRICAO_VERSAO], outro[MAX_DESCRICAO_VERSAO];
+    for (;;) {
+        if (!h->atual) {
+            printf("Histórico de versões indisponível.\n");
+            return;
+        }
+        exibe_menu_versoes();
+        int op = ler_opcao("Escolha uma opção: ", 6, 1);
+        if (op == 1 || op == 2) {
+            const char *feito = op == 1 ? historico_desfazer(h, baralho) : historico_refazer(h, baralho);
+            if (feito) printf("%s: %s (%d cartas).\n", op == 1 ? "Desfeito" : "Refeito", feito, baralho->n);
+            else if ((op == 1 ? h->n_desfazer : h->n_refazer) == 0) printf("Nada para %s.\n", op == 1 ? "desfazer" : "refazer");
+            else printf("Memória insuficiente para %s.\n", op == 1 ? "desfazer" : "refazer");
+        } else if (op == 3) {
+            if (!ler_texto_prompt("Nome da versão: ", nome, sizeof(nome)) || nome[0] == '\0') {
+                printf("Nome inválido.\n");
+            } else if (historico_nomear(h, nome)) {
+                set_color(32);
+                printf("Versão '%s' salva (%d cartas).\n", nome, baralho->n);
+                reset_color();
+            } else {
+                printf("Limite de %d versões nomeadas atingido.\n", MAX_VERSOES_NOMEADAS);
+            }
+        } else if (op == 4) {
+            printf("Atual: %d cartas em %d blocos.\n", h->atual->n_cartas, h->atual->n_blocos);
+            if (h->n_desfazer > 0) printf("Desfazer (%d): %s\n", h->n_desfazer, h->desfazer[h->n_desfazer - 1].descricao);
+            if (h->n_refazer > 0) printf("Refazer (%d): %s\n", h->n_refazer, h->refazer[h->n_refazer - 1].descricao);
+            for (int i = 0; i < h->n_nomeadas; ++i) {
+                const Versao *v = h->nomeadas[i].versao;
+                printf("%-20s | %d cartas | %d de %d blocos em comum com a atual\n", h->nomeadas[i].descricao,
+                       v->n_cartas, blocos_compartilhados(v, h->atual), v->n_blocos);
+            }
+            int blocos = historico_memoria(h);
+            printf("Memória do histórico: %d blocos distintos (%.1f MB).\n", blocos,
+                   (double)blocos * sizeof(BlocoVersao) / (1024.0 * 1024.0));
+        } else if (op == 5) {
+            ler_texto_prompt("Versão de origem (vazio = atual): ", nome, sizeof(nome));
+            ler_texto_prompt("Versão de destino (vazio = atual): ", outro, sizeof(outro));
+            const Versao *a = historico_buscar(h, nome), *b = historico_buscar(h, outro);
+            if (!a || !b) printf("Versão não encontrada.\n");
+            else if (!historico_comparar(h, a, b)) printf("Memória insuficiente para comparar.\n");
+        } else if (op == 6) {
+            if (!ler_texto_prompt("Nome da versão: ", nome, sizeof(nome)) || !historico_buscar(h, nome) || nome[0] == '\0') {
+                printf("Versão não encontrada.\n");
+            } else if (historico_restaurar(h, nome, baralho)) {
+                printf("Versão '%s' restaurada (%d cartas).\n", nome, baralho->n);
+            } else {
+                printf("Memória insuficiente para restaurar.\n");
+            }
+        } else if (op == 0) {
+            return;
+        } else {
+            printf("Opção inválida.\n");
+        }
+    }
+}
+
+// menu_exportar: pergunta o que exportar, o formato e o destino.
+
+void menu_exportar(Baralho *baralho, const Estatisticas *estat) {
+    char formato_txt[16], arquivo[256];
+    int op = ler_opcao("Exportar 1 - cartas, 2 - estatísticas ou 0 - voltar: ", 2, 1);
+    if (op == 0) return;
+    if (op != 1 && op != 2) { printf("Opção inválida.\n"); return; }
+    if (!ler_texto_prompt("Formato (csv, jsonl, colunas): ", formato_txt, sizeof(formato_txt))) return;
+    int formato = interpretar_formato(formato_txt);
+    if (formato < 0) { printf("Formato inválido.\n"); return; }
+    if (!ler_texto_prompt("Arquivo de saída ('-' para a tela): ", arquivo, sizeof(arquivo)) || arquivo[0] == '\0') return;
+
+    double inicio = relogio_seg();
+    long long bytes = op == 1 ? exportar_dados(arquivo, formato, baralho->cartas, baralho->n, NULL)
+                              : exportar_dados(arquivo, formato, NULL, 0, estat);
+    if (bytes < 0) printf("Erro ao exportar para %s.\n", arquivo);
+    else printf("%lld bytes exportados em %.2f s.\n", bytes, relogio_seg() - inicio);
+}
+
+// menu_ocioso: tarefa dos menus enquanto nenhuma tecla chega (só no
+// terminal). Se o autosave concluiu algo, apaga a linha do prompt, mostra o
+// relato e retorna 1 para ler_opcao redesenhar o prompt; senão não escreve nada.
+
+static int menu_ocioso(void *ctx) {
+    Autosave *as = (Autosave *)ctx;
+    if (!autosave_tem_relato(as)) return 0;
+    printf("\r\033[K");
+    return autosave_relatar(as);
+}
+
+// publicar_alteracao: publica o baralho se ele mudou desde a última
+// publicação e avisa o autosave.
+
+static void publicar_alteracao(Publicacao *p, Baralho *b, Autosave *as, uint32_t *versao_publicada) {
+    if (b->versao == *versao_publicada) return;
+    if (!publicar_baralho(p, b)) {
+        printf("Memória insuficiente para publicar o baralho; leituras usam a versão anterior.\n");
+        return;
+    }
+    *versao_publicada = b->versao;
+    autosave_agendar(as);
+}
+
+// ler_instantaneo: aponta 'leitura' para a cópia contínua do instantâneo
+// (sem instantâneo, mantém o baralho em edição). 0 se faltar memória.
+
+static int ler_instantaneo(const Instantaneo *snap, Baralho *leitura) {
+    if (!snap) return 1;
+    Carta *cartas = instantaneo_cartas(snap);
+    if (!cartas) {
+        printf("Memória insuficiente para ler o baralho publicado.\n");
+        return 0;
+    }
+    *leitura = (Baralho){ cartas, snap->n, snap->n, snap->versao, 0, 0 };
+    return 1;
+}
+
 // main principal da partida:
 
 // Função auxiliar: lê escolha de carta permitindo comandos "desistir" e "sair".
+// No terminal basta uma tecla: 1-N escolhe, 'd' desiste, 's' ou Esc sai; o
+// prompt é redesenhado a cada segundo com o tempo do turno. Sem terminal,
+// cada linha é um número, "desistir" (ou "d") ou "sair" (ou "s").
 
 // Resultados para desicao do progama:
 //  >=0 : índice 0-based escolhido
@@ -894,20 +6534,38 @@ void exibe_menu_cadastro() {
 static int escolher_carta_comandos(Jogador *j, int jogador_id, int *cmd) {
     char buf[256];
 
+    if (entrada.cru) {
+        time_t inicio = time(NULL);
+        for (;;) {
+            set_color(jogador_id == 0 ? 32 : 34);
+            printf("\r\033[KJogador %d, escolha a carta (1-%d, d = desistir, s = sair) [%ld s]: ",
+                   jogador_id + 1, j->cartas_restantes, (long)(time(NULL) - inicio));
+            reset_color();
+            int t = tecla_ler(ENTRADA_INTERVALO_MS);
+            if (t == TECLA_TEMPO) continue; // só redesenha o tempo
+            if (t == TECLA_FIM || t == TECLA_ESC || t == 's' || t == 'S') { printf("sair\n"); *cmd = CMD_SAIR; return -1; }
+            if (t == 'd' || t == 'D') { printf("desistir\n"); *cmd = CMD_DESISTIR; return -1; }
+            if (t >= '1' && t <= '0' + j->cartas_restantes) {
+                printf("%c\n", t);
+                *cmd = CMD_ESCOLHA;
+                return t - '1';
+            }
+        }
+    }
+
     // Loop até receber escolha válida ou comando
     for (;;) {
         set_color(jogador_id == 0 ? 32 : 34);
         printf("Jogador %d, escolha a carta: (1-%d)",
                jogador_id + 1, j->cartas_restantes);
         reset_color();
-        if (!fgets(buf, sizeof(buf), stdin)) { *cmd = 2; return -1; }
-        buf[strcspn(buf, "\n")] = '\0';
-        if (strcmp(buf, "sair") == 0) { *cmd = 2; return -1; }
-        if (strcmp(buf, "desistir") == 0) { *cmd = 1; return -1; }
+        if (!ler_linha(buf, sizeof(buf))) { *cmd = CMD_SAIR; return -1; }
+        if (strcmp(buf, "sair") == 0 || strcmp(buf, "s") == 0) { *cmd = CMD_SAIR; return -1; }
+        if (strcmp(buf, "desistir") == 0 || strcmp(buf, "d") == 0) { *cmd = CMD_DESISTIR; return -1; }
         char *end;
         long v = strtol(buf, &end, 10);
         if (end != buf && *end == '\0' && v >= 1 && v <= j->cartas_restantes) {
-            *cmd = 0;
+            *cmd = CMD_ESCOLHA;
             return (int)(v - 1);
         }
         printf("Escolha inválida.\n");
@@ -915,17 +6573,18 @@ static int escolher_carta_comandos(Jogador *j, int jogador_id, int *cmd) {
 }
 
 // Iniciar uma partida abre menu de modo de jogo e executa a batalha
-void jogar_partida(Carta *baralho, int n_cartas, Estatisticas *estat) {
+void jogar_partida(Carta *baralho, int n_cartas, const Distribuicao *dist, Estatisticas *estat) {
     exibe_menu_antes_do_batalha();
     int modo;
     while (1) {
-        modo = ler_inteiro_prompt("Escolha o modo: ");
+        modo = ler_opcao("Escolha o modo: ", 2, 1);
+        if (modo == 0) return; // 0, Esc ou fim da entrada
         if (modo == 1) {
-            jogar_partida_1x1(baralho, n_cartas, estat);
+            jogar_partida_1x1(baralho, n_cartas, dist, estat);
             return;
         }
         if (modo == 2) {
-            jogar_partida_1xComputador(baralho, n_cartas, estat);
+            jogar_partida_1xComputador(baralho, n_cartas, dist, estat);
             return;
         }
         if (modo < 1 || modo > 2) {
@@ -935,58 +6594,150 @@ void jogar_partida(Carta *baralho, int n_cartas, Estatisticas *estat) {
 }
 
 // main: loop principal do programa
-int main(void) {
-    srand((unsigned)time(NULL));
+// Argumentos opcionais (modo sem interface):
+//   --replay [arquivo] [repeticoes] : reverifica partidas gravadas
+//   --consulta "<consulta>" [baralho] : consulta cartas.bin ou um baralho do catálogo
+//   --servidor [porta|caminho]         : servidor multiplayer (Linux)
+//   --gerar <cartas> [arquivo] [passos] [alvo] : gera e equilibra um baralho sintético
+//   --exportar <csv|jsonl|colunas> [arquivo|-] : exporta cartas.bin ('-' = saída padrão)
+//   --estresse [leitores] [segundos] [cartas] : testa a publicação com leitores concorrentes
+//   --distribuir [partidas] [cartas]  : compara a distribuição uniforme com a equilibrada
+int main(int argc, char **argv) {
+    carregar_formula(ARQUIVO_FORMULA);
+    carregar_regras_distribuicao(ARQUIVO_DISTRIBUICAO);
+    if (argc >= 2 && strcmp(argv[1], "--replay") == 0) {
+        const char *arquivo = argc >= 3 ? argv[2] : ARQUIVO_REPLAYS;
+        int repeticoes = argc >= 4 ? atoi(argv[3]) : 0;
+        return verificar_replays(arquivo, repeticoes);
+    }
+#ifdef __linux__
+    if (argc >= 2 && strcmp(argv[1], "--servidor") == 0) {
+        char porta[16];
+        snprintf(porta, sizeof(porta), "%d", SERVIDOR_PORTA_PADRAO);
+        rng_sessao = (uint32_t)time(NULL) ^ 0x9E3779B9u;
+        return executar_servidor(argc >= 3 ? argv[2] : porta);
+    }
+#endif
+    if (argc >= 3 && strcmp(argv[1], "--gerar") == 0) {
+        const char *arquivo = argc >= 4 ? argv[3] : ARQUIVO_CARTAS;
+        int passos = argc >= 5 ? atoi(argv[4]) : OTIMIZADOR_PASSOS_PADRAO;
+        double alvo = argc >= 6 ? atof(argv[5]) : ALVO_ESPALHAMENTO_PADRAO;
+        return executar_gerador(atoi(argv[2]), arquivo, passos, alvo);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--exportar") == 0) {
+        int formato = interpretar_formato(argv[2]);
+        const char *arquivo = argc >= 4 ? argv[3] : "-";
+        if (formato < 0) {
+            fprintf(stderr, "Formato inválido: use csv, jsonl ou colunas.\n");
+            return 1;
+        }
+        Baralho b = {0};
+        carregar_cartas(&b);
+        double inicio = relogio_seg();
+        long long bytes = exportar_dados(arquivo, formato, b.cartas, b.n, NULL);
+        double seg = relogio_seg() - inicio;
+        // Resumo em stderr: stdout pode ser a própria exportação
+        if (bytes < 0) fprintf(stderr, "Erro ao exportar para %s.\n", arquivo);
+        else fprintf(stderr, "%d cartas exportadas (%lld bytes) em %.2f s (%.0f MB/s).\n",
+                     b.n, bytes, seg, seg > 0.0 ? bytes / seg / 1e6 : 0.0);
+        baralho_liberar(&b);
+        return bytes < 0 ? 1 : 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "--estresse") == 0) {
+        int leitores = argc >= 3 ? atoi(argv[2]) : 8;
+        double segundos = argc >= 4 ? atof(argv[3]) : ESTRESSE_SEGUNDOS_PADRAO;
+        int cartas = argc >= 5 ? atoi(argv[4]) : ESTRESSE_CARTAS_PADRAO;
+        return executar_estresse(leitores, segundos, cartas);
+    }
+    if (argc >= 2 && strcmp(argv[1], "--distribuir") == 0) {
+        int partidas = argc >= 3 ? atoi(argv[2]) : DISTRIBUICAO_PARTIDAS_PADRAO;
+        int cartas = argc >= 4 ? atoi(argv[3]) : 0;
+        return executar_distribuicao(partidas, cartas);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--consulta") == 0) {
+        if (argc >= 4) return consultar_catalogo(argv[3], argv[2]);
+        Baralho b = {0};
+        IndiceConsulta idx;
+        memset(&idx, 0, sizeof(idx));
+        carregar_cartas(&b);
+        consultar_baralho(&b, &idx, argv[2]);
+        liberar_indice_consulta(&idx);
+        baralho_liberar(&b);
+        return 0;
+    }
+
+    rng_sessao = (uint32_t)time(NULL) ^ 0x9E3779B9u;
 
-    Carta cartas[MAX_CARTAS];
-    memset(cartas, 0, sizeof(cartas));
-    int n_cartas = 0;
+    Baralho baralho = {0};
+    Historico historico;
+    Publicacao publicacao;
+    Autosave autosave;
+    IndiceConsulta indice_consulta;
+    memset(&indice_consulta, 0, sizeof(indice_consulta));
     Estatisticas estat = {0};
+    CacheDistribuicao cache_distribuicao = {0};
 
     // Tenta carregar cartas salvas
-    n_cartas = carregar_cartas(cartas);
-    if (n_cartas > 0) {
-        for (int i = 0; i < n_cartas; ++i) calcula_campos_derivados(&cartas[i]);
-        calcular_super_poder_normalizado(cartas, n_cartas);
-        printf("%d cartas carregadas do arquivo.\n", n_cartas);
+    // (campos derivados são calculados sob demanda, não na carga)
+    if (carregar_cartas(&baralho) > 0) {
+        printf("%d cartas carregadas do arquivo.\n", baralho.n);
     }
+    historico_iniciar(&historico, &baralho);
+    // Partidas, listagens, consultas e exportações leem o instantâneo publicado
+    publicacao_iniciar(&publicacao);
+    int leitor_menu = leitor_registrar(&publicacao);
+    uint32_t versao_publicada = baralho.versao;
+    if (!publicar_baralho(&publicacao, &baralho)) printf("Memória insuficiente para publicar o baralho.\n");
+    autosave_iniciar(&autosave, &publicacao);
+    entrada_iniciar();
+    entrada_ociosa(menu_ocioso, &autosave);
 
     // Loop principal
     while (1) {
+        // Qualquer alteração desde a última volta é publicada (e vai para o autosave)
+        publicar_alteracao(&publicacao, &baralho, &autosave, &versao_publicada);
+        autosave_relatar(&autosave);
+        const Instantaneo *snap = leitor_entrar(&publicacao, leitor_menu);
+        Baralho leitura = baralho; // sem instantâneo (faltou memória ao publicar): o baralho em edição
+
         exibe_nome_jogo();
         exibe_menu_principal();
-        printf("Escolha uma opção: ");
-        int opcao = ler_inteiro_prompt("");
+        int opcao = ler_opcao("Escolha uma opção: ", 9, 0);
 
         if (opcao == 1) {
             // Iniciar jogo
-            if (n_cartas < CARTAS_POR_JOGADOR * MAX_JOGADORES) {
+            if (!ler_instantaneo(snap, &leitura)) {
+                // sem memória para a cópia contínua (já avisado)
+            } else if (leitura.n < CARTAS_POR_JOGADOR * MAX_JOGADORES) {
                 printf("Cadastre pelo menos %d cartas para jogar!\n", CARTAS_POR_JOGADOR * MAX_JOGADORES);
-                continue;
+            } else {
+                jogar_partida(leitura.cartas, leitura.n, distribuicao_da_versao(&cache_distribuicao, &leitura), &estat);
             }
-            jogar_partida(cartas, n_cartas, &estat);
 
         } else if (opcao == 2) {
-            // Menu de cadastro de cartas
+            // Menu de cadastro de cartas. Cada cadastro publica um instantâneo
+            // novo: sem sair da leitura, o slot do menu impediria que os
+            // anteriores fossem liberados até a volta ao menu principal.
+            leitor_sair(&publicacao, leitor_menu);
                 for (;;) {
                 exibe_menu_cadastro();
-                printf("Escolha uma opção: ");
-                int op = ler_inteiro_prompt("");
+                int op = ler_opcao("Escolha uma opção: ", 1, 1);
                 if (op == 1) {
-                if (n_cartas >= MAX_CARTAS) {
+                if (!baralho_reservar(&baralho, baralho.n + 1)) {
                 printf("Capacidade máxima de cartas atingida.\n");
                 break;
                 }
                 
                     // garante string vazia antes do cadastro para detectar 'voltar'
-                    cartas[n_cartas].codigo[0] = '\0';
-                        cadastrar_carta(&cartas[n_cartas]);
-                        if (strlen(cartas[n_cartas].codigo) > 0) {
-                        calcula_campos_derivados(&cartas[n_cartas]);
-                        n_cartas++;
-                        calcular_super_poder_normalizado(cartas, n_cartas);
+                    baralho.cartas[baralho.n].codigo[0] = '\0';
+                        cadastrar_carta(&baralho.cartas[baralho.n]);
+                        if (strlen(baralho.cartas[baralho.n].codigo) > 0) {
+                        historico_inserir(&historico, &baralho.cartas[baralho.n]);
+                        baralho.n++;
+                        baralho_alterado(&baralho, baralho.n - 1, 1);
+                        publicar_alteracao(&publicacao, &baralho, &autosave, &versao_publicada);
                     }
-                        } else if (op == 2) {
+                        } else if (op == 0) {
                         break;
                         } else {
                         printf("Opção inválida.\n");
@@ -995,21 +6746,41 @@ int main(void) {
 
                 } else if (opcao == 3) {
                 // Exibir cartas cadastradas
-                exibir_cartas_resumido(cartas, n_cartas);
+                if (ler_instantaneo(snap, &leitura)) {
+                exibir_cartas_resumido(leitura.cartas, leitura.n);
                 printf("Deseja ver detalhes de alguma carta? (0 para não): ");
                 int idx = ler_inteiro_prompt("");
-                if (idx >= 1 && idx <= n_cartas) exibir_carta(&cartas[idx - 1]);
+                if (idx >= 1 && idx <= leitura.n) exibir_carta(&leitura.cartas[idx - 1]);
+                }
 
                      } else if (opcao == 4) {
                     // Apagar cartas
-                    apagar_carta(cartas, &n_cartas);
-                    if (n_cartas > 0) calcular_super_poder_normalizado(cartas, n_cartas);
+                    int apagada = apagar_carta(baralho.cartas, &baralho.n);
+                    if (apagada >= 0) {
+                        historico_apagar(&historico, apagada);
+                        baralho_alterado(&baralho, apagada, 0);
+                    }
 
                     } else if (opcao == 5) {
                         exibir_estatisticas(&estat);
-                        // Salvar e sair
                         } else if (opcao == 6) {
-                            salvar_cartas(cartas, n_cartas);
+                            leitor_sair(&publicacao, leitor_menu); // submenus usam o baralho em edição
+                            menu_catalogo(&baralho, &historico);
+                        } else if (opcao == 7) {
+                            char consulta[256];
+                            if (ler_instantaneo(snap, &leitura) &&
+                                ler_texto_prompt("Consulta (ex: estado=A populacao>=100000 ordem=-pib limite=10): ", consulta, sizeof(consulta)))
+                                consultar_baralho(&leitura, &indice_consulta, consulta);
+                        } else if (opcao == 8) {
+                            if (ler_instantaneo(snap, &leitura)) menu_exportar(&leitura, &estat);
+                        } else if (opcao == 9) {
+                            leitor_sair(&publicacao, leitor_menu);
+                            menu_versoes(&historico, &baralho);
+                        // Salvar e sair
+                        } else if (opcao == 0) { // tecla 0 ou fim da entrada
+                            leitor_sair(&publicacao, leitor_menu);
+                            autosave_encerrar(&autosave); // não concorrer com a gravação final
+                            salvar_cartas(baralho.cartas, baralho.n);
                             set_color(33);
                             printf("Saindo...\n");
                             reset_color();
@@ -1018,7 +6789,13 @@ int main(void) {
                         } else {
                             printf("Opção inválida.\n");
                             }
+        leitor_sair(&publicacao, leitor_menu);
                 }
 
+    liberar_indice_consulta(&indice_consulta);
+    if (cache_distribuicao.pronta) liberar_distribuicao(&cache_distribuicao.d);
+    publicacao_encerrar(&publicacao);
+    historico_liberar(&historico);
+    baralho_liberar(&baralho);
     return 0;
 }
\ No newline at end of file